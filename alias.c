@@ -0,0 +1,401 @@
+//alias.c
+#include "alias.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ALIAS_TABLE_INIT_CAP 64   // must be a power of 2
+
+/*=============================================================================
+* global variables & data structures
+=============================================================================*/
+// open addressing (linear probing) table of definitions, keyed by name
+static alias_def **table = NULL;
+static size_t table_cap  = 0;
+static size_t table_used = 0;
+
+// bumped by every cycle check, a definition with visit == visit_gen was seen
+static unsigned visit_gen = 0;
+
+/*=============================================================================
+* hash table helpers
+=============================================================================*/
+
+// FNV-1a
+static size_t hash_name(const char *s)
+{
+    size_t h = (size_t)14695981039346656037ULL;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= (size_t)1099511628211ULL;
+    }
+    return h;
+}
+
+static char* copy_str(const char *s)
+{
+    size_t len = strlen(s) + 1;
+    char *p = (char*)malloc(len);
+    if (p)
+        memcpy(p, s, len);
+    return p;
+}
+
+static size_t find_slot(alias_def **tab, size_t cap, const char *name)
+{
+    size_t i = hash_name(name) & (cap - 1);
+    while (tab[i] != NULL && strcmp(tab[i]->name, name) != 0)
+        i = (i + 1) & (cap - 1);
+    return i;
+}
+
+static int grow_table(void)
+{
+    size_t new_cap = table_cap ? table_cap * 2 : ALIAS_TABLE_INIT_CAP;
+    alias_def **new_tab = (alias_def**)calloc(new_cap, sizeof(alias_def*));
+    if (!new_tab)
+        return -1;
+
+    for (size_t i = 0; i < table_cap; ++i) {
+        if (table[i])
+            new_tab[find_slot(new_tab, new_cap, table[i]->name)] = table[i];
+    }
+    free(table);
+    table     = new_tab;
+    table_cap = new_cap;
+    return 0;
+}
+
+// empty slot `hole`, shifting later entries of its probe run back (no tombstones)
+static void remove_slot(size_t hole)
+{
+    size_t mask = table_cap - 1;
+    size_t i = hole;
+    while (1) {
+        i = (i + 1) & mask;
+        if (table[i] == NULL)
+            break;
+        size_t home = hash_name(table[i]->name) & mask;
+        // move i into the hole unless its home lies cyclically in (hole, i]
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            table[hole] = table[i];
+            hole = i;
+        }
+    }
+    table[hole] = NULL;
+    table_used--;
+}
+
+static void free_def(alias_def *d)
+{
+    free(d->name);
+    free(d->block);
+    free(d);
+}
+
+// d left the table: freed now, or by the last alias_release
+static void unlist(alias_def *d)
+{
+    d->listed = false;
+    if (d->refs == 0)
+        free_def(d);
+}
+
+/*=============================================================================
+* cycle check
+=============================================================================*/
+
+static int command_leads_to(arena *a, const char *name, const command *c);
+
+// every command of a parsed line, as command_leads_to
+static int line_leads_to(arena *a, const char *name, const cmd_line *cl)
+{
+    for (int p = 0; p < cl->nchain; ++p) {
+        const pipeline *pl = &cl->chain[p];
+        for (int k = 0; k < pl->nstages; ++k) {
+            int r = command_leads_to(a, name, &pl->stages[k]);
+            if (r != 0)
+                return r;
+        }
+    }
+    return 0;
+}
+
+// alias d run as command c: its line, c's arguments appended to the last command
+static int alias_leads_to(arena *a, const char *name, alias_def *d, const command *c)
+{
+    int extra = c->argc - 1;
+    if (extra == 0) {
+        if (d->visit == visit_gen)
+            return 0;   // already known not to
+        d->visit = visit_gen;
+        return line_leads_to(a, name, &d->line);
+    }
+
+    if (d->line.nchain == 0) {
+        command rest = { c->argv + 1, extra, false, NULL, 0 };   // empty alias: the arguments run
+        return command_leads_to(a, name, &rest);
+    }
+
+    const pipeline *tail = &d->line.chain[d->line.nchain - 1];
+    const command *last = &tail->stages[tail->nstages - 1];
+    for (int p = 0; p < d->line.nchain; ++p) {
+        const pipeline *pl = &d->line.chain[p];
+        for (int k = 0; k < pl->nstages; ++k) {
+            command s = pl->stages[k];
+            if (&pl->stages[k] == last) {
+                char **argv = (char**)arena_alloc(a, (size_t)(s.argc + extra + 1) * sizeof(char*));
+                if (!argv)
+                    return -1;
+                memcpy(argv, s.argv, (size_t)s.argc * sizeof(char*));
+                memcpy(argv + s.argc, c->argv + 1, (size_t)(extra + 1) * sizeof(char*));
+                s.argv  = argv;
+                s.argc += extra;
+            }
+            int r = command_leads_to(a, name, &s);
+            if (r != 0)
+                return r;
+        }
+    }
+    return 0;
+}
+
+// time and submit run the rest of their words, after their options: index
+// of the first one, 0 = c is neither or names no command
+static int runs_words_from(const command *c)
+{
+    int i = 1;
+    if (strcmp(c->argv[0], "time") == 0) {
+        for (; i < c->argc && c->argv[i][0] == '-'; ++i) {
+            if (strcmp(c->argv[i], "-f") == 0) {
+                ++i;
+            } else if (strcmp(c->argv[i], "--") == 0) {
+                ++i;
+                break;
+            }
+        }
+    } else if (strcmp(c->argv[0], "submit") == 0) {
+        while (i < c->argc && c->argv[i][0] == '-')
+            i += 2;   // -p prio, --after ids
+    } else {
+        return 0;
+    }
+    return i < c->argc ? i : 0;
+}
+
+// can running c end up running alias name again? 1 = yes, -1 = out of memory
+static int command_leads_to(arena *a, const char *name, const command *c)
+{
+    if (c->argc == 0)
+        return 0;
+
+    if (!c->no_alias) {
+        if (strcmp(c->argv[0], name) == 0)
+            return 1;
+        alias_def *d = alias_find(c->argv[0]);
+        if (d != NULL)
+            return alias_leads_to(a, name, d, c);
+    }
+
+    // a builtin that runs its arguments: that command is expanded at run time
+    int i = runs_words_from(c);
+    if (i == 0)
+        return 0;
+    if (i < c->argc - 1) {
+        command rest = { c->argv + i, c->argc - i, false, NULL, 0 };
+        return command_leads_to(a, name, &rest);
+    }
+
+    // one word is a command line of its own
+    cmd_line cl;
+    char *line = arena_strndup(a, c->argv[i], strlen(c->argv[i]));
+    if (!line)
+        return -1;
+    if (parse_line(a, line, &cl) == -1)
+        return 0;   // never runs anything
+    return line_leads_to(a, name, &cl);
+}
+
+/*=============================================================================
+* API
+=============================================================================*/
+
+alias_def* alias_find(const char *name)
+{
+    if (table_used == 0)
+        return NULL;
+    return table[find_slot(table, table_cap, name)];
+}
+
+int alias_set(arena *a, const char *name, char *value)
+{
+    cmd_line parsed;
+    if (parse_line(a, value, &parsed) == -1)
+        return -1;
+
+    // the alias's own name at the start of a command is the real command
+    for (int p = 0; p < parsed.nchain; ++p) {
+        pipeline *pl = &parsed.chain[p];
+        for (int k = 0; k < pl->nstages; ++k)
+            pl->stages[k].no_alias = strcmp(pl->stages[k].argv[0], name) == 0;
+    }
+
+    // the other commands must not lead back to it (the rest of the table has no
+    // cycles), nor the commands time / submit run for them
+    visit_gen++;
+    for (int p = 0; p < parsed.nchain; ++p) {
+        pipeline *pl = &parsed.chain[p];
+        for (int k = 0; k < pl->nstages; ++k) {
+            command *c = &pl->stages[k];
+            int r = command_leads_to(a, name, c);
+            if (r == -1) {
+                fprintf(stderr, "smash error: alias: malloc failed\n");
+                return -1;
+            }
+            if (r == 1) {
+                fprintf(stderr, "smash error: alias: %s: expands into itself through '%s'\n",
+                        name, c->argv[0]);
+                return -1;
+            }
+        }
+    }
+
+    alias_def *d = (alias_def*)calloc(1, sizeof(alias_def));
+    if (d)
+        d->name = copy_str(name);
+    if (d && d->name)
+        d->block = cmd_line_clone(&parsed, &d->line);
+
+    int full = (table_used + 1) * 10 >= table_cap * 7;
+    if (!d || !d->name || !d->block || (full && grow_table() == -1)) {
+        fprintf(stderr, "smash error: alias: malloc failed\n");
+        if (d)
+            free_def(d);
+        return -1;
+    }
+    d->listed = true;
+
+    size_t i = find_slot(table, table_cap, name);
+    if (table[i])
+        unlist(table[i]);   // redefined
+    else
+        table_used++;
+    table[i] = d;
+    return 0;
+}
+
+int alias_unset(const char *name)
+{
+    if (table_used == 0)
+        return 0;
+
+    size_t i = find_slot(table, table_cap, name);
+    alias_def *d = table[i];
+    if (d == NULL)
+        return 0;
+
+    remove_slot(i);
+    unlist(d);
+    return 1;
+}
+
+int alias_expand(arena *a, const alias_def *d, const command *c, bool background, cmd_line *out)
+{
+    int extra = c->argc - 1;
+    *out = d->line;
+    if (extra == 0 && !background)
+        return 0;   // the stored line as is
+
+    if (d->line.nchain == 0) {
+        // empty alias: the arguments are the command
+        if (extra == 0)
+            return 0;
+        pipeline *pl = (pipeline*)arena_alloc(a, sizeof(pipeline));
+        command *cmd = (command*)arena_alloc(a, sizeof(command));
+        if (!pl || !cmd)
+            return -1;
+        cmd->argv     = c->argv + 1;
+        cmd->argc     = extra;
+        cmd->no_alias = false;
+        cmd->redirs   = NULL;   // the command's own ones are applied around the expansion
+        cmd->nredirs  = 0;
+        pl->stages     = cmd;
+        pl->nstages    = 1;
+        pl->background = background;
+        pl->text       = NULL;
+        out->chain  = pl;
+        out->nchain = 1;
+    } else {
+        // copies of the last pipeline and its last command, the rest is shared
+        int np = d->line.nchain;
+        pipeline *chain = (pipeline*)arena_alloc(a, (size_t)np * sizeof(pipeline));
+        if (!chain)
+            return -1;
+        memcpy(chain, d->line.chain, (size_t)np * sizeof(pipeline));
+
+        pipeline *pl = &chain[np - 1];
+        command *stages = (command*)arena_alloc(a, (size_t)pl->nstages * sizeof(command));
+        if (!stages)
+            return -1;
+        memcpy(stages, pl->stages, (size_t)pl->nstages * sizeof(command));
+        pl->stages = stages;
+
+        command *last = &stages[pl->nstages - 1];
+        char **argv = (char**)arena_alloc(a, (size_t)(last->argc + extra + 1) * sizeof(char*));
+        if (!argv)
+            return -1;
+        memcpy(argv, last->argv, (size_t)last->argc * sizeof(char*));
+        memcpy(argv + last->argc, c->argv + 1, (size_t)(extra + 1) * sizeof(char*));   // NULL too
+        last->argv  = argv;
+        last->argc += extra;
+
+        pl->background = pl->background || background;
+        out->chain = chain;
+    }
+
+    // the job list shows what actually runs: the alias's text + the arguments [+ &]
+    pipeline *pl = &out->chain[out->nchain - 1];
+    const char *base = pl->text ? pl->text : "";
+    size_t base_len = strlen(base);
+    if (base_len > 0 && base[base_len - 1] == '&') {
+        base_len--;
+        while (base_len > 0 && (base[base_len - 1] == ' ' || base[base_len - 1] == '\t'))
+            base_len--;
+    }
+
+    size_t len = base_len + 3;
+    for (int i = 1; i <= extra; ++i)
+        len += strlen(c->argv[i]) + 1;
+
+    char *text = (char*)arena_alloc(a, len);
+    if (!text)
+        return -1;
+    char *w = text;
+    memcpy(w, base, base_len);
+    w += base_len;
+    for (int i = 1; i <= extra; ++i) {
+        if (w != text)
+            *w++ = ' ';
+        size_t n = strlen(c->argv[i]);
+        memcpy(w, c->argv[i], n);
+        w += n;
+    }
+    if (pl->background) {
+        memcpy(w, " &", 2);
+        w += 2;
+    }
+    *w = '\0';
+    pl->text = text;
+    return 0;
+}
+
+void alias_hold(alias_def *d)
+{
+    d->refs++;
+}
+
+void alias_release(alias_def *d)
+{
+    if (--d->refs == 0 && !d->listed)
+        free_def(d);
+}
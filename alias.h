@@ -0,0 +1,56 @@
+#ifndef ALIAS_H
+#define ALIAS_H
+
+#include <stdbool.h>
+#include "arena.h"
+#include "parser.h"
+
+/*=============================================================================
+* aliases (alias / unalias builtins)
+*
+*  - name -> command line, in an open addressing hash table
+*  - the value is parsed once, when the alias is defined; expanding it is one
+*    lookup plus splicing the command's arguments onto the stored argv
+*  - a definition that would make an alias expand into itself (directly,
+*    through other aliases or through the command time / submit run) is
+*    rejected, so expansion always terminates.
+*    A command that starts with the alias's own name (alias ls='ls -F')
+*    runs that name as is, like bash does
+=============================================================================*/
+
+typedef struct alias_def {
+    char *name;
+    cmd_line line;        // the parsed value, all in one malloc'd block
+    void *block;
+    int refs;             // expansions running right now (see alias_hold)
+    bool listed;          // still in the table (not unaliased / redefined)
+    unsigned visit;       // cycle check bookkeeping
+} alias_def;
+
+/*
+ * Define (or redefine) name as value. value is parsed in place, with a, and
+ * may be reused afterwards. returns 0, or -1 if the value does not parse or
+ * the alias would expand into itself (message printed)
+ */
+int alias_set(arena *a, const char *name, char *value);
+
+// drop name, returns 0 if it was not defined
+int alias_unset(const char *name);
+
+// the alias called name, NULL if there is none
+alias_def* alias_find(const char *name);
+
+/*
+ * The line command c (argv[0] is d's name) stands for: the alias's line with
+ * c's arguments appended to its last command, in the background if asked.
+ * Whatever has to differ from d's own line is built in a.
+ * returns 0, or -1 if out of memory
+ */
+int alias_expand(arena *a, const alias_def *d, const command *c, bool background, cmd_line *out);
+
+// keep d (and every line alias_expand built from it) alive while it runs,
+// even if it is unaliased or redefined meanwhile
+void alias_hold(alias_def *d);
+void alias_release(alias_def *d);
+
+#endif /* ALIAS_H */
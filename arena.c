@@ -0,0 +1,102 @@
+//arena.c
+#include "arena.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_CHUNK_SIZE (64 * 1024)   // first chunk, later ones double
+#define ARENA_ALIGN      16
+
+/*=============================================================================
+* structs
+=============================================================================*/
+struct arena_chunk {
+    arena_chunk *next;
+    size_t size;          // bytes in data
+    size_t used;
+    char data[];
+};
+
+/*=============================================================================
+* helpers
+=============================================================================*/
+
+// offset in c->data where an allocation may start
+static size_t aligned_used(const arena_chunk *c)
+{
+    uintptr_t p = (uintptr_t)(c->data + c->used);
+    return c->used + (size_t)((ARENA_ALIGN - p % ARENA_ALIGN) % ARENA_ALIGN);
+}
+
+static int fits(const arena_chunk *c, size_t size)
+{
+    size_t off = aligned_used(c);
+    return off <= c->size && size <= c->size - off;
+}
+
+static arena_chunk* new_chunk(size_t size)
+{
+    arena_chunk *c = (arena_chunk*)malloc(sizeof(arena_chunk) + size);
+    if (!c)
+        return NULL;
+    c->next = NULL;
+    c->size = size;
+    c->used = 0;
+    return c;
+}
+
+/*=============================================================================
+* API
+=============================================================================*/
+
+void* arena_alloc(arena *a, size_t size)
+{
+    if (a->cur == NULL) {
+        size_t first = ARENA_CHUNK_SIZE;
+        while (first < size + ARENA_ALIGN)
+            first *= 2;
+        a->first = a->cur = new_chunk(first);
+        if (!a->cur)
+            return NULL;
+    }
+
+    // chunks after cur were used before the last reset: take them over again
+    while (!fits(a->cur, size) && a->cur->next && fits(a->cur->next, size)) {
+        a->cur = a->cur->next;
+        a->cur->used = 0;
+    }
+
+    if (!fits(a->cur, size)) {
+        size_t grown = a->cur->size * 2;
+        while (grown < size + ARENA_ALIGN)
+            grown *= 2;
+
+        arena_chunk *c = new_chunk(grown);
+        if (!c)
+            return NULL;
+        c->next = a->cur->next;   // the too-small one stays usable for the next line
+        a->cur->next = c;
+        a->cur = c;
+    }
+
+    size_t off = aligned_used(a->cur);
+    a->cur->used = off + size;
+    return a->cur->data + off;
+}
+
+char* arena_strndup(arena *a, const char *s, size_t n)
+{
+    char *copy = (char*)arena_alloc(a, n + 1);
+    if (!copy)
+        return NULL;
+    memcpy(copy, s, n);
+    copy[n] = '\0';
+    return copy;
+}
+
+void arena_reset(arena *a)
+{
+    a->cur = a->first;
+    if (a->cur)
+        a->cur->used = 0;
+}
@@ -0,0 +1,33 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/*=============================================================================
+* bump allocator for per-line data
+*
+*  - allocations are carved out of large chunks, nothing is freed one by one
+*  - arena_reset drops everything in O(1); the chunks stay for the next line,
+*    so in the steady state a line costs no malloc at all
+*  - a chunk that is too small for a request gets a bigger one after it
+=============================================================================*/
+
+typedef struct arena_chunk arena_chunk;
+
+typedef struct arena {
+    arena_chunk *first;
+    arena_chunk *cur;     // chunk allocations come from
+} arena;
+
+#define ARENA_INIT { NULL, NULL }
+
+// size bytes aligned for any type, NULL if out of memory
+void* arena_alloc(arena *a, size_t size);
+
+// copy of the n bytes at s plus a '\0', NULL if out of memory
+char* arena_strndup(arena *a, const char *s, size_t n);
+
+// forget every allocation (the memory is reused)
+void arena_reset(arena *a);
+
+#endif /* ARENA_H */
@@ -0,0 +1,630 @@
+//bench.c
+// macro benchmarks: smash run under a pty, driven like a user at the terminal
+// usage: bench [-n count] [-m diff_mb] [-s save.json] [-c baseline.json] [-t pct] smash_path
+//
+//  - every sample is one line typed at the prompt (or a CTRL+Z), timed from the
+//    write to the pty until smash prints its next prompt
+//  - each workload runs in a fresh smash; percentiles are over its samples
+//  - -s writes the results as JSON, -c compares the p50 of every workload with
+//    a saved run: exit status 1 if one got slower by more than -t percent
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define PROMPT        "smash > "
+#define OUT_BUF       (64 * 1024)
+#define TIMEOUT_MS    30000     // one sample; diff of a big cold file included
+#define MAX_LINE      4000      // a canonical-mode pty line holds 4095 bytes
+#define ALIAS_DEPTH   16
+#define NS_PER_US     1000.0
+
+/*=============================================================================
+* structs
+=============================================================================*/
+
+// one smash under a pty
+typedef struct session {
+    pid_t pid;
+    int fd;                   // pty master
+    char buf[OUT_BUF];        // output not matched yet
+    size_t len;
+} session;
+
+// the samples of one workload, in microseconds
+typedef struct result {
+    const char *name;
+    double *us;
+    int n;
+    int cap;
+    double total_ns;          // wall time of the whole run, for ops/s
+    double p50, p90, p99, max, mean, ops;
+} result;
+
+/*=============================================================================
+* global variables & data structures
+=============================================================================*/
+static const char *smash_path;
+static int count = 1000;          // samples of the cheap workloads, the others are scaled down
+static int diff_mb = 64;
+static char tmp_dir[] = "/tmp/smash_bench.XXXXXX";
+
+/*=============================================================================
+* time, samples
+=============================================================================*/
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void add_sample(result *r, double ns)
+{
+    if (r->n == r->cap) {
+        r->cap = r->cap ? r->cap * 2 : 256;
+        r->us  = (double*)realloc(r->us, (size_t)r->cap * sizeof(double));
+        if (!r->us) {
+            perror("bench: realloc");
+            exit(2);
+        }
+    }
+    r->us[r->n++] = ns / NS_PER_US;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// nearest rank
+static double percentile(const result *r, double p)
+{
+    int k = (int)(p / 100.0 * r->n + 0.999999);
+    if (k < 1)
+        k = 1;
+    return r->us[k - 1];
+}
+
+static void summarize(result *r)
+{
+    if (r->n == 0)
+        return;
+    qsort(r->us, (size_t)r->n, sizeof(double), cmp_double);
+    double sum = 0;
+    for (int i = 0; i < r->n; ++i)
+        sum += r->us[i];
+    r->p50  = percentile(r, 50);
+    r->p90  = percentile(r, 90);
+    r->p99  = percentile(r, 99);
+    r->max  = r->us[r->n - 1];
+    r->mean = sum / r->n;
+    r->ops  = r->total_ns > 0 ? r->n * 1e9 / r->total_ns : 0;
+}
+
+/*=============================================================================
+* the pty session
+=============================================================================*/
+
+static void fail(session *s, const char *what)
+{
+    fprintf(stderr, "bench: %s\n", what);
+    if (s && s->len) {
+        fprintf(stderr, "bench: last output from smash:\n");
+        fwrite(s->buf, 1, s->len, stderr);
+        fputc('\n', stderr);
+    }
+    if (s)
+        kill(s->pid, SIGKILL);
+    exit(2);
+}
+
+// read until needle shows up; the output up to its end is dropped
+static void wait_for(session *s, const char *needle)
+{
+    size_t nlen = strlen(needle);
+    double deadline = now_ns() + TIMEOUT_MS * 1e6;
+
+    for (;;) {
+        char *hit = memmem(s->buf, s->len, needle, nlen);
+        if (hit) {
+            size_t used = (size_t)(hit - s->buf) + nlen;
+            memmove(s->buf, s->buf + used, s->len - used);
+            s->len -= used;
+            return;
+        }
+        if (s->len > OUT_BUF / 2) {   // keep just enough for a needle split across reads
+            memmove(s->buf, s->buf + s->len - nlen, nlen);
+            s->len = nlen;
+        }
+
+        int left = (int)((deadline - now_ns()) / 1e6);
+        if (left <= 0)
+            fail(s, "timed out waiting for smash");
+        struct pollfd p = { s->fd, POLLIN, 0 };
+        if (poll(&p, 1, left) == -1 && errno != EINTR)
+            fail(s, "poll failed");
+        ssize_t r = read(s->fd, s->buf + s->len, OUT_BUF - s->len);
+        if (r > 0)
+            s->len += (size_t)r;
+        else if (r == 0 || (errno != EAGAIN && errno != EINTR))
+            fail(s, "smash exited");
+    }
+}
+
+static void type(session *s, const char *text)
+{
+    size_t len = strlen(text);
+    while (len > 0) {
+        ssize_t w = write(s->fd, text, len);
+        if (w == -1) {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            fail(s, "write to the pty failed");
+        }
+        text += w;
+        len  -= (size_t)w;
+    }
+}
+
+// one line typed and run: ns until the next prompt
+static double run(session *s, const char *line)
+{
+    double t0 = now_ns();
+    type(s, line);
+    type(s, "\n");
+    wait_for(s, PROMPT);
+    return now_ns() - t0;
+}
+
+static void session_start(session *s)
+{
+    int m = posix_openpt(O_RDWR | O_NOCTTY);
+    if (m == -1 || grantpt(m) == -1 || unlockpt(m) == -1)
+        fail(NULL, "no pty");
+    const char *slave = ptsname(m);
+
+    pid_t pid = fork();
+    if (pid == -1)
+        fail(NULL, "fork failed");
+    if (pid == 0) {
+        // smash's own terminal: it is interactive and gets CTRL+Z as SIGTSTP
+        setsid();
+        int sfd = open(slave, O_RDWR);
+        if (sfd == -1)
+            _exit(127);
+        ioctl(sfd, TIOCSCTTY, 0);
+
+        // no echo (only smash's output comes back), no flush on CTRL+Z
+        struct termios t;
+        tcgetattr(sfd, &t);
+        t.c_lflag &= ~(tcflag_t)(ECHO | ECHOCTL);
+        t.c_lflag |= NOFLSH;
+        t.c_oflag &= ~(tcflag_t)ONLCR;
+        tcsetattr(sfd, TCSANOW, &t);
+
+        dup2(sfd, 0);
+        dup2(sfd, 1);
+        dup2(sfd, 2);
+        if (sfd > 2)
+            close(sfd);
+        close(m);
+        if (chdir(tmp_dir) == -1)
+            _exit(127);
+        execl(smash_path, smash_path, (char*)NULL);
+        _exit(127);
+    }
+
+    s->pid = pid;
+    s->fd  = m;
+    s->len = 0;
+    wait_for(s, PROMPT);
+}
+
+static void session_end(session *s)
+{
+    type(s, "quit kill\n");
+    // up to 10 s (quit kill gives the jobs 5), draining the output: a full pty would block smash
+    double deadline = now_ns() + 10e9;
+    while (waitpid(s->pid, NULL, WNOHANG) != s->pid) {
+        if (now_ns() > deadline) {
+            kill(s->pid, SIGKILL);
+            waitpid(s->pid, NULL, 0);
+            break;
+        }
+        char junk[4096];
+        struct pollfd p = { s->fd, POLLIN, 0 };
+        if (poll(&p, 1, 10) > 0 && read(s->fd, junk, sizeof(junk)) <= 0) {
+            struct timespec pause = { 0, 10 * 1000000L };   // hung up: just wait for the exit
+            nanosleep(&pause, NULL);
+        }
+    }
+    close(s->fd);
+}
+
+/*=============================================================================
+* workloads
+=============================================================================*/
+
+// the same line over and over
+static void repeat(result *r, const char *setup, const char *line, int n)
+{
+    session s;
+    session_start(&s);
+    if (setup)
+        run(&s, setup);
+    double t0 = now_ns();
+    for (int i = 0; i < n; ++i)
+        add_sample(r, run(&s, line));
+    r->total_ns = now_ns() - t0;
+    session_end(&s);
+}
+
+static void w_true(result *r, int jobs)
+{
+    repeat(r, NULL, "/bin/true", count);
+}
+
+static void w_chain_ext(result *r, int jobs)
+{
+    char line[MAX_LINE] = "/bin/true";
+    for (int i = 1; i < 16; ++i)
+        strcat(line, " && /bin/true");
+    repeat(r, NULL, line, count / 16 > 10 ? count / 16 : 10);
+}
+
+static void w_chain_builtin(result *r, int jobs)
+{
+    char line[MAX_LINE] = "cd .";
+    for (int i = 1; i < 256; ++i)
+        strcat(line, " && cd .");
+    repeat(r, NULL, line, count / 4 > 10 ? count / 4 : 10);
+}
+
+// a0 = cd ., a1 = a0, ... a15 = a14; the line is 128 x a15
+static void w_alias(result *r, int jobs)
+{
+    session s;
+    session_start(&s);
+    char line[MAX_LINE];
+    run(&s, "alias a0=\"cd .\"");
+    for (int i = 1; i < ALIAS_DEPTH; ++i) {
+        snprintf(line, sizeof(line), "alias a%d=a%d", i, i - 1);
+        run(&s, line);
+    }
+    snprintf(line, sizeof(line), "a%d", ALIAS_DEPTH - 1);
+    for (int i = 1; i < 128; ++i) {
+        size_t len = strlen(line);
+        snprintf(line + len, sizeof(line) - len, " && a%d", ALIAS_DEPTH - 1);
+    }
+
+    int n = count / 4 > 10 ? count / 4 : 10;
+    double t0 = now_ns();
+    for (int i = 0; i < n; ++i)
+        add_sample(r, run(&s, line));
+    r->total_ns = now_ns() - t0;
+    session_end(&s);
+}
+
+// sleep & until jobs are running; a sample is one more background job
+static void w_jobs_fill(result *r, int jobs)
+{
+    int rounds = count / jobs > 1 ? count / jobs : 1;
+    if (rounds > 5)
+        rounds = 5;
+    for (int k = 0; k < rounds; ++k) {
+        session s;
+        session_start(&s);
+        double t0 = now_ns();
+        for (int i = 0; i < jobs; ++i)
+            add_sample(r, run(&s, "sleep 1000 &"));
+        r->total_ns += now_ns() - t0;
+        session_end(&s);
+    }
+}
+
+// jobs with that many jobs in the list
+static void w_jobs_list(result *r, int jobs)
+{
+    session s;
+    session_start(&s);
+    for (int i = 0; i < jobs; ++i)
+        run(&s, "sleep 1000 &");
+    int n = count / 10 > 10 ? count / 10 : 10;
+    double t0 = now_ns();
+    for (int i = 0; i < n; ++i)
+        add_sample(r, run(&s, "jobs"));
+    r->total_ns = now_ns() - t0;
+    session_end(&s);
+}
+
+// job 1: a sleep stopped with CTRL+Z
+static void stopped_job(session *s)
+{
+    type(s, "sleep 1000\n");
+    // smash takes the signal only once it waits for the job: give it time to get there
+    struct timespec pause = { 0, 50 * 1000000L };
+    nanosleep(&pause, NULL);
+    type(s, "\x1a");
+    wait_for(s, PROMPT);
+}
+
+// CTRL+Z on a job in the foreground until the prompt is back
+static void w_ctrl_z(result *r, int jobs)
+{
+    session s;
+    session_start(&s);
+    stopped_job(&s);
+    int n = count / 10 > 10 ? count / 10 : 10;
+    for (int i = 0; i < n; ++i) {
+        type(&s, "fg 1\n");
+        wait_for(&s, "[1] ");   // fg prints the job before it waits for it
+        double t0 = now_ns();
+        type(&s, "\x1a");
+        wait_for(&s, PROMPT);
+        double dt = now_ns() - t0;
+        add_sample(r, dt);
+        r->total_ns += dt;
+    }
+    run(&s, "kill 9 1");
+    session_end(&s);
+}
+
+// bg 1, fg 1, CTRL+Z: a stopped job to running, to the foreground and stopped again
+static void w_fg_bg(result *r, int jobs)
+{
+    session s;
+    session_start(&s);
+    stopped_job(&s);
+    int n = count / 10 > 10 ? count / 10 : 10;
+    double start = now_ns();
+    for (int i = 0; i < n; ++i) {
+        double t0 = now_ns();
+        run(&s, "bg 1");
+        type(&s, "fg 1\n");
+        wait_for(&s, "[1] ");
+        type(&s, "\x1a");
+        wait_for(&s, PROMPT);
+        add_sample(r, now_ns() - t0);
+    }
+    r->total_ns = now_ns() - start;
+    run(&s, "kill 9 1");
+    session_end(&s);
+}
+
+// two files of diff_mb MB differing in the last byte, and a copy of the first
+static void make_diff_files(void)
+{
+    char path[256];
+    size_t chunk = 1 << 20;
+    char *buf = (char*)malloc(chunk);
+    if (!buf)
+        fail(NULL, "no memory");
+    unsigned x = 12345;
+
+    const char *names[] = { "a", "b", "c" };
+    FILE *f[3];
+    for (int i = 0; i < 3; ++i) {
+        snprintf(path, sizeof(path), "%s/%s", tmp_dir, names[i]);
+        if (!(f[i] = fopen(path, "w")))
+            fail(NULL, "can't write the diff files");
+    }
+    for (int mb = 0; mb < diff_mb; ++mb) {
+        for (size_t i = 0; i < chunk; ++i) {
+            x = x * 1103515245u + 12345u;
+            buf[i] = (char)('a' + (x >> 16) % 26);
+        }
+        for (int i = 0; i < 3; ++i) {
+            if (i == 2 && mb == diff_mb - 1)
+                buf[chunk - 1] ^= 1;
+            fwrite(buf, 1, chunk, f[i]);
+        }
+    }
+    for (int i = 0; i < 3; ++i)
+        fclose(f[i]);
+    free(buf);
+}
+
+// every byte compared (page cache warm after the first run)
+static void w_diff(result *r, int jobs)
+{
+    repeat(r, NULL, "diff --no-cache a c", 10);
+}
+
+// the fingerprint cache answers for an unchanged pair
+static void w_diff_cached(result *r, int jobs)
+{
+    repeat(r, "diff a b", "diff a b", count / 10 > 10 ? count / 10 : 10);
+}
+
+typedef struct workload {
+    const char *name;
+    void (*fn)(result *r, int jobs);
+    int jobs;                 // background jobs it runs with (jobs_*), else 0
+} workload;
+
+// the job table grows by pages, it is never full: jobs_* run at a few sizes
+static const workload workloads[] = {
+    { "true",          w_true,          0 },
+    { "chain_ext",     w_chain_ext,     0 },
+    { "chain_builtin", w_chain_builtin, 0 },
+    { "alias",         w_alias,         0 },
+    { "jobs_fill_100", w_jobs_fill,     100 },
+    { "jobs_fill_1k",  w_jobs_fill,     1000 },
+    { "jobs_fill_10k", w_jobs_fill,     10000 },
+    { "jobs_list_100", w_jobs_list,     100 },
+    { "jobs_list_1k",  w_jobs_list,     1000 },
+    { "jobs_list_10k", w_jobs_list,     10000 },
+    { "ctrl_z",        w_ctrl_z,        0 },
+    { "fg_bg",         w_fg_bg,         0 },
+    { "diff",          w_diff,          0 },
+    { "diff_cached",   w_diff_cached,   0 },
+};
+
+#define WORKLOADS_NUM ((int)(sizeof(workloads) / sizeof(workloads[0])))
+
+/*=============================================================================
+* baseline
+=============================================================================*/
+
+static int save_json(const char *path, const result *res)
+{
+    FILE *f = fopen(path, "w");
+    if (!f)
+        return -1;
+    fprintf(f, "{\n  \"count\": %d,\n  \"diff_mb\": %d,\n  \"workloads\": {\n", count, diff_mb);
+    for (int i = 0; i < WORKLOADS_NUM; ++i) {
+        const result *r = &res[i];
+        fprintf(f, "    \"%s\": {\"n\": %d, \"p50_us\": %.1f, \"p90_us\": %.1f, \"p99_us\": %.1f, "
+                   "\"max_us\": %.1f, \"mean_us\": %.1f, \"ops_per_sec\": %.1f}%s\n",
+                r->name, r->n, r->p50, r->p90, r->p99, r->max, r->mean, r->ops,
+                i + 1 < WORKLOADS_NUM ? "," : "");
+    }
+    fprintf(f, "  }\n}\n");
+    return fclose(f) == EOF ? -1 : 0;
+}
+
+// the whole file, NUL-terminated
+static char* load_file(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return NULL;
+    size_t cap = 4096, len = 0;
+    char *text = (char*)malloc(cap);
+    size_t r;
+    while (text && (r = fread(text + len, 1, cap - len - 1, f)) > 0) {
+        len += r;
+        if (len + 1 == cap) {
+            char *grown = (char*)realloc(text, cap *= 2);
+            if (!grown)
+                free(text);
+            text = grown;
+        }
+    }
+    fclose(f);
+    if (text)
+        text[len] = '\0';
+    return text;
+}
+
+// p50 of a workload in a file written by save_json, -1 if it isn't there
+static double baseline_p50(const char *json, const char *name)
+{
+    char key[64];
+    snprintf(key, sizeof(key), "\"%s\": {", name);
+    const char *p = strstr(json, key);
+    if (!p)
+        return -1;
+    const char *end = strchr(p, '}');
+    const char *v = strstr(p, "\"p50_us\":");
+    double us;
+    if (!v || (end && v > end) || sscanf(v + 9, "%lf", &us) != 1)
+        return -1;
+    return us;
+}
+
+/*=============================================================================
+* main
+=============================================================================*/
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: bench [-n count] [-m diff_mb] [-s save.json] [-c baseline.json] [-t pct] smash_path\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *save = NULL, *compare = NULL;
+    double threshold = 20.0;   // p50 of a few hundred samples still moves by 10%
+    int opt;
+    while ((opt = getopt(argc, argv, "n:m:s:c:t:")) != -1) {
+        switch (opt) {
+        case 'n': count = atoi(optarg); break;
+        case 'm': diff_mb = atoi(optarg); break;
+        case 's': save = optarg; break;
+        case 'c': compare = optarg; break;
+        case 't': threshold = atof(optarg); break;
+        default: usage();
+        }
+    }
+    if (optind + 1 != argc || count < 1 || diff_mb < 1)
+        usage();
+
+    // smash runs in the scratch directory: the path has to survive the chdir
+    static char abs_path[4096];
+    if (!realpath(argv[optind], abs_path)) {
+        perror(argv[optind]);
+        return 2;
+    }
+    smash_path = abs_path;
+
+    if (!mkdtemp(tmp_dir)) {
+        perror("bench: mkdtemp");
+        return 2;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    make_diff_files();
+
+    char *base = NULL;
+    if (compare && !(base = load_file(compare)))
+        fprintf(stderr, "bench: no baseline in %s, nothing to compare\n", compare);
+
+    result res[WORKLOADS_NUM];
+    memset(res, 0, sizeof(res));
+
+    printf("%-14s %6s %10s %10s %10s %10s %10s %10s", "workload", "n", "p50 us", "p90 us",
+           "p99 us", "max us", "mean us", "ops/s");
+    printf(base ? " %10s\n" : "\n", "vs base");
+    int regressions = 0;
+
+    for (int i = 0; i < WORKLOADS_NUM; ++i) {
+        result *r = &res[i];
+        r->name = workloads[i].name;
+        workloads[i].fn(r, workloads[i].jobs);
+        summarize(r);
+
+        printf("%-14s %6d %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f", r->name, r->n,
+               r->p50, r->p90, r->p99, r->max, r->mean, r->ops);
+        double b = base ? baseline_p50(base, r->name) : -1;
+        if (b > 0) {
+            double pct = (r->p50 - b) * 100.0 / b;
+            int worse = pct > threshold;
+            regressions += worse;
+            printf(" %+9.1f%%%s", pct, worse ? "  SLOWER" : "");
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+
+    char path[256];
+    for (int i = 0; i < 3; ++i) {
+        snprintf(path, sizeof(path), "%s/%c", tmp_dir, 'a' + i);
+        unlink(path);
+    }
+    rmdir(tmp_dir);
+
+    if (save && save_json(save, res) == -1) {
+        perror(save);
+        return 2;
+    }
+    if (regressions) {
+        printf("bench: %d workload(s) slower than the baseline by more than %.0f%%\n",
+               regressions, threshold);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,205 @@
+//iobench.c
+// diff's read path on the sync backend vs io_uring (and the mmap path), cold and warm page cache
+// usage: iobench [-d dir] [-m max_mb] [-r reps]
+//
+//  - pairs of identical files (every byte gets compared) from 4 KB to max_mb MB,
+//    written to a scratch directory under dir (not tmpfs: cold needs a disk)
+//  - cold: the files' pages are dropped before each compare
+//    (fdatasync + POSIX_FADV_DONTNEED, no root needed); warm: read once before
+//  - file_compare with FILE_COMPARE_NO_CACHE, plus FILE_COMPARE_NO_MMAP for the
+//    read paths; the backend is switched with SYS_IO_BACKEND
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../file_compare.h"
+#include "../my_system_call.h"
+
+#define SIZES_MAX 16
+
+/*=============================================================================
+* global variables & data structures
+=============================================================================*/
+static char dir[4096];
+static int reps = 9;
+
+/*=============================================================================
+* files
+=============================================================================*/
+
+static void file_path(char *out, size_t n, size_t size, char which)
+{
+    snprintf(out, n, "%s/%zu.%c", dir, size, which);
+}
+
+static int write_file(const char *path, size_t size)
+{
+    FILE *f = fopen(path, "w");
+    if (!f)
+        return -1;
+    unsigned x = (unsigned)size;   // both files of a size get the same bytes
+    char buf[4096];
+    for (size_t done = 0; done < size; ) {
+        for (size_t i = 0; i < sizeof(buf); ++i) {
+            x = x * 1103515245u + 12345u;
+            buf[i] = (char)(x >> 16);
+        }
+        size_t n = size - done < sizeof(buf) ? size - done : sizeof(buf);
+        fwrite(buf, 1, n, f);
+        done += n;
+    }
+    fflush(f);
+    fdatasync(fileno(f));   // clean pages can be dropped
+    return fclose(f);
+}
+
+static void drop_cache(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+/*=============================================================================
+* measuring
+=============================================================================*/
+
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec / 1e3;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// median microseconds of reps compares, -1 if a compare failed
+static double measure(size_t size, int cold, int flags)
+{
+    char p1[4200], p2[4200];
+    file_path(p1, sizeof(p1), size, 'a');
+    file_path(p2, sizeof(p2), size, 'b');
+    struct stat st1, st2;
+    if (stat(p1, &st1) != 0 || stat(p2, &st2) != 0)
+        return -1;
+
+    double t[64];
+    int n = reps < 64 ? reps : 64;
+    if (!cold)
+        file_compare(p1, &st1, p2, &st2, flags);   // pages in, ring and buffers set up
+    for (int i = 0; i < n; ++i) {
+        if (cold) {
+            drop_cache(p1);
+            drop_cache(p2);
+        }
+        double t0 = now_us();
+        if (file_compare(p1, &st1, p2, &st2, flags) != 0)
+            return -1;
+        t[i] = now_us() - t0;
+    }
+    qsort(t, (size_t)n, sizeof(double), cmp_double);
+    return t[n / 2];
+}
+
+static void print_cell(double us, size_t size)
+{
+    if (us < 0)
+        printf(" %20s", "-");
+    else
+        printf(" %10.1f %7.0fMB/s", us, (double)size / us);
+}
+
+/*=============================================================================
+* main
+=============================================================================*/
+int main(int argc, char *argv[])
+{
+    const char *base = ".";
+    int max_mb = 64;
+    int opt;
+    while ((opt = getopt(argc, argv, "d:m:r:")) != -1) {
+        switch (opt) {
+        case 'd': base = optarg; break;
+        case 'm': max_mb = atoi(optarg); break;
+        case 'r': reps = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: iobench [-d dir] [-m max_mb] [-r reps]\n");
+            return 2;
+        }
+    }
+    if (max_mb < 1 || reps < 1) {
+        fprintf(stderr, "usage: iobench [-d dir] [-m max_mb] [-r reps]\n");
+        return 2;
+    }
+
+    snprintf(dir, sizeof(dir), "%s/iobench.XXXXXX", base);
+    if (!mkdtemp(dir)) {
+        perror("iobench: mkdtemp");
+        return 2;
+    }
+
+    size_t sizes[SIZES_MAX];
+    int nsizes = 0;
+    for (size_t s = 4096; s <= (size_t)max_mb << 20 && nsizes < SIZES_MAX; s *= 16)
+        sizes[nsizes++] = s;
+    if (sizes[nsizes - 1] != (size_t)max_mb << 20 && nsizes < SIZES_MAX)
+        sizes[nsizes++] = (size_t)max_mb << 20;
+
+    char path[4200];
+    for (int i = 0; i < nsizes; ++i) {
+        for (char w = 'a'; w <= 'b'; ++w) {
+            file_path(path, sizeof(path), sizes[i], w);
+            if (write_file(path, sizes[i]) != 0) {
+                perror(path);
+                return 2;
+            }
+        }
+    }
+
+    int uring = my_system_call_ext(SYS_IO_BACKEND, IO_BACKEND_URING) == IO_BACKEND_URING;
+    if (!uring)
+        printf("iobench: no io_uring here (%s), its columns are empty\n", strerror(errno));
+
+    printf("%-6s %10s %20s %20s %20s\n", "cache", "size", "sync read (us)", "io_uring read (us)", "mmap (us)");
+    for (int cold = 1; cold >= 0; --cold) {
+        for (int i = 0; i < nsizes; ++i) {
+            size_t size = sizes[i];
+            printf("%-6s %10zu", cold ? "cold" : "warm", size);
+
+            my_system_call_ext(SYS_IO_BACKEND, IO_BACKEND_SYNC);
+            print_cell(measure(size, cold, FILE_COMPARE_NO_CACHE | FILE_COMPARE_NO_MMAP), size);
+
+            double u = -1;
+            if (uring) {
+                my_system_call_ext(SYS_IO_BACKEND, IO_BACKEND_URING);
+                u = measure(size, cold, FILE_COMPARE_NO_CACHE | FILE_COMPARE_NO_MMAP);
+            }
+            print_cell(u, size);
+
+            // files up to one read chunk never take the mmap path
+            print_cell(size > IO_BUF_SIZE ? measure(size, cold, FILE_COMPARE_NO_CACHE) : -1, size);
+            printf("\n");
+            fflush(stdout);
+        }
+    }
+
+    for (int i = 0; i < nsizes; ++i) {
+        for (char w = 'a'; w <= 'b'; ++w) {
+            file_path(path, sizeof(path), sizes[i], w);
+            unlink(path);
+        }
+    }
+    rmdir(dir);
+    return 0;
+}
@@ -0,0 +1,304 @@
+//microbench.c
+// microbenchmarks of the data-structure hot paths, linked with smash's objects (all but smash.o)
+// usage: microbench [scale]
+//
+//  - parse_line over a corpus of command lines and over long && chains
+//  - add_job / delete_job / find_by_pid under churn, at several table sizes
+//  - alias_find with 10 to 10k aliases defined, hits and misses
+//  - ns/op from CLOCK_MONOTONIC; allocs/op and bytes/op from malloc, calloc
+//    and realloc, wrapped at link time (-Wl,--wrap=...): only smash's own
+//    calls are counted, not the ones inside libc
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../arena.h"
+#include "../parser.h"
+#include "../jobs.h"
+#include "../alias.h"
+
+#define LINE_MAX_LEN 4096
+
+/*=============================================================================
+* allocation counting
+=============================================================================*/
+static uint64_t allocs = 0;
+static uint64_t alloc_bytes = 0;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void *p, size_t size);
+void __real_free(void *p);
+
+void* __wrap_malloc(size_t size)
+{
+    allocs++;
+    alloc_bytes += size;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t n, size_t size)
+{
+    allocs++;
+    alloc_bytes += n * size;
+    return __real_calloc(n, size);
+}
+
+void* __wrap_realloc(void *p, size_t size)
+{
+    allocs++;
+    alloc_bytes += size;
+    return __real_realloc(p, size);
+}
+
+void __wrap_free(void *p)
+{
+    __real_free(p);
+}
+
+/*=============================================================================
+* measuring
+=============================================================================*/
+static int scale = 1;
+static volatile long sink;   // results go here so the loops are not optimized out
+
+// a measurement in progress
+typedef struct mark {
+    double ns;
+    uint64_t allocs;
+    uint64_t bytes;
+} mark;
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static mark start(void)
+{
+    mark m = { now_ns(), allocs, alloc_bytes };
+    return m;
+}
+
+static void report(const char *name, const mark *m, long ops)
+{
+    double ns = now_ns() - m->ns;
+    printf("%-36s %10ld %10.1f %10.2f %10.1f\n", name, ops, ns / ops,
+           (double)(allocs - m->allocs) / ops, (double)(alloc_bytes - m->bytes) / ops);
+}
+
+// xorshift: the same sequence every run
+static uint32_t rng = 2463534242u;
+
+static uint32_t next_rand(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+/*=============================================================================
+* parser
+=============================================================================*/
+
+// the kind of lines people type, builtins and external commands
+static const char *corpus[] = {
+    "ls",
+    "ls -la /usr/share/doc",
+    "cd ..",
+    "pwd",
+    "jobs",
+    "fg 2",
+    "kill 9 3",
+    "sleep 100 &",
+    "cat /etc/passwd | grep root | wc -l",
+    "grep -rn \"TODO: fix\" src include > todo.txt",
+    "make -j8 && ./smash test.txt && echo done",
+    "diff -r build/old build/new > changes 2> errors",
+    "find . -name '*.c' | xargs grep -l job_list | sort | uniq -c",
+    "alias ll=\"ls -l --color=auto\"",
+    "echo \"a \\\"quoted\\\" word\" 'and $literal' plain\\ escaped",
+    "gcc -std=c99 -Wall -Werror -pedantic-errors -pthread -DNDEBUG -c commands.c -o commands.o",
+    "tar czf backup.tar.gz docs src tests < /dev/null >> backup.log",
+    "submit -p 5 -a 1 ./run_tests --all",
+    "time -f \"%e %M\" sort -n big.txt | head -20",
+    "parallel 4 gzip -9 a b c d e f g h",
+};
+
+#define CORPUS_NUM ((int)(sizeof(corpus) / sizeof(corpus[0])))
+
+static char line[LINE_MAX_LEN];
+
+static void bench_parse_corpus(void)
+{
+    arena a = ARENA_INIT;
+    size_t len[CORPUS_NUM];
+    for (int i = 0; i < CORPUS_NUM; ++i)
+        len[i] = strlen(corpus[i]) + 1;
+
+    long ops = 200000L * scale;
+    mark m = start();
+    for (long k = 0; k < ops; ++k) {
+        int i = (int)(k % CORPUS_NUM);
+        memcpy(line, corpus[i], len[i]);   // parsed in place
+        cmd_line cl;
+        if (parse_line(&a, line, &cl) == 0)
+            sink += cl.nchain;
+        arena_reset(&a);
+    }
+    report("parse_line corpus", &m, ops);
+}
+
+// a && b && ...: the chain is split into its pipelines by the parser
+static void bench_parse_chain(int n)
+{
+    arena a = ARENA_INIT;
+    char text[LINE_MAX_LEN] = "";
+    for (int i = 0; i < n; ++i) {
+        size_t l = strlen(text);
+        snprintf(text + l, sizeof(text) - l, "%scmd%d arg", i ? " && " : "", i);
+    }
+    size_t size = strlen(text) + 1;
+
+    long ops = 2000000L * scale / n;
+    mark m = start();
+    for (long k = 0; k < ops; ++k) {
+        memcpy(line, text, size);
+        cmd_line cl;
+        if (parse_line(&a, line, &cl) == 0)
+            sink += cl.nchain;
+        arena_reset(&a);
+    }
+    char name[64];
+    snprintf(name, sizeof(name), "parse_line && chain x%d", n);
+    report(name, &m, ops);
+}
+
+/*=============================================================================
+* job table
+=============================================================================*/
+
+// size jobs in the table; then delete a random one and add a new one in its place
+static void bench_jobs(int size)
+{
+    job_arr arr;
+    init_job_arr(&arr);
+
+    pid_t *pids = (pid_t*)malloc((size_t)size * sizeof(pid_t));
+    int *ids = (int*)malloc((size_t)size * sizeof(int));
+    if (!pids || !ids) {
+        perror("microbench: malloc");
+        exit(1);
+    }
+    pid_t next_pid = 100000;   // not real processes: nothing here signals or waits
+    for (int i = 0; i < size; ++i) {
+        pids[i] = next_pid++;
+        ids[i]  = add_job(&arr, pids[i], "sleep 100 &", BG);
+    }
+
+    long ops = 500000L * scale;
+    char name[64];
+
+    mark m = start();
+    for (long k = 0; k < ops; ++k) {
+        int i = (int)(next_rand() % (unsigned)size);
+        delete_job(&arr, ids[i]);
+        pids[i] = next_pid++;
+        ids[i]  = add_job(&arr, pids[i], "sleep 100 &", BG);
+    }
+    snprintf(name, sizeof(name), "delete_job + add_job, %d jobs", size);
+    report(name, &m, ops);
+
+    m = start();
+    for (long k = 0; k < ops; ++k)
+        sink += find_by_pid(&arr, pids[next_rand() % (unsigned)size]);
+    snprintf(name, sizeof(name), "find_by_pid hit, %d jobs", size);
+    report(name, &m, ops);
+
+    m = start();
+    for (long k = 0; k < ops; ++k)
+        sink += find_by_pid(&arr, (pid_t)(next_rand() % 90000u) + 1);
+    snprintf(name, sizeof(name), "find_by_pid miss, %d jobs", size);
+    report(name, &m, ops);
+
+    for (int i = 0; i < size; ++i)
+        delete_job(&arr, ids[i]);
+    free(pids);
+    free(ids);
+}
+
+/*=============================================================================
+* aliases
+=============================================================================*/
+
+static int aliases_defined = 0;
+
+// define aliases a<n> up to count of them
+static void define_aliases(int count)
+{
+    arena a = ARENA_INIT;
+    char name[32], value[64];
+    for (; aliases_defined < count; ++aliases_defined) {
+        snprintf(name, sizeof(name), "a%d", aliases_defined);
+        snprintf(value, sizeof(value), "ls -l --color=auto dir%d", aliases_defined);
+        alias_set(&a, name, value);
+        arena_reset(&a);
+    }
+}
+
+static void bench_alias(int count)
+{
+    define_aliases(count);
+
+    char names[256][32];
+    for (int i = 0; i < 256; ++i)
+        snprintf(names[i], sizeof(names[i]), "a%u", next_rand() % (unsigned)count);
+    char misses[256][32];
+    for (int i = 0; i < 256; ++i)
+        snprintf(misses[i], sizeof(misses[i]), "cmd%u", next_rand());
+
+    long ops = 1000000L * scale;
+    char name[64];
+
+    mark m = start();
+    for (long k = 0; k < ops; ++k)
+        sink += alias_find(names[k & 255]) != NULL;
+    snprintf(name, sizeof(name), "alias_find hit, %d aliases", count);
+    report(name, &m, ops);
+
+    m = start();
+    for (long k = 0; k < ops; ++k)
+        sink += alias_find(misses[k & 255]) != NULL;
+    snprintf(name, sizeof(name), "alias_find miss, %d aliases", count);
+    report(name, &m, ops);
+}
+
+/*=============================================================================
+* main
+=============================================================================*/
+int main(int argc, char *argv[])
+{
+    if (argc > 2 || (argc == 2 && (scale = atoi(argv[1])) < 1)) {
+        fprintf(stderr, "usage: microbench [scale]\n");
+        return 2;
+    }
+
+    printf("%-36s %10s %10s %10s %10s\n", "benchmark", "ops", "ns/op", "allocs/op", "bytes/op");
+
+    bench_parse_corpus();
+    bench_parse_chain(2);
+    bench_parse_chain(16);
+    bench_parse_chain(128);
+
+    int sizes[] = { 10, 100, 1000, 10000 };
+    for (int i = 0; i < 4; ++i)
+        bench_jobs(sizes[i]);
+    for (int i = 0; i < 4; ++i)
+        bench_alias(sizes[i]);
+    return 0;
+}
@@ -0,0 +1,88 @@
+#ifndef BUILTINS_H
+#define BUILTINS_H
+
+#include <stdint.h>
+
+/*=============================================================================
+* builtin registry
+*
+*  - every builtin is one BUILTIN_LIST line: name, handler, arity (min / max
+*    number of arguments after the name, ARGS_ANY = no limit), the message
+*    for a wrong number of arguments, flags
+*  - the dispatcher finds a name with a perfect hash (builtin_hash.h, made
+*    from this list by tools/gen_builtin_hash at build time): one hash and
+*    one strcmp, whatever the number of builtins
+*  - a new builtin is a handler int f(exec_ctx *ctx, char **args, int argc)
+*    plus a line here
+*  - a BI_THREAD builtin that feeds a pipe (jobs | grep x) runs on a worker
+*    thread of smash instead of a forked copy (stage_thread.h)
+=============================================================================*/
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#define ARGS_ANY (-1)
+
+// what a builtin may do besides running in smash itself in the foreground
+#define BI_BACKGROUND 0x1   // with '&': runs in a forked smash as a background job
+#define BI_PIPELINE   0x2   // as a pipeline stage (in a forked smash)
+#define BI_NO_ALIAS   0x4   // never alias-expanded (alias / unalias)
+#define BI_OWN_JOB    0x8   // starts a job of its own, '&' and the text are passed on to it
+#define BI_THREAD     0x10  // may run on a thread: writes to ctx->out only, reads the job table locked
+
+// X(name, handler, min_args, max_args, arity message, flags)
+#define BUILTIN_LIST(X) \
+    X("alias",    alias_cmd,       1, ARGS_ANY, "invalid arguments",         BI_NO_ALIAS) \
+    X("unalias",  unalias_cmd,     1, 1,        "invalid arguments",         BI_NO_ALIAS) \
+    X("showpid",  showpid,         0, 0,        "expected 0 arguments",      BI_PIPELINE | BI_THREAD) \
+    X("pwd",      pwd,             0, 0,        "expected 0 arguments",      BI_PIPELINE | BI_BACKGROUND | BI_THREAD) \
+    X("cd",       cd,              1, 1,        "expected 1 arguments",      0) \
+    X("diff",     cmd_diff,        0, ARGS_ANY, NULL,                        BI_PIPELINE | BI_BACKGROUND | BI_THREAD) \
+    X("jobs",     jobs_builtin,    0, 3,        "expected 0 arguments",      BI_PIPELINE | BI_THREAD) \
+    X("jobstat",  jobstat_builtin, 1, 1,        "invalid arguments",         BI_PIPELINE | BI_THREAD) \
+    X("kill",     kill_builtin,    2, 2,        "invalid arguments",         0) \
+    X("fg",       fg_builtin,      0, 1,        "invalid arguments",         0) \
+    X("bg",       bg_builtin,      0, 1,        "invalid arguments",         0) \
+    X("hash",     hash_cmd,        0, 1,        "invalid arguments",         BI_PIPELINE) \
+    X("quit",     quit_builtin,    0, 1,        "expected 0 or 1 arguments", 0) \
+    X("parallel", parallel_cmd,    2, ARGS_ANY, "invalid arguments",         BI_PIPELINE | BI_OWN_JOB) \
+    X("submit",   submit_cmd,      1, ARGS_ANY, "invalid arguments",         0) \
+    X("queue",    queue_cmd,       0, 2,        "invalid arguments",         BI_PIPELINE) \
+    X("time",     time_cmd,        1, ARGS_ANY, "invalid arguments",         BI_PIPELINE | BI_BACKGROUND) \
+    X("trace",    trace_cmd,       1, 2,        "invalid arguments",         0)
+
+// smash-wide state builtins keep between commands (changed in smash itself only)
+typedef struct shell_state {
+    char *old_pwd;            // cd -: directory before the last cd (owned), NULL = none yet
+} shell_state;
+
+// one run of a builtin: everything it may use besides its arguments
+typedef struct exec_ctx {
+    shell_state *shell;
+    FILE *out;                // its standard output: stdout, or its pipe on a thread
+    const char *text;         // the command as typed (job list)
+    bool background;          // it ended with '&'
+    bool threaded;            // on a worker thread: smash's event loop is off limits
+} exec_ctx;
+
+typedef struct builtin {
+    const char *name;
+    int (*handler)(exec_ctx *ctx, char **args, int argc);   // argc = arguments after the name
+    int min_args;
+    int max_args;
+    const char *arity_msg;
+    int flags;
+} builtin;
+
+// the perfect hash tools/gen_builtin_hash searches a seed for (FNV-1a, seeded)
+static inline uint32_t builtin_hash(const char *s, uint32_t seed)
+{
+    uint32_t h = 2166136261u ^ seed;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    return h ^ (h >> 15);   // low bits pick the slot: fold the high ones in
+}
+
+#endif /* BUILTINS_H */
@@ -9,95 +9,43 @@
 #include <sys/wait.h>
 #include <limits.h>     // PATH_MAX
 #include "jobs.h"
+#include "path_cache.h"
+#include "file_compare.h"
+#include "diff_tree.h"
+#include "fp_cache.h"
+#include "event_loop.h"
+#include "signals.h"
+#include "arena.h"
+#include "parser.h"
+#include "alias.h"
+#include "builtins.h"
+#include "parallel.h"
+#include "job_queue.h"
+#include "redirect.h"
+#include "stage_thread.h"
+#include "trace.h"
+#include "builtin_hash.h"   // generated from builtins.h (make)
 #include <stdlib.h>   // malloc, free
+#include <time.h>     // clock_gettime
 
 
 
-// job table is actually defined in smash.c
-extern job_arr job_list;
+// everything parsed from the current input line (reset once the line is done)
+static arena line_arena = ARENA_INIT;
 
-// global argv buffer for the current simple command
-char *g_argv[ARGS_NUM_MAX + 1];
+static int run_chain(cmd_line *cl);
 
-// 1 if the current command should run in background (ends with '&')
-int g_is_bg = 0;
 
 
 
-
-/* ================= ALIAS DATA STRUCTURE ================= */
-
-typedef struct Alias {
-    char name[CMD_LENGTH_MAX];   // alias name
-    char value[CMD_LENGTH_MAX];  // expanded command line
-    struct Alias *next;
-} Alias;
-
-static Alias *alias_head = NULL;
-
-/* protect against infinite recursion: a->b, b->a, etc. */
-#define MAX_ALIAS_EXPANSION_DEPTH 10
-static int alias_expansion_depth = 0;
-
-/* find alias node by name (internal helper) */
-static Alias* find_alias_node(const char *name)
-{
-    for (Alias *cur = alias_head; cur != NULL; cur = cur->next) {
-        if (strcmp(cur->name, name) == 0)
-            return cur;
-    }
-    return NULL;
-}
-
-/* get alias value or NULL if not found */
-static const char* find_alias_value(const char *name)
-{
-    Alias *node = find_alias_node(name);
-    return node ? node->value : NULL;
-}
-
-/* create or update alias */
-static void set_alias(const char *name, const char *value)
-{
-    Alias *node = find_alias_node(name);
-    if (!node) {
-        node = (Alias*)malloc(sizeof(Alias));
-        if (!node) {
-            fprintf(stderr, "smash error: alias: malloc failed\n");
-            return;
-        }
-        strncpy(node->name, name, CMD_LENGTH_MAX - 1);
-        node->name[CMD_LENGTH_MAX - 1] = '\0';
-        node->next = alias_head;
-        alias_head = node;
-    }
-
-    strncpy(node->value, value, CMD_LENGTH_MAX - 1);
-    node->value[CMD_LENGTH_MAX - 1] = '\0';
-}
-
-/* remove alias by name, return 1 if removed, 0 if not found */
-static int remove_alias(const char *name)
+// heap copy of a string (command lines have no length limit), NULL if out of memory
+static char* copy_string(const char *s)
 {
-    Alias *prev = NULL;
-    Alias *cur  = alias_head;
-
-    while (cur) {
-        if (strcmp(cur->name, name) == 0) {
-            if (prev)
-                prev->next = cur->next;
-            else
-                alias_head = cur->next;
-            free(cur);
-            return 1;
-        }
-        prev = cur;
-        cur  = cur->next;
-    }
-    return 0;
+    size_t size = strlen(s) + 1;
+    char *copy = (char*)malloc(size);
+    return copy ? (char*)memcpy(copy, s, size) : NULL;
 }
 
-/* ================= END OF ALIAS DATA STRUCTURE ================= */
 
 
 //example function for printing errors from internal commands
@@ -109,89 +57,93 @@ void perrorSmash(const char* cmd, const char* msg)
         msg);
 }
 
-//example function for parsing commands
-int parseCmdExample(char* line)
-{
-	char* delimiters = " \t\n"; //parsing should be done by spaces, tabs or newlines
-	char* cmd = strtok(line, delimiters); //read strtok documentation - parses string by delimiters
-	if(!cmd)
-		return INVALID_COMMAND; //this means no tokens were found, most like since command is invalid
-	
-	char* args[MAX_ARGS];
-	int nargs = 0;
-	args[0] = cmd; //first token before spaces/tabs/newlines should be command name
-	for(int i = 1; i < MAX_ARGS; i++)
-	{
-		args[i] = strtok(NULL, delimiters); //first arg NULL -> keep tokenizing from previous call
-		if(!args[i])
-			break;
-		nargs++;
-	}
-	/*
-	At this point cmd contains the command string and the args array contains
-	the arguments. You can return them via struct/class, for example in C:
-		typedef struct {
-			char* cmd;
-			char* args[MAX_ARGS];
-		} Command;
-	Or maybe something more like this:
-		typedef struct {
-			bool bg;
-			char** args;
-			int nargs;
-		} CmdArgs;
-	*/
-}
-
-
-
 //#################################################
-int showpid(char **args, int argc)
+int showpid(exec_ctx *ctx, char **args, int argc)
 {
-    if (argc != 0)
-	{
-		fprintf(stderr, "smash error: showpid: expected 0 arguments\n");
-		return 1;
-		}
-	
-		printf("smash pid is %d\n", getpid());
-		return 0;
-	    
+	fprintf(ctx->out, "smash pid is %d\n", getpid());
+	return 0;
 }
 
 //###########################################################
-int pwd(char **args, int argc)
+int pwd(exec_ctx *ctx, char **args, int argc)
 {
-	if (argc != 0)
-	{
-		fprintf(stderr, "smash error: pwd: expected 0 arguments\n");
-		return 1;
-		}
-
-	
-		char path[CMD_LENGTH_MAX];
-		if (getcwd(path, CMD_LENGTH_MAX) == NULL)
+		// any length: the directory may be deeper than a command line is long
+		char *path = getcwd(NULL, 0);
+		if (path == NULL)
 		{
 			fprintf(stderr, "smash error: pwd: getcwd failed\n");
 			return 1;
 		}
 
-		printf("%s\n", path);
+		fprintf(ctx->out, "%s\n", path);
+		free(path);
 		return 0;
 }
 
 
 // #########################################################################################
-int cmd_diff(char **args, int argc)
+
+// diff -r <dir1> <dir2>: walk both trees, compare file pairs in parallel
+static int cmd_diff_recursive(FILE *out, const char *path1, const char *path2, int flags)
+{
+	struct stat st1, st2;
+	if (stat(path1, &st1) != 0 || stat(path2, &st2) != 0)
+	{
+		fprintf(stderr, "smash error: diff: expected valid paths for directories\n");
+		return 1;
+	}
+
+	if (!S_ISDIR(st1.st_mode) || !S_ISDIR(st2.st_mode))
+	{
+		fprintf(stderr, "smash error: diff: paths are not directories\n");
+		return 1;
+	}
+
+	// added/removed/changed lines are printed by diff_tree as they are found
+	int diff_count = diff_tree(out, path1, path2, flags);
+	if (diff_count == -1)
+	{
+		perror("smash error: diff");
+		return 1;
+	}
+
+	fprintf(out, "diff: %d\n", diff_count);
+	return 0;
+}
+
+int cmd_diff(exec_ctx *ctx, char **args, int argc)
 {
-	if (argc != 2)
+	if (argc == 1 && strcmp(args[1], "--cache-stats") == 0)
+	{
+		fp_cache_print_stats(ctx->out);
+		return 0;
+	}
+
+	// leading options: -r (directories), --no-cache (always compare the bytes)
+	int recursive = 0, flags = 0, i = 1;
+	for (; i <= argc && args[i][0] == '-'; ++i)
+	{
+		if (strcmp(args[i], "-r") == 0)
+			recursive = 1;
+		else if (strcmp(args[i], "--no-cache") == 0)
+			flags |= FILE_COMPARE_NO_CACHE;
+		else
+			break;
+	}
+
+	if (argc - i + 1 != 2)
 	{
 		fprintf(stderr, "smash error: diff: expected 2 arguments\n");
 		return 1;
 	}
 
-	const char *path1 = args[1];
-	const char *path2 = args[2];
+	if (recursive)
+	{
+		return cmd_diff_recursive(ctx->out, args[i], args[i + 1], flags);
+	}
+
+	const char *path1 = args[i];
+	const char *path2 = args[i + 1];
 
 	struct stat st1, st2;
 	//Check that both paths exist
@@ -208,93 +160,34 @@ int cmd_diff(char **args, int argc)
 		return 1;
 	}
 
-	int fd1 = (int)my_system_call(SYS_OPEN, path1, O_RDONLY, 0);
-	if (fd1 == -1)
-	{
-		fprintf(stderr, "smash error: diff: expected valid paths for files\n");
-		return 1;
-	}
-
-	int fd2 = (int)my_system_call(SYS_OPEN, path2, O_RDONLY, 0);
-	if (fd2 == -1)
+	// size/inode short-circuit, fingerprint cache, then read or mmap + SIMD compare (file_compare.c)
+	int diff_count = file_compare(path1, &st1, path2, &st2, flags);
+	if (diff_count == -1)
 	{
-		my_system_call(SYS_CLOSE, fd1);
 		fprintf(stderr, "smash error: diff: expected valid paths for files\n");
 		return 1;
-    }
-
-	unsigned char buf1[BUF_SIZE], buf2[BUF_SIZE];
-	int diff_count = 0;
-	while (1)
-	{
-		long r1  = my_system_call(SYS_READ, fd1, buf1, sizeof(buf1));
-		long r2  = my_system_call(SYS_READ, fd2, buf2, sizeof(buf2));
-
-		if (r1 < 0 || r2 < 0)
-		{
-			// real read error
-			diff_count = 1;
-			break;
-		}
-
-		if (r1 == 0 && r2 == 0)
-		{
-		 // both EOF which means equal so far 
-			break;
-		}
-
-		if (r1 != r2)
-		{
-			 // different lengths
-			diff_count = 1;
-			break;
-		}
-
-		if (memcmp(buf1, buf2, r1) != 0) 
-		{ 
-		// same length, different bytes
-			diff_count = 1;
-			break;
-		}
 	}
 
-	
-
-	my_system_call(SYS_CLOSE, fd1);
-	my_system_call(SYS_CLOSE, fd2);
-
-
 //  Print result: 0 = same, 1 = different
-	printf("diff: %d\n", diff_count);
+	fprintf(ctx->out, "diff: %d\n", diff_count);
 	return 0;
 }
 
 // #########################################################################################
 
 
-static char old_pwd[PATH_MAX] = {0}; // Persistent state
-static int old_pwd_set = 0; //  Flag for first use
-
-int cd(char **args, int argc)
+int cd(exec_ctx *ctx, char **args, int argc)
 {
-	if (argc != 1)
-	{
-		// argc = number of arguments AFTER "cd"
-		// so if argc = 1, there is no path to change to
-		fprintf(stderr, "smash error: cd: expected 1 arguments\n");
-		return 1;
-	}
-	
 	const char *target = args[1]; //
 	
 	 // 1) Handle "cd -" -> go back to previous directory
 	if (strcmp(target, "-") == 0)
 	{
-		if (!old_pwd_set) {
+		if (ctx->shell->old_pwd == NULL) {
             fprintf(stderr, "smash error: cd: old pwd not set\n");
             return 1;
         }
-        target = old_pwd;  // go to previous directory
+        target = ctx->shell->old_pwd;  // go to previous directory
 	}
 
 
@@ -325,25 +218,128 @@ int cd(char **args, int argc)
         }
 
 // 5) Update old_pwd only AFTER successful cd
-    strncpy(old_pwd, current_pwd, PATH_MAX - 1);
-    old_pwd[PATH_MAX - 1] = '\0';
-    old_pwd_set = 1;
+    char *saved = copy_string(current_pwd);
+    if (saved) {
+        free(ctx->shell->old_pwd);   // target may have been this one, it is done with
+        ctx->shell->old_pwd = saved;
+    }
 
     return 0;
 }
 
 // #########################################################################################
 
-int jobs(char **args, int argc, job_arr *arr)
+#define JOBS_WATCH_MIN_MS 10
+
+static long monotonic_ms(void)
+{
+    return (long)(monotonic_ns() / 1000000);
+}
+
+/*
+ * jobs -w <secs> [count]: jobs -l every <secs> (fractions allowed), count
+ * times or until CTRL+C / the reader of a pipe goes away. On a terminal the
+ * screen is redrawn, otherwise the lists follow each other
+ */
+static int jobs_watch(exec_ctx *ctx, char **args, int argc, job_arr *arr)
+{
+    if (argc < 2) {
+        fprintf(stderr, "smash error: jobs: invalid arguments\n");
+        return 1;
+    }
+    char *endptr;
+    double secs = strtod(args[2], &endptr);
+    long count  = 0;   // 0 = until stopped
+    if (*args[2] == '\0' || *endptr != '\0' || !(secs > 0) || secs > 86400 || argc > 3) {
+        fprintf(stderr, "smash error: jobs: invalid arguments\n");
+        return 1;
+    }
+    if (argc == 3) {
+        count = strtol(args[3], &endptr, 10);
+        if (*args[3] == '\0' || *endptr != '\0' || count <= 0) {
+            fprintf(stderr, "smash error: jobs: invalid arguments\n");
+            return 1;
+        }
+    }
+
+    long interval_ms = (long)(secs * 1000.0);
+    if (interval_ms < JOBS_WATCH_MIN_MS)
+        interval_ms = JOBS_WATCH_MIN_MS;
+    bool redraw = ctx->out == stdout && isatty(STDOUT_FILENO);
+    unsigned interrupts = event_loop_interrupts();
+
+    for (long n = 0; count == 0 || n < count; ++n) {
+        if (n > 0) {
+            // wait out the interval; the main thread keeps handling events meanwhile
+            long deadline = monotonic_ms() + interval_ms;
+            long left;
+            while ((left = deadline - monotonic_ms()) > 0) {
+                if (ctx->threaded) {
+                    struct timespec ts = { left / 1000, (left % 1000) * 1000000L };
+                    nanosleep(&ts, NULL);
+                } else if (event_loop_run((int)left) == -1 || event_loop_interrupts() != interrupts) {
+                    return 0;   // CTRL+C
+                }
+            }
+        } else if (!ctx->threaded) {
+            event_loop_poll();
+        }
+
+        if (redraw)
+            fprintf(ctx->out, "\033[H\033[J");
+        else if (n > 0)
+            fprintf(ctx->out, "\n");
+        print_jobs_live(arr, ctx->out);
+        if (fflush(ctx->out) == EOF)
+            return 0;   // nobody reads any more (EPIPE)
+    }
+    return 0;
+}
+
+int jobs(exec_ctx *ctx, char **args, int argc, job_arr *arr)
 {
-    if(argc != 0){
+    // jobs -v: also the finished jobs with their resource usage
+    int verbose = (argc == 1 && strcmp(args[1], "-v") == 0);
+    // jobs -l: state, CPU%, RSS, threads; jobs -w <secs> [count]: the same, refreshed
+    int live    = (argc == 1 && strcmp(args[1], "-l") == 0);
+    int watch   = (argc >= 1 && strcmp(args[1], "-w") == 0);
+    if (watch)
+        return jobs_watch(ctx, args, argc, arr);
+    if(argc != 0 && !verbose && !live){
         fprintf(stderr, "smash error: jobs: expected 0 arguments\n");
         return 1;
     }
 
-    update_jobs(arr);
+    // reap whatever exited since the loop last ran (the loop is the main thread's)
+    if (!ctx->threaded)
+        event_loop_poll();
+
+    if (live)
+        print_jobs_live(arr, ctx->out);
+    else
+        print_all_bg_jobs(arr, ctx->out);
+    if (verbose)
+        print_job_history(arr, ctx->out);
+    return 0;
+}
+
+// jobstat <id>: CPU time, max RSS, faults, context switches of a job (from wait4)
+int jobstat(exec_ctx *ctx, char **args, int argc, job_arr *arr)
+{
+    char *endptr;
+    long id_long = strtol(args[1], &endptr, 10);
+    if (*args[1] == '\0' || *endptr != '\0' || id_long <= 0 || id_long > INT_MAX) {
+        fprintf(stderr, "smash error: jobstat: invalid arguments\n");
+        return 1;
+    }
+
+    if (!ctx->threaded)
+        event_loop_poll();
 
-    print_all_bg_jobs(arr);
+    if (print_job_stat(arr, (int)id_long, ctx->out) == -1) {
+        fprintf(stderr, "smash error: jobstat: job id %ld does not exist\n", id_long);
+        return 1;
+    }
     return 0;
 }
 
@@ -351,14 +347,8 @@ int jobs(char **args, int argc, job_arr *arr)
 
 //####################################################################################
 
-int kill(char **args, int argc, job_arr *jobs)
+int kill_cmd(char **args, int argc, job_arr *jobs)
 {
-	    //  Check argument count: must be exactly 2
-		if (argc != 2) {
-			fprintf(stderr, "smash error: kill: invalid arguments\n");
-			return 1;
-		}
-
 		char *endptr1;
 		long signum_long = strtol(args[1], &endptr1, 10);
 
@@ -375,20 +365,28 @@ int kill(char **args, int argc, job_arr *jobs)
 		long job_id_long = strtol(args[2], &endptr2, 10);
 		
 		if (*args[2] == '\0' || *endptr2 != '\0' ||
-				job_id_long <= 0 || job_id_long > MAX_JOBS) {
+				job_id_long <= 0 || job_id_long > INT_MAX) {
 				fprintf(stderr, "smash error: kill: invalid arguments\n");
 				return 1;
 			}
 		int job_id = (int)job_id_long;
 
-		if (job_id < 1 || job_id > MAX_JOBS || !jobs->jobs[job_id].full) {
+		job *target = find_job(jobs, job_id);
+		if (!target) {
 			fprintf(stderr, "smash error: kill: job id %d does not exist\n", job_id);
 			return 1;
 		}
 
-		// ---------- send the signal via wrapper ----------
-		pid_t pid = jobs->jobs[job_id].pid;
-		long ret = my_system_call(SYS_KILL, pid, signum);
+		// a queued job has no process yet: any signal takes it off the queue
+		if (target->status == QUEUED) {
+			delete_job(jobs, job_id);   // jobs waiting for it are cancelled
+			printf("job %d was removed from the queue\n", job_id);
+			return 0;
+		}
+
+		// ---------- send the signal via wrapper (whole group for pipelines) ----------
+		pid_t pid = target->pid;
+		long ret = signal_job(target, signum);
 		if (ret == -1) {
 			// System-level error (very rare); assignment doesn't specify text,
 			// so a generic perror is fine.
@@ -406,16 +404,10 @@ int kill(char **args, int argc, job_arr *jobs)
 //###########################################################################
 int fg(char **args, int argc, job_arr *jobs)
 {
-    int job_id = -1;   // will hold the chosen job index (1..MAX_JOBS)
+    int job_id = -1;   // will hold the chosen job id
 
     /* ---------- argument parsing ---------- */
 
-    if (argc > 1) {
-        // too many args
-        fprintf(stderr, "smash error: fg: invalid arguments\n");
-        return 1;
-    }
-
     if (argc == 1) {
         // parse job id from args[1], command looks like: fg <num>
         char *endptr;
@@ -423,7 +415,7 @@ int fg(char **args, int argc, job_arr *jobs)
 
         // must be: pure number, >0, within range
         if (*args[1] == '\0' || *endptr != '\0' ||
-            id_long <= 0 || id_long > MAX_JOBS) {
+            id_long <= 0 || id_long > INT_MAX) {
             fprintf(stderr, "smash error: fg: invalid arguments\n");
             return 1;
         }
@@ -431,7 +423,7 @@ int fg(char **args, int argc, job_arr *jobs)
         job_id = (int)id_long;
 
         // check that this job id actually exists
-        if (!jobs->jobs[job_id].full) {
+        if (!find_job(jobs, job_id)) {
             fprintf(stderr, "smash error: fg: job id %d does not exist\n", job_id);
             return 1;
         }
@@ -444,16 +436,11 @@ int fg(char **args, int argc, job_arr *jobs)
             return 1;
         }
 
-        // find highest existing job id
-        for (int j = MAX_JOBS; j >= 1; --j) {
-            if (jobs->jobs[j].full) {
-                job_id = j;
-                break;
-            }
-        }
+        // highest existing job id (tracked by the job table)
+        job_id = jobs->highest_id;
 
         // very defensive: in case job_counter is out of sync
-        if (job_id == -1) {
+        if (job_id == 0) {
             fprintf(stderr, "smash error: fg: jobs list is empty\n");
             return 1;
         }
@@ -461,15 +448,19 @@ int fg(char **args, int argc, job_arr *jobs)
 
     /* ---------- at this point: job_id refers to a valid job ---------- */
 
-    job  *j   = &jobs->jobs[job_id];
-    pid_t pid = j->pid;
+    job *j = job_at(jobs, job_id);
+
+    if (j->status == QUEUED) {
+        fprintf(stderr, "smash error: fg: job id %d is still queued\n", job_id);
+        return 1;
+    }
 
     // print job info (adjust format to what the assignment wants, if needed)
     printf("[%d] %s\n", job_id, j->command);
 
     // if job is stopped, resume it with SIGCONT
     if (j->status == STOPPED) {
-        long r = my_system_call(SYS_KILL, pid, SIGCONT);
+        long r = signal_job(j, SIGCONT);
         if (r == -1) {
             perror("smash error: fg: SIGCONT failed");
             return 1;
@@ -477,11 +468,11 @@ int fg(char **args, int argc, job_arr *jobs)
     }
 
     // mark as foreground (in your status logic)
-    j->status = FG;
+    set_job_status(jobs, job_id, FG);
 
-    // ---------- wait for job to finish or stop again ----------
-    int  status = 0;
-    long w      = my_system_call(SYS_WAITPID, pid, &status, WUNTRACED);
+    // ---------- wait for job (every process of it) to finish or stop again ----------
+    int status = 0;
+    int w      = event_loop_wait_job(j, &status);
 
     if (w == -1) {
         perror("smash error: fg: waitpid failed");
@@ -489,13 +480,14 @@ int fg(char **args, int argc, job_arr *jobs)
         return 1;
     }
 
-    if (WIFSTOPPED(status)) {
+    if (w == 1) {
         // job was stopped again (Ctrl+Z / SIGSTOP) → keep it in job list as STOPPED
-        j->status = STOPPED;
+        set_job_status(jobs, job_id, STOPPED);
         printf("\n");
         return 0;
     } else {
-        // job finished (normal exit or killed) → remove from jobs list
+        // job finished (normal exit or killed) → history, remove from jobs list
+        job_record_finished(jobs, j, job_id);
         delete_job(jobs, job_id);
         return 0;
     }
@@ -511,18 +503,13 @@ int bg(char **args, int argc, job_arr *jobs)
 
     /* ---------- argument parsing ---------- */
 
-    if (argc > 1) {
-        fprintf(stderr, "smash error: bg: invalid arguments\n");
-        return 1;
-    }
-
     if (argc == 1) {
         // parse job id from args[1]
         char *endptr;
         long id_long = strtol(args[1], &endptr, 10);
 
         if (*args[1] == '\0' || *endptr != '\0' ||
-            id_long <= 0 || id_long > MAX_JOBS) {
+            id_long <= 0 || id_long > INT_MAX) {
             fprintf(stderr, "smash error: bg: invalid arguments\n");
             return 1;
         }
@@ -530,7 +517,7 @@ int bg(char **args, int argc, job_arr *jobs)
         job_id = (int)id_long;
 
         // ensure this job exists
-        if (!jobs->jobs[job_id].full) {
+        if (!find_job(jobs, job_id)) {
             fprintf(stderr, "smash error: bg: job id %d does not exist\n", job_id);
             return 1;
         }
@@ -543,16 +530,10 @@ int bg(char **args, int argc, job_arr *jobs)
             return 1;
         }
 
-        int found = 0;
-        for (int j = MAX_JOBS; j >= 1; --j) {
-            if (jobs->jobs[j].full && jobs->jobs[j].status == STOPPED) {
-                job_id = j;
-                found  = 1;
-                break;
-            }
-        }
+        // highest STOPPED job id (tracked by the job table)
+        job_id = jobs->highest_stopped_id;
 
-        if (!found) {
+        if (job_id == 0) {
             fprintf(stderr, "smash error: bg: there is no stopped job to resume\n");
             return 1;
         }
@@ -560,7 +541,12 @@ int bg(char **args, int argc, job_arr *jobs)
 
     /* ---------- at this point job_id is valid ---------- */
 
-    job *j = &jobs->jobs[job_id];
+    job *j = job_at(jobs, job_id);
+
+    if (j->status == QUEUED) {
+        fprintf(stderr, "smash error: bg: job id %d is still queued\n", job_id);
+        return 1;
+    }
 
     // must be STOPPED to resume with bg
     if (j->status != STOPPED) {
@@ -571,14 +557,14 @@ int bg(char **args, int argc, job_arr *jobs)
     }
 
     // Send SIGCONT to resume the job
-    long ret = my_system_call(SYS_KILL, j->pid, SIGCONT);
+    long ret = signal_job(j, SIGCONT);
     if (ret == -1) {
         perror("smash error: bg: SIGCONT failed");
         return 1;
     }
 
     // update status to background
-    j->status = BG;
+    set_job_status(jobs, job_id, BG);
 
     // print info
     printf("%s : %d\n", j->command, j->pid);
@@ -589,13 +575,52 @@ int bg(char **args, int argc, job_arr *jobs)
 
 //####################################
 
-int quit(char **args, int argc, job_arr *jobs)
+// quit kill: a job being shut down
+typedef struct quit_entry {
+    int id;
+    pid_t pid;
+    char *command;     // copy, the slot is cleared once the job is reaped
+    int term_errno;    // SIGTERM failed with this errno, 0 = sent
+    int killed;        // got SIGKILL after the deadline
+    int kill_errno;
+} quit_entry;
+
+#define QUIT_TERM_TIMEOUT_MS 5000
+
+// job of entry e is gone (reaped by the event loop, or every process reaped)
+static int quit_entry_done(job_arr *jobs, const quit_entry *e)
 {
-	if (argc > 1) {
-        fprintf(stderr, "smash error: quit: expected 0 or 1 arguments\n");
+    if (e->term_errno != 0 || e->kill_errno != 0)
         return 1;
+    job *j = find_job(jobs, e->id);
+    return j == NULL || j->pid != e->pid || j->nlive == 0;
+}
+
+// print the lines of finished jobs, in job id order; returns the next one to print
+static int quit_print_done(job_arr *jobs, quit_entry *entries, int n, int next)
+{
+    while (next < n && quit_entry_done(jobs, &entries[next])) {
+        quit_entry *e = &entries[next++];
+
+        printf("[%d] %s - sending SIGTERM... ", e->id, e->command);
+        if (e->term_errno != 0) {
+            fflush(stdout);
+            fprintf(stderr, "smash error: quit: SIGTERM failed: %s\n", strerror(e->term_errno));
+        } else if (e->killed) {
+            printf("sending SIGKILL... ");
+            if (e->kill_errno != 0) {
+                fflush(stdout);
+                fprintf(stderr, "smash error: quit: SIGKILL failed: %s\n", strerror(e->kill_errno));
+            }
+        }
+        printf("done\n");
     }
+    fflush(stdout);
+    return next;
+}
 
+int quit(char **args, int argc, job_arr *jobs)
+{
 	if (argc == 1 && strcmp(args[1], "kill") != 0) {
         fprintf(stderr, "smash error: quit: unexpected arguments\n");
         return 1;
@@ -603,84 +628,79 @@ int quit(char **args, int argc, job_arr *jobs)
 
 	 /* ---------- case: plain 'quit' ---------- */
 	if (argc == 0) {
+			fflush(stdout);   // batch mode buffers stdout fully
 			_exit(0);   // terminate smash immediately
 	}
 
 	/* ---------- case: 'quit kill' ---------- */
-	// scan all job slots marks whether this slot is active only active jobs are processed.
-	for (int id = 1; id <= MAX_JOBS; ++id) {
-        if (!jobs->jobs[id].full)
-            continue;
-
-        job  *j   = &jobs->jobs[id];
-        pid_t pid = j->pid;
-
-        int status = 0;
-        long rv;
-
-        /* skip jobs that already finished */
-        rv = my_system_call(SYS_WAITPID, pid, &status, WNOHANG);
-        if (rv == -1) {
-            // child is probably gone remove from table and skip
-            delete_job(jobs, id);
-            continue;
-        }
-        if (rv > 0) {
-            // already terminated Remove it from jobs list
-            delete_job(jobs, id);
+    // every job gets SIGTERM at once, then they share one 5 second deadline:
+    // exits are collected by the event loop as they happen, only the jobs
+    // still alive at the deadline get SIGKILL
+    job_queue_close();   // nothing queued starts any more, it is just dropped
+    event_loop_poll();   // drop the jobs that already finished
+
+    quit_entry *entries = malloc(sizeof(quit_entry) * (size_t)(jobs->job_counter + 1));
+    int n = 0;
+
+    for (int id = 1; id <= jobs->highest_id && entries; ++id) {
+        job *j = find_job(jobs, id);
+        if (!j)
             continue;
-        }
-
-        /* 1) header: "[id] command - "  (spaces around '-') */
-        printf("[%d] %s - ", id, j->command);
 
-        /* 2) send SIGTERM and print message */
-        printf("sending SIGTERM... ");
-        fflush(stdout);
-
-        long kr = my_system_call(SYS_KILL, pid, SIGTERM);
-        if (kr == -1) {
-            perror("smash error: quit: SIGTERM failed");
-            printf("done\n");
+        /* skip jobs that already finished (every process reaped or gone) */
+        if (poll_job(j) == 0) {
             delete_job(jobs, id);
             continue;
         }
 
-        /* 3) wait up to 5 seconds after SIGTERM */
-        sleep(5);
+        quit_entry *e = &entries[n];
+        e->command = copy_string(j->command);
+        if (!e->command)
+            break;
+        e->id = id;
+        e->pid = j->pid;
+        e->killed = 0;
+        e->kill_errno = 0;
+        e->term_errno = 0;
+        ++n;
+
+        if (signal_job(j, SIGTERM) == -1)
+            e->term_errno = errno;
+        else if (j->status == STOPPED)
+            (void)signal_job(j, SIGCONT);   // a stopped job only sees SIGTERM once it runs
+    }
 
-        rv = my_system_call(SYS_WAITPID, pid, &status, WNOHANG);
-        if (rv == -1) {
-            perror("smash error: quit: waitpid failed");
-            printf("done\n");
-            delete_job(jobs, id);
-            continue;
-        }
+    /* wait for the exits until the deadline, printing in job order */
+    int next = quit_print_done(jobs, entries, n, 0);
+    long deadline = monotonic_ms() + QUIT_TERM_TIMEOUT_MS;
+    long left;
+    while (next < n && (left = deadline - monotonic_ms()) > 0) {
+        if (event_loop_run((int)left) == -1)
+            break;
+        next = quit_print_done(jobs, entries, n, next);
+    }
 
-        if (rv > 0) {
-            /* process exited within those 5 seconds */
-            printf("done\n");
-            delete_job(jobs, id);
+    /* still alive after the deadline → SIGKILL */
+    for (int k = next; k < n; ++k) {
+        quit_entry *e = &entries[k];
+        if (quit_entry_done(jobs, e))
             continue;
-        }
-
-        /* 4) still alive after 5 seconds → SIGKILL */
-        printf("sending SIGKILL... ");
-        fflush(stdout);
+        e->killed = 1;
+        if (signal_job(find_job(jobs, e->id), SIGKILL) == -1)
+            e->kill_errno = errno;
+    }
 
-        kr = my_system_call(SYS_KILL, pid, SIGKILL);
-        if (kr == -1) {
-            perror("smash error: quit: SIGKILL failed");
-            printf("done\n");
-        } else {
-            // reap it (blocking is fine, we're quitting anyway)
-            my_system_call(SYS_WAITPID, pid, &status, 0);
-            printf("done\n");
+    // reap them (blocking is fine, we're quitting anyway)
+    while (next < n) {
+        next = quit_print_done(jobs, entries, n, next);
+        if (next < n && event_loop_run(-1) == -1) {
+            job *j = find_job(jobs, entries[next].id);
+            if (j)
+                wait_job(j, NULL);
         }
-
-        delete_job(jobs, id);
     }
 
+    fflush(stdout);
     _exit(0);   // after handling all jobs, terminate smash
 }
 
@@ -689,115 +709,127 @@ int quit(char **args, int argc, job_arr *jobs)
 
 
 
-int parseCommand(char *cmd)
-{
-    int argc = 0;
-    g_is_bg = 0;   // reset background flag for this command
-    char *tok = strtok(cmd, " \t\n");  // handles any number of spaces & tabs
-
-    while (tok && argc < ARGS_NUM_MAX) {
-        // If token is "&", mark as background and DO NOT add it to argv
-        if (strcmp(tok, "&") == 0) {
-            g_is_bg = 1;
-            // We *don't* put "&" in g_argv[]
-            // According to the assignment, "&" appears only at the end,
-            // so we can just keep parsing in case there is weird input,
-            // but normally there should be no more tokens.
-            break;
-
-        } else {
-            g_argv[argc++] = tok;
-        }
+//###############################################pragma endregion
 
-        tok = strtok(NULL, " \t\n");
-    }
+/*=============================================================================
+* builtin registry (builtins.h)
+=============================================================================*/
 
-    g_argv[argc] = NULL;  // terminate argv-style array
+// the job builtins work on smash's job table
+static int jobs_builtin(exec_ctx *ctx, char **args, int argc)    { return jobs(ctx, args, argc, &job_list); }
+static int jobstat_builtin(exec_ctx *ctx, char **args, int argc) { return jobstat(ctx, args, argc, &job_list); }
+static int kill_builtin(exec_ctx *ctx, char **args, int argc)    { return kill_cmd(args, argc, &job_list); }
+static int fg_builtin(exec_ctx *ctx, char **args, int argc)      { return fg(args, argc, &job_list); }
+static int bg_builtin(exec_ctx *ctx, char **args, int argc)      { return bg(args, argc, &job_list); }
+static int quit_builtin(exec_ctx *ctx, char **args, int argc)    { return quit(args, argc, &job_list); }
 
-    return argc;          // number of *real* args (without "&")
-}
+// what builtins keep between commands (cd -)
+static shell_state shell;
 
-//###############################################pragma endregion
+#define BUILTIN_ENTRY(name, handler, min_args, max_args, msg, flags) \
+    { name, handler, min_args, max_args, msg, flags },
 
-int command_Manager(int numArgs, char *original_line)
-{
-    if (numArgs == 0)
-        return 0;  // nothing to do = "success"
+static const builtin builtin_table[] = { BUILTIN_LIST(BUILTIN_ENTRY) };
 
-    char *cmd = g_argv[0];
+// builtin_hash.h must come from the current list (make regenerates it)
+typedef char builtin_hash_is_current[
+    (BUILTIN_HASH_COUNT == sizeof(builtin_table) / sizeof(builtin_table[0])) ? 1 : -1];
 
-    /* ---------- alias & unalias builtins (not alias-expanded) ---------- */
-    if (strcmp(cmd, "alias") == 0) {
-        return alias_cmd(g_argv, numArgs - 1, original_line);
-    }
+// the builtin called name, NULL for anything else: one hash, one compare
+static const builtin* find_builtin(const char *name)
+{
+    int i = builtin_slot[builtin_hash(name, BUILTIN_HASH_SEED) & (BUILTIN_HASH_SIZE - 1)];
+    if (i < 0 || strcmp(builtin_table[i].name, name) != 0)
+        return NULL;
+    return &builtin_table[i];
+}
 
-    if (strcmp(cmd, "unalias") == 0) {
-        return unalias_cmd(g_argv, numArgs - 1);
-    }
+static int run_command(command *c, const char *text, bool background)
+{
+    if (c->argc == 0)
+        return 0;  // nothing to do = "success"
 
-    /* ---------- alias EXPANSION for other commands ---------- */
-    const char *expansion = find_alias_value(cmd);
-    if (expansion != NULL) {
-        if (alias_expansion_depth >= MAX_ALIAS_EXPANSION_DEPTH) {
-            fprintf(stderr, "smash error: alias: expansion too deep (possible recursion)\n");
+    char **argv  = c->argv;
+    int numArgs  = c->argc;
+    char *cmd    = argv[0];
+    const builtin *b = find_builtin(cmd);
+
+    /* ---------- alias EXPANSION (not for alias / unalias themselves) ---------- */
+    alias_def *alias = (c->no_alias || (b && (b->flags & BI_NO_ALIAS))) ? NULL : alias_find(cmd);
+    if (alias != NULL) {
+        // parsed when it was defined: only our arguments (and '&') are spliced in
+        cmd_line cl;
+        TRACE_BEGIN("alias_expand");
+        int expanded = alias_expand(&line_arena, alias, c, background, &cl);
+        TRACE_END("alias_expand");
+        if (expanded == -1) {
+            fprintf(stderr, "smash error: alias: malloc failed\n");
             return 1;
         }
 
-        alias_expansion_depth++;
-
-        char buf[CMD_LENGTH_MAX];
-        strncpy(buf, expansion, CMD_LENGTH_MAX - 1);
-        buf[CMD_LENGTH_MAX - 1] = '\0';
+        // our redirections cover everything the alias runs
+        redirect_state rs;
+        if (c->nredirs > 0 && redirect_begin(c, &rs) == -1)
+            return 1;
 
-        int ret;
-        if (strstr(buf, "&&") != NULL) {
-            // expansion itself may contain '&&'
-            ret = handle_compound_commands(buf);
-        } else {
-            char tmp[CMD_LENGTH_MAX];
-            strcpy(tmp, buf);
-            int argc2 = parseCommand(tmp);
-            ret = command_Manager(argc2, buf);
-        }
+        alias_hold(alias);   // its commands may unalias it
+        int ret = run_chain(&cl);   // may hold '&&' and pipelines itself
+        alias_release(alias);
 
-        alias_expansion_depth--;
+        if (c->nredirs > 0)
+            redirect_end(&rs);
         return ret;
     }
 
 
 /* ---------- built-ins commands --------------------------------------- */
-    
-    if (strcmp(cmd, "showpid") == 0) {
-        // argc here = number of arguments *after* the command name
-        return showpid(g_argv, numArgs - 1);
-
-    } else if (strcmp(cmd, "pwd") == 0) {
-        return pwd(g_argv, numArgs - 1);
 
-    } else if (strcmp(cmd, "cd") == 0) {
-        return cd(g_argv, numArgs - 1);
-
-    } else if (strcmp(cmd, "diff") == 0) {
-        return cmd_diff(g_argv, numArgs - 1);
-
-    } else if (strcmp(cmd, "jobs") == 0) {
-        return jobs(g_argv, numArgs - 1, &job_list);
-
-    } else if (strcmp(cmd, "kill") == 0) {
-        return kill(g_argv, numArgs - 1, &job_list);
+    if (b != NULL) {
+        // argc here = number of arguments *after* the command name
+        int argc = numArgs - 1;
+        if (argc < b->min_args || (b->max_args != ARGS_ANY && argc > b->max_args)) {
+            fprintf(stderr, "smash error: %s: %s\n", b->name, b->arity_msg);
+            return 1;
+        }
 
-    } else if (strcmp(cmd, "fg") == 0) {
-        return fg(g_argv, numArgs - 1, &job_list);
+        // '&': as a job in a forked smash if it allows it, else right here as usual
+        // (BI_OWN_JOB builtins start their job themselves)
+        if (background && (b->flags & BI_BACKGROUND)) {
+            pipeline job_pipe = { c, 1, arena_strndup(&line_arena, text, strlen(text)), true };
+            if (job_pipe.text == NULL) {
+                perror("smash error: malloc failed");
+                return 1;
+            }
+            return run_pipeline(&job_pipe);
+        }
+        // redirected: right here all the same, 0 / 1 / 2 are switched for its run
+        redirect_state rs;
+        if (c->nredirs > 0 && redirect_begin(c, &rs) == -1)
+            return 1;
 
-    } else if (strcmp(cmd, "bg") == 0) {
-        return bg(g_argv, numArgs - 1, &job_list);
+        exec_ctx ctx = { &shell, stdout, text, background, false };
+        int ret = b->handler(&ctx, argv, argc);   // quit may _exit(0) inside
 
-    } else if (strcmp(cmd, "quit") == 0) {
-        return quit(g_argv, numArgs - 1, &job_list);  // may _exit(0) inside
+        if (c->nredirs > 0)
+            redirect_end(&rs);
+        return ret;
     }
 
-    // not a built-in -> external command
-    return run_external_command(g_argv, original_line);
+    // not a built-in -> external command, its files are handed to the child
+    int fds[3] = { -1, -1, -1 };
+    if (redirect_open(c, fds) == -1)
+        return 1;
+    int ret = run_external_command(argv, fds, text, background);
+    redirect_close(fds);
+    return ret;
+}
+
+int command_Manager(command *c, const char *text, bool background)
+{
+    TRACE_BEGIN("command_Manager");
+    int ret = run_command(c, text, background);
+    TRACE_END("command_Manager");
+    return ret;
 }
 
 
@@ -805,41 +837,132 @@ int command_Manager(int numArgs, char *original_line)
 
 //###################################################################
 
-int run_external_command(char **argv, const char *original_line)
+/*
+ * Launch engine for external commands.
+ *  - spawn (default): posix_spawn via SYS_SPAWN, no page-table copy of smash
+ *  - fork: the classic fork + setpgrp + execvp path
+ * Selected once from the environment: SMASH_SPAWN=fork|spawn, so both paths
+ * can be compared on the same workload.
+ */
+static int spawn_mode = -1;   // -1 = not read yet, 0 = fork, 1 = spawn
+
+// set in a forked pipeline stage: exec the external command in this process
+static int exec_in_place = 0;
+
+static int use_spawn(void)
 {
-    // ---------- fork a child process ----------
-    pid_t pid = (pid_t)my_system_call(SYS_FORK);
-    if (pid < 0) {
-        perror("smash error: fork failed");
-        return 1; // failure
+    if (spawn_mode == -1) {
+        const char *mode = getenv("SMASH_SPAWN");
+        spawn_mode = (mode != NULL && strcmp(mode, "fork") == 0) ? 0 : 1;
     }
+    return spawn_mode;
+}
 
-    /* ================= CHILD PROCESS ================= */
-    if (pid == 0) {
-        // Put the child in a new process group (required for job control)
-        setpgrp();
+// print the error for a program that could not be executed
+static void report_exec_failure(int err)
+{
+    if (err == ENOENT) {
+        fprintf(stderr, "smash error: external: cannot find program\n");
+    } else {
+        fprintf(stderr, "smash error: external: invalid command\n");
+    }
+}
 
-        long rv = my_system_call(SYS_EXECVP, argv[0], argv);
+// exit code of a command from its wait status (128 + signal if killed, like sh)
+static int exit_code_of(int status)
+{
+    if (WIFEXITED(status))
+        return WEXITSTATUS(status);   // program's return value
+    if (WIFSIGNALED(status))
+        return 128 + WTERMSIG(status);
+    return 1;
+}
 
-        // If we got here, exec failed.
-        if (rv == -1) {
-            if (errno == ENOENT) {
-                fprintf(stderr, "smash error: external: cannot find program\n");
-            } else {
-                fprintf(stderr, "smash error: external: invalid command\n");
-            }
+/*
+ * posix_spawn prog (argv[0] resolved) into process group pgid (0 = a new one),
+ * fds as for launch_stage (NULL = inherit all). Returns the pid, or -1 with
+ * the error reported.
+ */
+static pid_t spawn_program(const char *prog, char **argv, pid_t pgid, const int fds[3])
+{
+    pid_t pid;
+    if (my_system_call_ext(SYS_SPAWN, &pid, prog, argv, pgid, fds) == -1) {
+        if (errno == EAGAIN || errno == ENOMEM) {
+            perror("smash error: fork failed");
         } else {
-            fprintf(stderr, "smash error: external: invalid command\n");
+            if (errno == ENOENT)
+                path_cache_forget(argv[0]);   // cached path went stale
+            report_exec_failure(errno);
         }
-
-        _exit(1);  // Child must exit on failure
+        return -1;
     }
+    return pid;
+}
 
-    /* ================= PARENT PROCESS (smash) ================= */
+int run_external_command(char **argv, const int fds[3], const char *text, bool background)
+{
+    pid_t pid;
+
+    // resolve argv[0] through the PATH cache; a cached miss fails without forking
+    const char *prog = path_cache_lookup(argv[0]);
+    if (prog == NULL) {
+        report_exec_failure(errno);
+        return 1;
+    }
+
+    // our buffered output goes first (stdout is fully buffered in batch mode)
+    fflush(stdout);
+
+    if (exec_in_place) {
+        // a pipeline stage or the last line of a script: become the program
+        redirect_apply(fds);
+        TRACE_MARK("exec", 0);
+        my_system_call(SYS_EXECVP, prog, argv);
+        report_exec_failure(errno);
+        _exit(1);
+    }
+
+    if (use_spawn()) {
+        // ---------- spawn the child (new process group, no fork) ----------
+        TRACE_BEGIN("spawn");
+        pid = spawn_program(prog, argv, 0, fds);
+        TRACE_END("spawn");
+        if (pid == -1)
+            return 1; // failure, no child was left running
+        event_loop_watch_pid(pid);
+    } else {
+        // ---------- fork a child process ----------
+        TRACE_BEGIN("fork");
+        pid = (pid_t)my_system_call(SYS_FORK);
+        TRACE_END("fork");   // in both of them
+        if (pid < 0) {
+            perror("smash error: fork failed");
+            return 1; // failure
+        }
 
-    if (g_is_bg) {
+        /* ================= CHILD PROCESS ================= */
+        if (pid == 0) {
+            restore_child_signals();   // smash keeps them blocked for its event loop
+
+            // Put the child in a new process group (required for job control)
+            setpgid(0, 0);
+            redirect_apply(fds);
+
+            TRACE_MARK("exec", 0);
+            my_system_call(SYS_EXECVP, prog, argv);
+
+            // If we got here, exec failed.
+            report_exec_failure(errno);
+            _exit(1);  // Child must exit on failure
+        }
+        event_loop_watch_pid(pid);
+    }
+
+    /* ================= PARENT PROCESS (smash) ================= */
+
+    if (background) {
         // ---------- background command ----------
-        int job_id = add_job(&job_list, pid, original_line, BG);
+        int job_id = add_job(&job_list, pid, text, BG);
         if (job_id == -1) {
             fprintf(stderr, "smash error: jobs list is full\n");
             // process still runs, we just don't track it
@@ -850,10 +973,12 @@ int run_external_command(char **argv, const char *original_line)
     /* ---------- foreground command ---------- */
 
     // Put FG job into slot 0
-    int job_id = add_job(&job_list, pid, original_line, FG);
+    add_job(&job_list, pid, text, FG);
     int status = 0;
 
-    long wr = my_system_call(SYS_WAITPID, pid, &status, WUNTRACED);
+    // CTRL+C / CTRL+Z and background exits are handled while we wait
+    job *fgj = job_at(&job_list, 0);
+    int wr   = event_loop_wait_job(fgj, &status);
     if (wr == -1) {
         perror("smash error: waitpid failed");
         clear_fg_job(&job_list);   // make sure fg slot is not left dirty
@@ -861,9 +986,7 @@ int run_external_command(char **argv, const char *original_line)
     }
 
     // If the process was stopped (Ctrl+Z), move it into jobs[1..] as STOPPED
-    if (WIFSTOPPED(status)) {
-        job *fgj = &job_list.jobs[0];
-
+    if (wr == 1) {
         // Try to add it as a STOPPED BG job with a real job id
         if (fgj->full) {
             if (add_job(&job_list, fgj->pid, fgj->command, STOPPED) == -1) {
@@ -877,145 +1000,405 @@ int run_external_command(char **argv, const char *original_line)
     }
 
     // Process finished (normal exit or killed)
-    int exit_code = 1;   // default: failure
-
-    if (WIFEXITED(status)) {
-        exit_code = WEXITSTATUS(status);   // program's return value
-    } else if (WIFSIGNALED(status)) {
-        exit_code = 1;                     // killed by signal → treat as failure
-    }
+    int exit_code = exit_code_of(status);
 
+    job_record_finished(&job_list, fgj, 0);
     clear_fg_job(&job_list);
 
-    // success if child returned 0, otherwise failure
-    return (exit_code == 0) ? 0 : 1;
+    // 0 = success, anything else fails the && chain (and is smash's exit code if last)
+    return exit_code;
 }
 
 
 //###################################
 
-// Remove leading and trailing spaces/tabs in-place.
-// Returns pointer to the first non-space character.
-static char* trim_spaces(char *s)
+// run the pipelines of a parsed line while they succeed (&&), returns the last status
+static int run_chain(cmd_line *cl)
 {
-    while (*s == ' ' || *s == '\t')
-        s++;
+    int final_status = 0;     // result of last executed command
+    TRACE_BEGIN("run_chain");
 
-    char *end = s + strlen(s);
-    while (end > s && (end[-1] == ' ' || end[-1] == '\t'))
-        end--;
+    for (int i = 0; i < cl->nchain; ++i) {
+        pipeline *p = &cl->chain[i];
 
-    *end = '\0';
-    return s;
+        if (p->nstages > 1)
+            final_status = run_pipeline(p);
+        else
+            final_status = command_Manager(&p->stages[0], p->text, p->background);
+
+        if (final_status != 0)
+            break;   // This command failed -> stop executing further
+    }
+    TRACE_END("run_chain");
+    return final_status;
+}
+
+int run_line(char *line)
+{
+    arena_reset(&line_arena);   // whatever the previous line parsed is done with
+
+    cmd_line cl;
+    TRACE_BEGIN("parse");
+    int bad = parse_line(&line_arena, line, &cl) == -1;
+    TRACE_END("parse");
+    if (bad)
+        return 1;
+    return run_chain(&cl);
 }
 
-//#############################################################
+//#########################################################################################
 
-int handle_compound_commands(char *line)
+/*
+ * Pipelines: "cmd1 | cmd2 | ... [&]"
+ *  - all stages start at once in one process group and form a single job,
+ *    so fg/bg/kill/Ctrl-C/Ctrl-Z act on the whole pipeline
+ *  - external stages go through the regular launch engine (spawn or fork),
+ *    builtins (those flagged BI_PIPELINE) and aliases run in a forked copy of smash
+ *  - the exit status is the one of the last stage
+ */
+
+/*
+ * Pipe buffer size for pipeline stages (F_SETPIPE_SZ), 0 = kernel default.
+ * Read once from the environment: SMASH_PIPE_SIZE=<bytes>.
+ */
+static long pipe_size = -1;
+
+static long pipe_buffer_size(void)
 {
-    char buffer[CMD_LENGTH_MAX + 1];
-    strncpy(buffer, line, CMD_LENGTH_MAX);
-    buffer[CMD_LENGTH_MAX] = '\0';
+    if (pipe_size == -1) {
+        const char *val = getenv("SMASH_PIPE_SIZE");
+        char *endptr = NULL;
+        long size = (val != NULL) ? strtol(val, &endptr, 10) : 0;
 
-    char *nextPart = buffer;  // part we are currently processing
-    int final_status = 0;     // result of last executed command
+        pipe_size = (val != NULL && *val != '\0' && *endptr == '\0' && size > 0) ? size : 0;
+    }
+    return pipe_size;
+}
 
-    while (1) {
-        // Look for "&&" in the remaining string
-        char *andPos = strstr(nextPart, "&&");
+/*
+ * Start one stage (command c of the pipeline) in process group pgid
+ * (0 = new group led by this stage). fds[i] != -1 replaces descriptor i,
+ * spare_fd is the read end of the stage's own output pipe (closed in the child).
+ * Returns the pid, or -1 if the stage could not be started.
+ */
+static pid_t launch_stage(command *c, pid_t pgid, const int fds[3], int spare_fd)
+{
+    pid_t pid;
+    char **argv = c->argv;
+
+    if (use_spawn() && find_builtin(argv[0]) == NULL && (c->no_alias || alias_find(argv[0]) == NULL)) {
+        const char *prog = path_cache_lookup(argv[0]);
+        if (prog == NULL) {
+            report_exec_failure(errno);
+            return -1;
+        }
+        // its own redirections win over the pipes
+        int stage_fds[3] = { fds[0], fds[1], fds[2] };
+        int files[3];
+        if (redirect_open(c, files) == -1)
+            return -1;
+        for (int i = 0; i < 3; ++i) {
+            if (files[i] != -1)
+                stage_fds[i] = files[i];
+        }
 
-        // This will hold the current simple command (trimmed)
-        char *cmd_segment = NULL;
+        fflush(stdout);   // ahead of what the stage writes
+        TRACE_BEGIN("spawn");
+        pid = spawn_program(prog, argv, pgid, stage_fds);
+        TRACE_END("spawn");
+        redirect_close(files);
+        if (pid == -1)
+            return -1;
+        event_loop_watch_pid(pid);
+        return pid;
+    }
 
-        if (!andPos) {
-            // No more "&&" -> nextPart is the final command
-            cmd_segment = trim_spaces(nextPart);
+    fflush(stdout);   // the child must not repeat what we buffered so far
+    TRACE_BEGIN("fork");
+    pid = (pid_t)my_system_call(SYS_FORK);
+    TRACE_END("fork");
+    if (pid < 0) {
+        perror("smash error: fork failed");
+        return -1;
+    }
 
-            // If empty after trimming, nothing to do
-            if (cmd_segment[0] == '\0') {
-                return final_status;  // whatever happened before
+    /* ================= CHILD PROCESS (smash copy) ================= */
+    if (pid == 0) {
+        restore_child_signals();
+        setpgid(0, pgid);
+
+        for (int i = 0; i < 3; ++i) {
+            if (fds[i] != -1 && fds[i] != i) {
+                dup2(fds[i], i);
+                my_system_call(SYS_CLOSE, fds[i]);
             }
+        }
+        if (spare_fd != -1)
+            my_system_call(SYS_CLOSE, spare_fd);
 
-            // Make a copy for parseCommand (because it uses strtok and modifies string)
-            char cmd_for_parse[CMD_LENGTH_MAX + 1];
-            strncpy(cmd_for_parse, cmd_segment, CMD_LENGTH_MAX);
-            cmd_for_parse[CMD_LENGTH_MAX] = '\0';
+        exec_in_place = 1;   // an external command (maybe behind an alias) replaces us
 
-            int argc = parseCommand(cmd_for_parse);
-            if (argc == 0) {
-                return final_status;
-            }
+        int ret = command_Manager(c, argv[0], false);
+        fflush(stdout);
+        _exit(ret >= 0 && ret <= 255 ? ret : 255);   // the stage's own status, as an exit code
+    }
+
+    // set the group from the parent too, so waitpid(-pgid) can't race the child
+    setpgid(pid, pgid ? pgid : pid);
+    event_loop_watch_pid(pid);
+    return pid;
+}
+
+// a BI_THREAD builtin stage that runs as typed (no alias, no redirection,
+// valid arity) may go on a thread; returns it, NULL if the stage is forked
+static const builtin* thread_stage(const command *c)
+{
+    const builtin *b = find_builtin(c->argv[0]);
+    if (!b || !(b->flags & BI_THREAD) || c->nredirs > 0)
+        return NULL;
+    if (!c->no_alias && alias_find(c->argv[0]) != NULL)
+        return NULL;
+    int argc = c->argc - 1;
+    if (argc < b->min_args || (b->max_args != ARGS_ANY && argc > b->max_args))
+        return NULL;   // the forked copy prints the error as always
+    return b;
+}
+
+// the stage threads of a pipeline become members of its job (id, 0 = fg slot)
+static void attach_threads(int id, stage_threads *threads)
+{
+    if (!threads)
+        return;
+    if (id < 0) {
+        stage_threads_release(&job_list, threads);   // they run on, untracked
+        return;
+    }
+    job_table_lock(&job_list);
+    job_at(&job_list, id)->threads = threads;
+    job_table_unlock(&job_list);
+}
+
+/*
+ * Start every stage of p, wired with pipes, in one process group.
+ * pids gets the started ones (*npids), *pgid the group; *last_failed = the
+ * last stage could not start; *threads = the stages running on threads
+ * (NULL = none), one reference for the caller, who hands it to the job.
+ * returns 0, or 1 if no process started at all.
+ */
+static int start_stages(pipeline *p, pid_t *pids, int *npids, pid_t *pgid, int *last_failed,
+                        stage_threads **threads)
+{
+    int nstages = p->nstages;
+    int in_fd   = -1;    // read end feeding the current stage
+
+    *npids       = 0;
+    *pgid        = 0;    // first started stage leads the group
+    *last_failed = 0;
 
-            final_status = command_Manager(argc, cmd_segment);
-            return final_status;
+    for (int i = 0; i < nstages; ++i) {
+        int pipe_fds[2] = { -1, -1 };
+
+        if (i < nstages - 1 &&
+            my_system_call_ext(SYS_PIPE_CLOEXEC, pipe_fds, pipe_buffer_size()) == -1) {
+            perror("smash error: pipe failed");
+            *last_failed = 1;
+            break;   // stages started so far see EOF and finish
         }
 
-        // Cut the buffer at "&&"
-        *andPos = '\0';
-
-        // Left part is the next command
-        cmd_segment = trim_spaces(nextPart);
-
-        // Skip empty left segment
-        if (cmd_segment[0] != '\0') {
-            // Make a copy for parsing
-            char cmd_for_parse[CMD_LENGTH_MAX + 1];
-            strncpy(cmd_for_parse, cmd_segment, CMD_LENGTH_MAX);
-            cmd_for_parse[CMD_LENGTH_MAX] = '\0';
-
-            int argc = parseCommand(cmd_for_parse);
-            if (argc > 0) {
-                int status = command_Manager(argc, cmd_segment);
-                if (status != 0) {
-                    // This command failed -> stop executing further
-                    return status;
-                }
-                final_status = status;
-            }
+        // a builtin feeding the next stage: on a thread if it can, else in a forked smash
+        const builtin *b = i < nstages - 1 ? thread_stage(&p->stages[i]) : NULL;
+        if (b && *threads == NULL)
+            *threads = stage_threads_new();
+        bool threaded = b && *threads &&
+            stage_thread_start(&job_list, *threads, &shell, b, &p->stages[i], in_fd, pipe_fds[1]) == 0;
+
+        int fds[3] = { in_fd, pipe_fds[1], -1 };
+        pid_t pid = threaded ? 0 : launch_stage(&p->stages[i], *pgid, fds, pipe_fds[0]);
+
+        // the parent keeps only the read end for the next stage
+        if (in_fd != -1)
+            my_system_call(SYS_CLOSE, in_fd);
+        if (pipe_fds[1] != -1)
+            my_system_call(SYS_CLOSE, pipe_fds[1]);
+        in_fd = pipe_fds[0];
+
+        if (threaded)
+            continue;
+        if (pid == -1) {
+            if (i == nstages - 1)
+                *last_failed = 1;
+            continue;
         }
 
-        // Continue with the right side, after the "&&"
-        nextPart = andPos + 2;
+        if (*pgid == 0)
+            *pgid = pid;
+        pids[(*npids)++] = pid;
     }
+
+    if (in_fd != -1)
+        my_system_call(SYS_CLOSE, in_fd);
+
+    return *npids == 0 ? 1 : 0;
 }
 
-//#########################################################################################
+// builtins that change smash itself would only change a forked copy;
+// returns the first stage of p that is one of them, NULL if there is none
+static const builtin* smash_only_stage(const pipeline *p)
+{
+    for (int i = 0; i < p->nstages; ++i) {
+        const builtin *b = find_builtin(p->stages[i].argv[0]);
+        if (b && !(b->flags & BI_PIPELINE))
+            return b;
+    }
+    return NULL;
+}
 
-/* alias: alias name="some commands" */
-int alias_cmd(char **args, int argc, const char *original_line)
+int run_pipeline(pipeline *p)
 {
-    (void)args;  // we ignore tokenized args; we re-parse from original_line
+    int nstages = p->nstages;
+    if (nstages > PIPE_STAGES_MAX) {
+        fprintf(stderr, "smash error: pipe: too many stages\n");
+        return 1;
+    }
 
-    // must have at least a name after "alias"
-    if (argc < 1) {
-        fprintf(stderr, "smash error: alias: invalid arguments\n");
+    const builtin *b = nstages > 1 ? smash_only_stage(p) : NULL;
+    if (b) {
+        fprintf(stderr, "smash error: %s: cannot run in a pipeline\n", b->name);
         return 1;
     }
 
-    const char *p = original_line;
+    /* ---------- start every stage, wired with pipes ---------- */
+    pid_t pids[PIPE_STAGES_MAX];
+    int   npids, last_failed;
+    pid_t pgid;
+    stage_threads *threads = NULL;
 
-    // skip leading spaces
-    while (*p == ' ' || *p == '\t') p++;
+    if (start_stages(p, pids, &npids, &pgid, &last_failed, &threads) != 0) {
+        stage_threads_release(&job_list, threads);
+        return 1;
+    }
 
-    // must start with "alias"
-    if (strncmp(p, "alias", 5) != 0) {
-        fprintf(stderr, "smash error: alias: invalid arguments\n");
+    /* ---------- background pipeline ---------- */
+    // job command is the full line, like for simple commands (including '&')
+    if (p->background) {
+        attach_threads(add_job_group(&job_list, pgid, pids, npids, p->text, BG), threads);
+        return 0;
+    }
+
+    /* ---------- foreground pipeline ---------- */
+    attach_threads(add_job_group(&job_list, pgid, pids, npids, p->text, FG), threads);
+    job *fgj = job_at(&job_list, 0);
+
+    int status = 0;
+    int w = event_loop_wait_job(fgj, &status);
+    if (w == -1) {
+        perror("smash error: waitpid failed");
+        clear_fg_job(&job_list);
         return 1;
     }
-    p += 5;
 
-    // skip spaces after 'alias'
-    while (*p == ' ' || *p == '\t') p++;
+    if (w == 1) {
+        // stopped (Ctrl+Z): keep the whole group as one STOPPED job
+        int id = add_job_group(&job_list, fgj->pid, fgj->pids, fgj->npids, fgj->command, STOPPED);
+        if (id > 0) {
+            job_table_lock(&job_list);
+            job *j = job_at(&job_list, id);
+            j->usage = fgj->usage;   // stages that already exited
+            j->threads = fgj->threads;
+            fgj->threads = NULL;
+            job_table_unlock(&job_list);
+        }
+        clear_fg_job(&job_list);
+        return 1;
+    }
 
-    // parse alias name: up to '=' or whitespace
-    char name_buf[CMD_LENGTH_MAX];
-    int ni = 0;
-    while (*p && *p != '=' && *p != ' ' && *p != '\t' && ni < CMD_LENGTH_MAX - 1) {
-        name_buf[ni++] = *p++;
+    job_record_finished(&job_list, fgj, 0);
+    clear_fg_job(&job_list);
+
+    if (last_failed)
+        return 1;
+    return exit_code_of(status);   // of the last stage
+}
+
+int start_queued_job(pipeline *p, int id)
+{
+    pid_t pids[PIPE_STAGES_MAX];
+    int   npids, last_failed;
+    pid_t pgid;
+
+    stage_threads *threads = NULL;
+
+    if (start_stages(p, pids, &npids, &pgid, &last_failed, &threads) != 0) {
+        stage_threads_release(&job_list, threads);
+        return -1;
+    }
+    if (job_start_queued(&job_list, id, pgid, pids, npids) == -1) {
+        stage_threads_release(&job_list, threads);
+        return -1;   // the processes run on, untracked
+    }
+    attach_threads(id, threads);
+    return 0;
+}
+
+int run_last_line(char *line)
+{
+    arena_reset(&line_arena);
+
+    cmd_line cl;
+    TRACE_BEGIN("parse");
+    int bad = parse_line(&line_arena, line, &cl) == -1;
+    TRACE_END("parse");
+    if (bad)
+        return 1;
+
+    if (cl.nchain == 1 && cl.chain[0].nstages == 1 && !cl.chain[0].background) {
+        char **argv = cl.chain[0].stages[0].argv;
+
+        if (find_builtin(argv[0]) == NULL && alias_find(argv[0]) == NULL) {
+            // nothing runs after it: no fork, no wait, its exit status is ours
+            int fds[3];
+            if (redirect_open(&cl.chain[0].stages[0], fds) == -1)
+                return 1;
+            restore_child_signals();
+            exec_in_place = 1;
+            return run_external_command(argv, fds, cl.chain[0].text, false);   // returns only if not found
+        }
     }
-    name_buf[ni] = '\0';
+    return run_chain(&cl);
+}
 
-    if (ni == 0) {
+//#########################################################################################
+
+/* alias: alias name="some commands" */
+int alias_cmd(exec_ctx *ctx, char **args, int argc)
+{
+    // the words after "alias" as one text (quotes are already gone):
+    // name="a b" -> name=a b, and the old spaced form name = value still works
+    size_t len = 0;
+    for (int i = 1; i <= argc; ++i)
+        len += strlen(args[i]) + 1;
+
+    char *text = (char*)arena_alloc(&line_arena, len);
+    if (!text) {
+        fprintf(stderr, "smash error: alias: malloc failed\n");
+        return 1;
+    }
+    char *w = text;
+    for (int i = 1; i <= argc; ++i) {
+        size_t n = strlen(args[i]);
+        memcpy(w, args[i], n);
+        w += n;
+        *w++ = (i < argc) ? ' ' : '\0';
+    }
+
+    // parse alias name: up to '=' or whitespace
+    char *p = text;
+    char *name = p;
+    while (*p && *p != '=' && *p != ' ' && *p != '\t')
+        p++;
+    char *name_end = p;
+
+    if (name_end == name) {
         fprintf(stderr, "smash error: alias: invalid name\n");
         return 1;
     }
@@ -1027,55 +1410,551 @@ int alias_cmd(char **args, int argc, const char *original_line)
         fprintf(stderr, "smash error: alias: invalid arguments\n");
         return 1;
     }
+    *name_end = '\0';
     p++; // skip '='
 
-    // skip spaces before value
+    // value: the rest, without the spaces around it
     while (*p == ' ' || *p == '\t') p++;
+    char *end = p + strlen(p);
+    while (end > p && (end[-1] == ' ' || end[-1] == '\t'))
+        end--;
+    *end = '\0';
+
+    // parsed (and checked for loops) once, here
+    return alias_set(&line_arena, name, p) == -1 ? 1 : 0;
+}
 
-    // parse value
-    char value_buf[CMD_LENGTH_MAX];
 
-    if (*p == '"') {
-        // quoted value: alias x="......"
-        p++;  // skip opening quote
-        int vi = 0;
-        while (*p && *p != '"' && vi < CMD_LENGTH_MAX - 1) {
-            value_buf[vi++] = *p++;
-        }
-        value_buf[vi] = '\0';
-        // if closing quote is missing, we just stop at end-of-line
-    } else {
-        // unquoted: copy rest of line and trim spaces using your existing trim_spaces
-        char tmp[CMD_LENGTH_MAX];
-        strncpy(tmp, p, CMD_LENGTH_MAX - 1);
-        tmp[CMD_LENGTH_MAX - 1] = '\0';
+//###############################################################################
+
+/* hash: list the PATH cache with hit/miss counts, hash -r: flush it */
+int hash_cmd(exec_ctx *ctx, char **args, int argc)
+{
+    if (argc == 0) {
+        path_cache_print();
+        return 0;
+    }
 
-        char *trimmed = trim_spaces(tmp);   // your existing function
-        strncpy(value_buf, trimmed, CMD_LENGTH_MAX - 1);
-        value_buf[CMD_LENGTH_MAX - 1] = '\0';
+    if (argc == 1 && strcmp(args[1], "-r") == 0) {
+        path_cache_flush();
+        return 0;
     }
 
-    // store or update alias
-    set_alias(name_buf, value_buf);
+    fprintf(stderr, "smash error: hash: invalid arguments\n");
+    return 1;
+}
+
+//###############################################################################
+
+int unalias_cmd(exec_ctx *ctx, char **args, int argc)
+{
+    const char *name = args[1];
+    // removing a non-existing alias is just a no-op
+    (void)alias_unset(name);
     return 0;
 }
 
 
+
+
+
 //###############################################################################
 
-int unalias_cmd(char **args, int argc)
+// the parallel driver (a forked smash): keeps spec->jobs invocations running
+// in our process group until all are done; returns the exit code
+static int parallel_drive(const parallel_spec *spec, parallel_stats *stats)
 {
-    if (argc != 1) {
-        fprintf(stderr, "smash error: unalias: invalid arguments\n");
+    int total   = parallel_invocations(spec);
+    int next    = 0;
+    int running = 0;
+    int failed  = 0;
+    arena argv_arena = ARENA_INIT;   // argv of one invocation (spawn copies it)
+
+    while (next < total || running > 0) {
+        while (running < spec->jobs && next < total) {
+            arena_reset(&argv_arena);
+            char **argv = parallel_argv(&argv_arena, spec, next++);
+            const char *prog = argv ? path_cache_lookup(argv[0]) : NULL;
+
+            parallel_stats_started(stats);
+            pid_t pid = -1;
+            if (!argv)
+                fprintf(stderr, "smash error: parallel: out of memory\n");
+            else if (!prog)
+                report_exec_failure(errno);
+            else
+                pid = spawn_program(prog, argv, getpgrp(), NULL);
+
+            if (pid == -1) {
+                failed++;
+                parallel_stats_finished(stats, true);
+                continue;
+            }
+            running++;
+        }
+        if (running == 0)
+            continue;   // the rest could not start either, or all done
+
+        int status = 0;
+        pid_t w = (pid_t)my_system_call_ext(SYS_WAIT4, -1, &status, 0, (struct rusage*)NULL);
+        if (w == -1) {
+            if (errno == EINTR)
+                continue;
+            break;   // no children left to wait for
+        }
+        running--;
+
+        bool bad = !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+        failed += bad;
+        parallel_stats_finished(stats, bad);
+    }
+    return failed ? 1 : 0;
+}
+
+/* parallel [-j N] [-n K] cmd [word...] ::: args / :::: files (see parallel.h) */
+int parallel_cmd(exec_ctx *ctx, char **args, int argc)
+{
+    parallel_spec spec;
+    if (parallel_parse(&line_arena, args, argc, &spec) == -1)
+        return 1;
+
+    int total = parallel_invocations(&spec);
+    if (total == 0)
+        return 0;
+
+    // a program that is not there fails right away, not once per argument
+    if (strstr(spec.tmpl[0], "{}") == NULL && path_cache_lookup(spec.tmpl[0]) == NULL) {
+        report_exec_failure(errno);
         return 1;
     }
 
-    const char *name = args[1];
-    // removing a non-existing alias is just a no-op
-    (void)remove_alias(name);
+    parallel_stats *stats = parallel_stats_new(total);
+    if (!stats) {
+        perror("smash error: parallel: mmap failed");
+        return 1;
+    }
+
+    if (exec_in_place)
+        return parallel_drive(&spec, stats);   // a pipeline stage: we are the driver
+
+    fflush(stdout);   // the driver must not repeat what we buffered so far
+    pid_t pid = (pid_t)my_system_call(SYS_FORK);
+    if (pid < 0) {
+        perror("smash error: fork failed");
+        parallel_stats_free(stats);
+        return 1;
+    }
+
+    /* ================= CHILD PROCESS (the driver) ================= */
+    if (pid == 0) {
+        restore_child_signals();
+        setpgid(0, 0);   // its invocations join this group: one job for all of them
+        int ret = parallel_drive(&spec, stats);
+        fflush(stdout);
+        _exit(ret);
+    }
+
+    setpgid(pid, pid);
+    event_loop_watch_pid(pid);
+
+    /* ---------- background: one job, progress in jobs ---------- */
+    if (ctx->background) {
+        int id = add_job_group(&job_list, pid, &pid, 1, ctx->text, BG);
+        if (id > 0) {
+            job_table_lock(&job_list);
+            job_at(&job_list, id)->par = stats;
+            job_table_unlock(&job_list);
+        } else {
+            parallel_stats_free(stats);   // the driver runs on, untracked
+        }
+        return 0;
+    }
+
+    /* ---------- foreground ---------- */
+    add_job_group(&job_list, pid, &pid, 1, ctx->text, FG);
+    job *fgj = job_at(&job_list, 0);
+    fgj->par = stats;
+
+    int status = 0;
+    int w = event_loop_wait_job(fgj, &status);
+    if (w == -1) {
+        perror("smash error: waitpid failed");
+        clear_fg_job(&job_list);
+        return 1;
+    }
+
+    if (w == 1) {
+        // stopped (Ctrl+Z): the driver and its invocations become one STOPPED job
+        int id = add_job_group(&job_list, pid, &pid, 1, fgj->command, STOPPED);
+        if (id > 0) {
+            job_table_lock(&job_list);
+            job_at(&job_list, id)->par = fgj->par;
+            fgj->par = NULL;
+            job_table_unlock(&job_list);
+        }
+        clear_fg_job(&job_list);
+        return 1;
+    }
+
+    job_record_finished(&job_list, fgj, 0);
+    clear_fg_job(&job_list);
+    return exit_code_of(status);
+}
+
+
+//###############################################################################
+
+// job ids of a --after list "1,4,7" into a: jobs in the table, or ones that
+// already finished fine (history), which are left out; returns how many,
+// -1 on error (message printed)
+static int parse_after_list(char *list, int **ids)
+{
+    int n = 1;
+    for (const char *p = list; *p; ++p)
+        n += (*p == ',');
+
+    *ids = (int*)arena_alloc(&line_arena, (size_t)n * sizeof(int));
+    if (!*ids) {
+        fprintf(stderr, "smash error: submit: malloc failed\n");
+        return -1;
+    }
+
+    int count = 0;
+    char *p = list;
+    for (int k = 0; k < n; ++k) {
+        char *endptr;
+        long id = strtol(p, &endptr, 10);
+        if (endptr == p || (*endptr != ',' && *endptr != '\0') || id <= 0 || id > INT_MAX) {
+            fprintf(stderr, "smash error: submit: invalid arguments\n");
+            return -1;
+        }
+        p = endptr + 1;
+
+        if (find_job(&job_list, id)) {
+            (*ids)[count++] = (int)id;
+            continue;
+        }
+
+        // it may have finished (and been reaped) before we got here
+        const job_record *r = find_job_record(&job_list, (int)id);
+        if (!r) {
+            fprintf(stderr, "smash error: submit: job id %ld does not exist\n", id);
+            return -1;
+        }
+        if (r->exit_status == -1 || !WIFEXITED(r->exit_status) || WEXITSTATUS(r->exit_status) != 0) {
+            fprintf(stderr, "smash error: submit: job id %ld did not succeed\n", id);
+            return -1;
+        }
+    }
+    return count;
+}
+
+// words as one text, separated by spaces (line arena); NULL if out of memory
+static char* join_words(char **words, int n)
+{
+    size_t len = 0;
+    for (int k = 0; k < n; ++k)
+        len += strlen(words[k]) + 1;
+    char *text = (char*)arena_alloc(&line_arena, len);
+    if (!text)
+        return NULL;
+    char *w = text;
+    for (int k = 0; k < n; ++k) {
+        size_t wl = strlen(words[k]);
+        memcpy(w, words[k], wl);
+        w += wl;
+        *w++ = (k < n - 1) ? ' ' : '\0';
+    }
+    return text;
+}
+
+/*
+ * submit [-p prio] [--after id,...] cmd [args...]
+ * submit [-p prio] [--after id,...] "cmd | cmd ..."
+ * queue the pipeline as a job of its own (see job_queue.h)
+ */
+int submit_cmd(exec_ctx *ctx, char **args, int argc)
+{
+    int prio = 0;
+    int *after = NULL;
+    int nafter = 0;
+
+    // options
+    int i = 1;
+    for (; i <= argc && args[i][0] == '-'; i += 2) {
+        if (i == argc) {
+            fprintf(stderr, "smash error: submit: invalid arguments\n");
+            return 1;
+        }
+        if (strcmp(args[i], "-p") == 0) {
+            char *endptr;
+            long v = strtol(args[i + 1], &endptr, 10);
+            if (*args[i + 1] == '\0' || *endptr != '\0' || v < INT_MIN || v > INT_MAX) {
+                fprintf(stderr, "smash error: submit: invalid arguments\n");
+                return 1;
+            }
+            prio = (int)v;
+        } else if (strcmp(args[i], "--after") == 0) {
+            nafter = parse_after_list(args[i + 1], &after);
+            if (nafter == -1)
+                return 1;
+        } else {
+            fprintf(stderr, "smash error: submit: invalid arguments\n");
+            return 1;
+        }
+    }
+    if (i > argc) {
+        fprintf(stderr, "smash error: submit: invalid arguments\n");
+        return 1;
+    }
+
+    // one quoted word is a command line of its own, more words are the argv
+    cmd_line cl;
+    command c = { args + i, argc - i + 1, false };
+    pipeline single = { &c, 1, NULL, false };
+
+    if (i == argc) {
+        char *line = arena_strndup(&line_arena, args[i], strlen(args[i]));
+        if (!line) {
+            fprintf(stderr, "smash error: submit: malloc failed\n");
+            return 1;
+        }
+        if (parse_line(&line_arena, line, &cl) == -1)
+            return 1;
+        if (cl.nchain != 1 || cl.chain[0].background) {
+            fprintf(stderr, "smash error: submit: one pipeline per job (use --after to chain jobs)\n");
+            return 1;
+        }
+    } else {
+        single.text = join_words(args + i, argc - i + 1);
+        if (!single.text) {
+            fprintf(stderr, "smash error: submit: malloc failed\n");
+            return 1;
+        }
+        cl.chain  = &single;
+        cl.nchain = 1;
+    }
+
+    pipeline *p = &cl.chain[0];
+    if (p->nstages > PIPE_STAGES_MAX) {
+        fprintf(stderr, "smash error: pipe: too many stages\n");
+        return 1;
+    }
+    const builtin *b = smash_only_stage(p);
+    if (b) {
+        fprintf(stderr, "smash error: submit: %s cannot be queued\n", b->name);
+        return 1;
+    }
+
+    int id = job_queue_submit(&job_list, &cl, p->text, prio, after, nafter);
+    if (id == -1)
+        return 1;
+    printf("[%d] %s\n", id, p->text);
     return 0;
 }
 
+/* queue: what the job queue holds, queue -j N: run at most N queued jobs at once */
+int queue_cmd(exec_ctx *ctx, char **args, int argc)
+{
+    if (argc == 0) {
+        event_loop_poll();   // finished jobs free their slots first
+        job_queue_print();
+        return 0;
+    }
+
+    char *endptr;
+    long n = (argc == 2) ? strtol(args[2], &endptr, 10) : 0;
+    if (argc != 2 || strcmp(args[1], "-j") != 0 || *args[2] == '\0' || *endptr != '\0'
+        || n <= 0 || n > INT_MAX) {
+        fprintf(stderr, "smash error: queue: invalid arguments\n");
+        return 1;
+    }
+    job_queue_set_limit(&job_list, (int)n);
+    return 0;
+}
+
+
+//###################################################################
+
+/*=============================================================================
+* time: wall clock (CLOCK_MONOTONIC, ns) and rusage of a command line run
+* right here, with no /usr/bin/time fork + exec of its own
+=============================================================================*/
+
+// %e real s  %E real ns  %U / %S user / sys s  %u / %s user / sys us  %M max rss KB
+// %R / %F minor / major faults  %w / %c voluntary / involuntary ctxsw  %x exit  %C command
+#define TIME_FORMAT_DEFAULT "real %e s\nuser %U s\nsys %S s\nmaxrss %M KB\nctxsw %w voluntary, %c involuntary\n"
+#define TIME_FORMAT_MACHINE "real_ns=%E user_us=%u sys_us=%s maxrss_kb=%M minflt=%R majflt=%F nvcsw=%w nivcsw=%c exit=%x\n"
+
+typedef struct time_sample {
+    int64_t ns;
+    struct rusage self;       // smash: builtins and their stage threads run in it
+} time_sample;
+
+static void time_sample_take(time_sample *t)
+{
+    getrusage(RUSAGE_SELF, &t->self);
+    t->ns = monotonic_ns();
+}
+
+static long tv_us(struct timeval tv)
+{
+    return (long)tv.tv_sec * 1000000L + (long)tv.tv_usec;
+}
+
+// what the command used from a to b: smash's own share (builtins) plus
+// kids, the wait4 usage of the jobs it ran in the foreground
+static void time_delta(const time_sample *a, const time_sample *b, const job_usage *kids,
+                       job_usage *u)
+{
+    u->utime_us = tv_us(b->self.ru_utime) - tv_us(a->self.ru_utime) + kids->utime_us;
+    u->stime_us = tv_us(b->self.ru_stime) - tv_us(a->self.ru_stime) + kids->stime_us;
+    u->minflt = b->self.ru_minflt - a->self.ru_minflt + kids->minflt;
+    u->majflt = b->self.ru_majflt - a->self.ru_majflt + kids->majflt;
+    u->nvcsw  = b->self.ru_nvcsw - a->self.ru_nvcsw + kids->nvcsw;
+    u->nivcsw = b->self.ru_nivcsw - a->self.ru_nivcsw + kids->nivcsw;
+
+    // max rss is a high-water mark, not a counter: the jobs' when any was
+    // reaped (every process has some), else smash's own
+    u->maxrss_kb = kids->maxrss_kb > 0 ? kids->maxrss_kb : b->self.ru_maxrss;
+}
+
+static void time_print(FILE *out, const char *fmt, int64_t real_ns, const job_usage *u,
+                       int status, const char *text)
+{
+    for (const char *f = fmt; *f; ++f) {
+        if (*f == '\\' && (f[1] == 'n' || f[1] == 't')) {
+            fputc(*++f == 'n' ? '\n' : '\t', out);
+            continue;
+        }
+        if (*f != '%' || f[1] == '\0') {
+            fputc(*f, out);
+            continue;
+        }
+        switch (*++f) {
+        case 'e': fprintf(out, "%lld.%09lld", (long long)(real_ns / NS_PER_SEC),
+                          (long long)(real_ns % NS_PER_SEC));                      break;
+        case 'E': fprintf(out, "%lld", (long long)real_ns);                        break;
+        case 'U': fprintf(out, "%ld.%06ld", u->utime_us / 1000000, u->utime_us % 1000000); break;
+        case 'S': fprintf(out, "%ld.%06ld", u->stime_us / 1000000, u->stime_us % 1000000); break;
+        case 'u': fprintf(out, "%ld", u->utime_us);                                break;
+        case 's': fprintf(out, "%ld", u->stime_us);                                break;
+        case 'M': fprintf(out, "%ld", u->maxrss_kb);                               break;
+        case 'R': fprintf(out, "%ld", u->minflt);                                  break;
+        case 'F': fprintf(out, "%ld", u->majflt);                                  break;
+        case 'w': fprintf(out, "%ld", u->nvcsw);                                   break;
+        case 'c': fprintf(out, "%ld", u->nivcsw);                                  break;
+        case 'x': fprintf(out, "%d", status);                                      break;
+        case 'C': fputs(text, out);                                                break;
+        case '%': fputc('%', out);                                                 break;
+        default:  fputc('%', out); fputc(*f, out);                                 break;
+        }
+    }
+}
+
+/*
+ * time [-m | -f format] cmd [args...]
+ * time [-m | -f format] "cmd && cmd | cmd ..."
+ * run the command line in smash (aliases and builtins too) and print how
+ * long it took and what it used to stderr; -m is one key=value line,
+ * SMASH_TIMEFORMAT the default format. returns the command's status
+ */
+int time_cmd(exec_ctx *ctx, char **args, int argc)
+{
+    const char *fmt = getenv("SMASH_TIMEFORMAT");
+    if (fmt == NULL || *fmt == '\0')
+        fmt = TIME_FORMAT_DEFAULT;
+
+    // options
+    int i = 1;
+    for (; i <= argc && args[i][0] == '-'; ++i) {
+        if (strcmp(args[i], "-m") == 0) {
+            fmt = TIME_FORMAT_MACHINE;
+        } else if (strcmp(args[i], "-f") == 0 && i < argc) {
+            fmt = args[++i];
+        } else if (strcmp(args[i], "--") == 0) {
+            ++i;
+            break;
+        } else {
+            fprintf(stderr, "smash error: time: invalid arguments\n");
+            return 1;
+        }
+    }
+    if (i > argc) {
+        fprintf(stderr, "smash error: time: invalid arguments\n");
+        return 1;
+    }
 
+    // one quoted word is a command line of its own, more words are the command
+    cmd_line cl;
+    command c = { args + i, argc - i + 1, false };
+    char *text;
+    if (i == argc) {
+        text = arena_strndup(&line_arena, args[i], strlen(args[i]));
+        char *line = text ? arena_strndup(&line_arena, text, strlen(text)) : NULL;
+        if (!line) {
+            fprintf(stderr, "smash error: time: malloc failed\n");
+            return 1;
+        }
+        if (parse_line(&line_arena, line, &cl) == -1)
+            return 1;
+    } else {
+        text = join_words(args + i, argc - i + 1);
+        if (!text) {
+            fprintf(stderr, "smash error: time: malloc failed\n");
+            return 1;
+        }
+    }
+
+    // jobs of the command add their wait4 usage here as they finish; not
+    // RUSAGE_CHILDREN, which counts background jobs reaped meanwhile too
+    job_usage kids = { 0, 0, 0, 0, 0, 0, 0 };
+    job_usage *outer = job_list.fg_usage;   // time inside time
+    job_list.fg_usage = &kids;
+
+    time_sample before, after;
+    time_sample_take(&before);
+    int ret = (i == argc) ? run_chain(&cl) : command_Manager(&c, text, false);
+    time_sample_take(&after);
+
+    job_list.fg_usage = outer;
+    if (outer)
+        job_usage_add(outer, &kids);
+
+    job_usage u;
+    time_delta(&before, &after, &kids, &u);
+    fflush(stdout);   // the command's output comes first
+    time_print(stderr, fmt, after.ns - before.ns, &u, ret, text);
+    fflush(stderr);
+    return ret;
+}
 
 
+//###################################################################
+
+/* trace on | off | dump <file>: command-lifecycle tracing (see trace.h) */
+int trace_cmd(exec_ctx *ctx, char **args, int argc)
+{
+    if (argc == 1 && strcmp(args[1], "on") == 0) {
+        if (trace_start() == -1) {
+            fprintf(stderr, "smash error: trace: %s\n", strerror(errno));
+            return 1;
+        }
+        return 0;
+    }
+    if (argc == 1 && strcmp(args[1], "off") == 0) {
+        trace_stop();
+        return 0;
+    }
+    if (argc == 2 && strcmp(args[1], "dump") == 0) {
+        long n = trace_dump(args[2]);
+        if (n == -1) {
+            fprintf(stderr, "smash error: trace: %s: %s\n", args[2], strerror(errno));
+            return 1;
+        }
+        fprintf(ctx->out, "trace: %ld events written to %s\n", n, args[2]);
+        return 0;
+    }
+    fprintf(stderr, "smash error: trace: invalid arguments\n");
+    return 1;
+}
@@ -5,20 +5,16 @@
 =============================================================================*/
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdbool.h>
 #include "jobs.h"
+#include "parser.h"
+#include "builtins.h"   // exec_ctx
 
 
 
-#define CMD_LENGTH_MAX 80
-#define ARGS_NUM_MAX 20
-#define JOBS_NUM_MAX 100
-#define MAX_JOBS 100
-#define BUF_SIZE 4096
 #define PATH_MAX 4096
 
 
-extern char *g_argv[ARGS_NUM_MAX + 1];
-extern int   g_is_bg;   // 1 if command ended with &
 
 /*=============================================================================
 * error handling - some useful macros and examples of error handling,
@@ -66,45 +62,69 @@ typedef enum {
 
 =============================================================================*/
 
-int showpid(char **args, int argc);
+int showpid(exec_ctx *ctx, char **args, int argc);
 
-int pwd(char **args, int argc);
+int pwd(exec_ctx *ctx, char **args, int argc);
 
-int cd(char **args, int argc);
+int cd(exec_ctx *ctx, char **args, int argc);
 
 int quit(char **args, int argc, job_arr *jobs);
 
-int jobs(char **args, int argc, job_arr *arr);
+int jobs(exec_ctx *ctx, char **args, int argc, job_arr *arr);
+
+int jobstat(exec_ctx *ctx, char **args, int argc, job_arr *arr);
 
 int fg(char **args, int argc, job_arr *jobs);
 
 int bg(char **args, int argc, job_arr *jobs);
 
-int kill(char **args, int argc, job_arr *jobs);
+int kill_cmd(char **args, int argc, job_arr *jobs);   // "kill" (kill() is POSIX)
 
-int cmd_diff(char **args, int argc);
+int cmd_diff(exec_ctx *ctx, char **args, int argc);
 
-/* parsing & dispatch */
+/* parsing & dispatch (parser.h) */
 
-int parseCommand(char *cmd);
+// parse line (cut up in place) and run it: pipelines joined by &&; returns the status
+int run_line(char *line);
 
 // dispatcher: choose built-in vs external
-// numArgs is argc from parseCommand; original_line is the full, unmodified line.
+// text is the command as typed (job list), background = it ended with '&'
 
-int command_Manager(int numArgs, char *original_line);
+int command_Manager(command *c, const char *text, bool background);
 
 /* external commands */
 
-int run_external_command(char **argv, const char *original_line);
+// fds[i] != -1 becomes descriptor i of the program (redirect_open)
+int run_external_command(char **argv, const int fds[3], const char *text, bool background);
+
+/* pipelines with | (one job, one process group) */
+
+int run_pipeline(pipeline *p);
+
+// last line of a batch input: a simple external command is exec'd in place
+// of smash (no fork / wait), anything else runs as usual; returns the status
+int run_last_line(char *line);
+
+
+int alias_cmd(exec_ctx *ctx, char **args, int argc);
+
+int unalias_cmd(exec_ctx *ctx, char **args, int argc);
+
+int hash_cmd(exec_ctx *ctx, char **args, int argc);
+
+int parallel_cmd(exec_ctx *ctx, char **args, int argc);
 
-/* compound commands with && */
+int submit_cmd(exec_ctx *ctx, char **args, int argc);
 
-int handle_compound_commands(char *line);
+int queue_cmd(exec_ctx *ctx, char **args, int argc);
 
+int time_cmd(exec_ctx *ctx, char **args, int argc);
 
-int alias_cmd(char **args, int argc, const char *original_line);
+int trace_cmd(exec_ctx *ctx, char **args, int argc);
 
-int unalias_cmd(char **args, int argc);
+// start queued pipeline p in the background as job id (QUEUED until now),
+// -1 if it could not start (job_queue.c)
+int start_queued_job(pipeline *p, int id);
 
 
 
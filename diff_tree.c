@@ -0,0 +1,250 @@
+//diff_tree.c
+#define _GNU_SOURCE     // getdents64, struct dirent64, openat/fstatat
+#include "diff_tree.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "file_compare.h"
+#include "my_system_call.h"
+#include "thread_pool.h"
+
+#define DENTS_BUF_SIZE (32 * 1024)
+#define REL_PATH_MAX   4096
+
+/*=============================================================================
+* structs
+=============================================================================*/
+typedef struct tree_diff {
+    const char *root1;
+    const char *root2;
+    thread_pool *pool;
+    FILE *out;                  // where the result lines go
+    int flags;                  // FILE_COMPARE_* for every file pair
+    pthread_mutex_t out_lock;   // one result line at a time
+    int differs;                // protected by out_lock
+} tree_diff;
+
+// one file pair handed to the pool
+typedef struct compare_job {
+    tree_diff *td;
+    struct stat st1;
+    struct stat st2;
+    char rel[];                 // path relative to the roots
+} compare_job;
+
+/*=============================================================================
+* helpers
+=============================================================================*/
+
+static void report(tree_diff *td, const char *what, const char *rel)
+{
+    pthread_mutex_lock(&td->out_lock);
+    fprintf(td->out, "%s: %s\n", what, rel);
+    fflush(td->out);   // show results while the walk is still running
+    td->differs = 1;
+    pthread_mutex_unlock(&td->out_lock);
+}
+
+static char* join_path(const char *root, const char *rel)
+{
+    size_t root_len = strlen(root), rel_len = strlen(rel);
+    char *p = (char*)malloc(root_len + rel_len + 2);
+    if (!p)
+        return NULL;
+    memcpy(p, root, root_len);
+    p[root_len] = '/';
+    memcpy(p + root_len + 1, rel, rel_len + 1);
+    return p;
+}
+
+// pool task: compare one pair of regular files
+static void compare_task(void *arg)
+{
+    compare_job *job = (compare_job*)arg;
+    tree_diff *td = job->td;
+
+    char *path1 = join_path(td->root1, job->rel);
+    char *path2 = join_path(td->root2, job->rel);
+
+    // a pair that can't be opened can't be shown equal either
+    int r = (path1 && path2) ? file_compare(path1, &job->st1, path2, &job->st2, td->flags) : -1;
+    if (r != 0)
+        report(td, "changed", job->rel);
+
+    free(path1);
+    free(path2);
+    free(job);
+}
+
+static void submit_compare(tree_diff *td, const char *rel,
+                           const struct stat *st1, const struct stat *st2)
+{
+    size_t len = strlen(rel) + 1;
+    compare_job *job = (compare_job*)malloc(sizeof(compare_job) + len);
+    if (!job) {
+        report(td, "changed", rel);   // out of memory: be conservative
+        return;
+    }
+    job->td  = td;
+    job->st1 = *st1;
+    job->st2 = *st2;
+    memcpy(job->rel, rel, len);
+    thread_pool_submit(td->pool, compare_task, job);
+}
+
+// 1 if the two symlinks point to different targets
+static int links_differ(int dfd1, int dfd2, const char *name)
+{
+    char t1[REL_PATH_MAX], t2[REL_PATH_MAX];
+    ssize_t n1 = readlinkat(dfd1, name, t1, sizeof(t1));
+    ssize_t n2 = readlinkat(dfd2, name, t2, sizeof(t2));
+    return n1 < 0 || n1 != n2 || memcmp(t1, t2, (size_t)n1) != 0;
+}
+
+static int is_dot_entry(const char *name)
+{
+    return name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+/*=============================================================================
+* walk
+=============================================================================*/
+
+/*
+ * Walk one directory pair. rel holds the current relative path (rel_len
+ * bytes, no trailing '/'), entry names are appended to it in place.
+ */
+static void walk_dir(tree_diff *td, int dfd1, int dfd2, char *rel, size_t rel_len)
+{
+    char *buf = (char*)malloc(DENTS_BUF_SIZE);
+    if (!buf) {
+        report(td, "changed", rel_len ? rel : ".");
+        return;
+    }
+
+    /* ---------- pass 1: entries of the first tree ---------- */
+    long n;
+    while ((n = getdents64(dfd1, buf, DENTS_BUF_SIZE)) > 0) {
+        for (long off = 0; off < n; ) {
+            struct dirent64 *de = (struct dirent64*)(buf + off);
+            off += de->d_reclen;
+
+            if (is_dot_entry(de->d_name))
+                continue;
+
+            size_t name_len = strlen(de->d_name);
+            size_t sep = rel_len ? 1 : 0;
+            if (rel_len + sep + name_len >= REL_PATH_MAX)
+                continue;   // deeper than we can name
+            if (sep)
+                rel[rel_len] = '/';
+            memcpy(rel + rel_len + sep, de->d_name, name_len + 1);
+            size_t sub_len = rel_len + sep + name_len;
+
+            struct stat st1, st2;
+            if (fstatat(dfd1, de->d_name, &st1, AT_SYMLINK_NOFOLLOW) != 0)
+                continue;   // vanished meanwhile
+
+            if (fstatat(dfd2, de->d_name, &st2, AT_SYMLINK_NOFOLLOW) != 0) {
+                report(td, "removed", rel);
+            } else if ((st1.st_mode & S_IFMT) != (st2.st_mode & S_IFMT)) {
+                report(td, "changed", rel);   // e.g. file in one tree, dir in the other
+            } else if (S_ISREG(st1.st_mode)) {
+                submit_compare(td, rel, &st1, &st2);
+            } else if (S_ISDIR(st1.st_mode)) {
+                int sub1 = openat(dfd1, de->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                int sub2 = openat(dfd2, de->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                if (sub1 != -1 && sub2 != -1)
+                    walk_dir(td, sub1, sub2, rel, sub_len);
+                else
+                    report(td, "changed", rel);   // unreadable on one side
+                if (sub1 != -1)
+                    my_system_call(SYS_CLOSE, sub1);
+                if (sub2 != -1)
+                    my_system_call(SYS_CLOSE, sub2);
+            } else if (S_ISLNK(st1.st_mode)) {
+                if (links_differ(dfd1, dfd2, de->d_name))
+                    report(td, "changed", rel);
+            }
+            // other file types (fifos, devices) of the same kind count as equal
+        }
+    }
+    rel[rel_len] = '\0';
+
+    /* ---------- pass 2: entries only in the second tree ---------- */
+    while ((n = getdents64(dfd2, buf, DENTS_BUF_SIZE)) > 0) {
+        for (long off = 0; off < n; ) {
+            struct dirent64 *de = (struct dirent64*)(buf + off);
+            off += de->d_reclen;
+
+            if (is_dot_entry(de->d_name))
+                continue;
+
+            struct stat st1;
+            if (fstatat(dfd1, de->d_name, &st1, AT_SYMLINK_NOFOLLOW) == 0 || errno != ENOENT)
+                continue;
+
+            size_t name_len = strlen(de->d_name);
+            size_t sep = rel_len ? 1 : 0;
+            if (rel_len + sep + name_len >= REL_PATH_MAX)
+                continue;
+            if (sep)
+                rel[rel_len] = '/';
+            memcpy(rel + rel_len + sep, de->d_name, name_len + 1);
+            report(td, "added", rel);
+        }
+    }
+    rel[rel_len] = '\0';
+
+    free(buf);
+}
+
+/*=============================================================================
+* API
+=============================================================================*/
+
+int diff_tree(FILE *out, const char *root1, const char *root2, int flags)
+{
+    int dfd1 = (int)my_system_call(SYS_OPEN, root1, O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0);
+    if (dfd1 == -1)
+        return -1;
+
+    int dfd2 = (int)my_system_call(SYS_OPEN, root2, O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0);
+    if (dfd2 == -1) {
+        my_system_call(SYS_CLOSE, dfd1);
+        return -1;
+    }
+
+    tree_diff td;
+    td.root1   = root1;
+    td.root2   = root2;
+    td.out     = out;
+    td.flags   = flags;
+    td.differs = 0;
+    td.pool    = thread_pool_create(0);
+    if (!td.pool) {
+        my_system_call(SYS_CLOSE, dfd1);
+        my_system_call(SYS_CLOSE, dfd2);
+        errno = EAGAIN;
+        return -1;
+    }
+    pthread_mutex_init(&td.out_lock, NULL);
+
+    char rel[REL_PATH_MAX];
+    rel[0] = '\0';
+    walk_dir(&td, dfd1, dfd2, rel, 0);
+
+    // the walk is done, let the remaining compares drain
+    thread_pool_destroy(td.pool);
+    pthread_mutex_destroy(&td.out_lock);
+
+    my_system_call(SYS_CLOSE, dfd1);
+    my_system_call(SYS_CLOSE, dfd2);
+    return td.differs;
+}
@@ -0,0 +1,27 @@
+#ifndef DIFF_TREE_H
+#define DIFF_TREE_H
+
+#include <stdio.h>
+
+/*=============================================================================
+* recursive diff (diff -r)
+*
+*  - both trees are walked together with openat/getdents64, entries are
+*    paired by their path relative to the roots
+*  - file pairs are compared on a work-stealing thread pool with the same
+*    engine as the single-file diff (file_compare), while the walk goes on
+*  - results are printed as soon as they are known, one line per path:
+*      "added: <rel>"    only in the second tree
+*      "removed: <rel>"  only in the first tree
+*      "changed: <rel>"  contents (or file type / link target) differ
+=============================================================================*/
+
+/*
+ * Compare the directory trees root1 and root2, results go to out, flags
+ * are passed on to file_compare (FILE_COMPARE_NO_CACHE).
+ * returns 0 = identical, 1 = differences found (printed), -1 = a root could
+ * not be opened or no worker threads could be started (errno set)
+ */
+int diff_tree(FILE *out, const char *root1, const char *root2, int flags);
+
+#endif /* DIFF_TREE_H */
@@ -0,0 +1,426 @@
+//event_loop.c
+#define _GNU_SOURCE     // signalfd, epoll_create1
+#include "event_loop.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include "my_system_call.h"
+#include "signals.h"
+#include "trace.h"
+
+#define MAX_EVENTS     64
+#define INPUT_BLOCK    65536   // bytes asked for per read, the buffer grows for longer lines
+
+/*=============================================================================
+* structs
+=============================================================================*/
+typedef struct event_loop {
+    int ready;
+    pid_t owner;            // the shell itself (forked pipeline stages must not touch the set)
+    int epfd;
+    int sigfd;
+    int in_fd;              // where commands come from: stdin or a script, -1 = only a -c text
+    int in_polled;          // 0: in_fd can't be epoll'ed (e.g. a regular file), just read it
+    int sweep;              // a child could not be watched: poll the job table on SIGCHLD
+    job_arr *jobs;
+
+    job *fg;                // foreground job being waited for, NULL if none
+    int *fg_last_status;
+    int fg_stopped;
+    unsigned interrupts;    // CTRL+C seen so far
+
+    char *in;                  // input bytes not handed out yet: in[in_start..in_end)
+    size_t in_cap;
+    size_t in_start;
+    size_t in_end;
+    size_t in_scanned;         // in[in_start..in_scanned) has no '\n'
+    int in_ready;              // epoll reported in_fd readable (then it is disarmed until read)
+    int in_eof;
+} event_loop;
+
+static event_loop loop = { .epfd = -1, .sigfd = -1, .in_fd = -1 };
+
+// epoll data: (fd << 32) | pid, pid 0 for the input and the signalfd
+#define EVENT_DATA(fd, pid) (((uint64_t)(uint32_t)(fd) << 32) | (uint32_t)(pid))
+#define EVENT_FD(data)      ((int)(uint32_t)((data) >> 32))
+#define EVENT_PID(data)     ((pid_t)(uint32_t)(data))
+
+/*=============================================================================
+* children
+=============================================================================*/
+
+static int job_has_pid(const job *j, pid_t pid)
+{
+    for (int k = 0; k < j->npids; ++k) {
+        if (j->pids[k] == pid)
+            return 1;
+    }
+    return 0;
+}
+
+// check every live process of the foreground job (exited / stopped)
+static void fg_poll(void)
+{
+    job *j = loop.fg;
+    pid_t last = j->pids[j->npids - 1];
+
+    for (int k = 0; k < j->npids; ++k) {
+        pid_t pid = j->pids[k];
+        if (pid == 0)
+            continue;
+
+        int status = 0;
+        struct rusage ru;
+        pid_t w = (pid_t)my_system_call_ext(SYS_WAIT4, pid, &status, WNOHANG | WUNTRACED, &ru);
+        if (w == 0)
+            continue;   // still running
+
+        if (w == pid && WIFSTOPPED(status)) {
+            loop.fg_stopped = 1;   // the rest of the group got the same stop signal
+            return;
+        }
+
+        // exited / killed, or not our child any more
+        if (w != pid) {
+            job_member_exited(j, pid);
+            continue;
+        }
+        if (pid == last && loop.fg_last_status)
+            *loop.fg_last_status = status;
+        job_member_reaped(j, pid, status, &ru);
+    }
+}
+
+// the pidfd of pid became readable: the process exited
+static void child_exited(pid_t pid, int pidfd)
+{
+    // closing alone is not enough: the set keeps the item while any other
+    // reference to the pidfd's file lives, and it stays readable
+    (void)epoll_ctl(loop.epfd, EPOLL_CTL_DEL, pidfd, NULL);
+    my_system_call(SYS_CLOSE, pidfd);
+
+    if (loop.fg && job_has_pid(loop.fg, pid)) {
+        fg_poll();
+        return;
+    }
+
+    TRACE_MARK("reap", pid);
+    int status = -1;
+    struct rusage ru;
+    pid_t w = (pid_t)my_system_call_ext(SYS_WAIT4, pid, &status, WNOHANG, &ru);
+    // 0: the pid was reaped elsewhere and already reused by a running child
+    if (w == pid)
+        (void)job_process_reaped(loop.jobs, pid, status, &ru);
+    else if (w == -1 && errno == ECHILD)
+        (void)job_process_reaped(loop.jobs, pid, -1, NULL);
+}
+
+static void handle_signals(void)
+{
+    struct signalfd_siginfo si;
+    while (my_system_call(SYS_READ, loop.sigfd, &si, sizeof(si)) == (long)sizeof(si)) {
+        switch (si.ssi_signo) {
+        case SIGINT:
+            loop.interrupts++;
+            ctrl_c(SIGINT);
+            break;
+        case SIGTSTP:
+            ctrl_z(SIGTSTP);
+            break;
+        case SIGCHLD:
+            // exits come through the pidfds, stops only through SIGCHLD
+            if (loop.fg)
+                fg_poll();
+            if (loop.sweep)
+                reap_jobs(loop.jobs);
+            break;
+        }
+    }
+}
+
+/*=============================================================================
+* dispatch
+=============================================================================*/
+
+// wait up to timeout ms (-1 = forever) and handle what happened; -1 on error
+static int dispatch_events(int timeout)
+{
+    struct epoll_event events[MAX_EVENTS];
+
+    int n = epoll_wait(loop.epfd, events, MAX_EVENTS, timeout);
+    if (n == -1)
+        return errno == EINTR ? 0 : -1;
+
+    for (int i = 0; i < n; ++i) {
+        uint64_t data = events[i].data.u64;
+        int fd = EVENT_FD(data);
+
+        if (EVENT_PID(data) != 0)
+            child_exited(EVENT_PID(data), fd);
+        else if (fd == loop.sigfd)
+            handle_signals();
+        else
+            loop.in_ready = 1;
+    }
+    return n;
+}
+
+static int is_owner(void)
+{
+    return loop.ready && getpid() == loop.owner;
+}
+
+/*=============================================================================
+* input
+=============================================================================*/
+
+// make room for at least one more block (plus the '\0' of a last line), -1 if out of memory
+static int reserve_input(void)
+{
+    if (loop.in_start > 0) {
+        // the line handed out last is done with: move the rest to the front
+        memmove(loop.in, loop.in + loop.in_start, loop.in_end - loop.in_start);
+        loop.in_end     -= loop.in_start;
+        loop.in_scanned -= loop.in_start;
+        loop.in_start    = 0;
+    }
+
+    if (loop.in_cap - loop.in_end > INPUT_BLOCK)
+        return 0;
+
+    size_t cap = loop.in_cap ? loop.in_cap : INPUT_BLOCK;
+    while (cap - loop.in_end <= INPUT_BLOCK)
+        cap *= 2;
+
+    char *in = (char*)realloc(loop.in, cap);
+    if (!in)
+        return -1;
+    loop.in     = in;
+    loop.in_cap = cap;
+    return 0;
+}
+
+static void fill_input(void)
+{
+    if (loop.in_fd == -1 || reserve_input() == -1) {
+        if (loop.in_fd != -1)
+            perror("smash error: input");
+        loop.in_eof = 1;   // hand out what we have and stop
+        return;
+    }
+
+    long r;
+    do {
+        r = my_system_call(SYS_READ, loop.in_fd, loop.in + loop.in_end, loop.in_cap - loop.in_end - 1);
+    } while (r == -1 && errno == EINTR);
+
+    loop.in_ready = 0;
+    if (loop.in_polled) {
+        // one-shot: pending input must not wake every foreground wait
+        struct epoll_event ev;
+        ev.events   = EPOLLIN | EPOLLONESHOT;
+        ev.data.u64 = EVENT_DATA(loop.in_fd, 0);
+        (void)epoll_ctl(loop.epfd, EPOLL_CTL_MOD, loop.in_fd, &ev);
+    }
+    if (r <= 0)
+        loop.in_eof = 1;   // end of input, or the input is unusable
+    else
+        loop.in_end += (size_t)r;
+}
+
+/*
+ * Only blanks follow in[in_start + from..): the line ending there is the
+ * last one. Reads more input while that is possible without blocking
+ * (the unread bytes may move, offsets are from in_start).
+ */
+static int rest_is_blank(size_t from)
+{
+    while (1) {
+        for (size_t i = loop.in_start + from; i < loop.in_end; ++i) {
+            char c = loop.in[i];
+            if (c != ' ' && c != '\t' && c != '\n')
+                return 0;
+        }
+        from = loop.in_end - loop.in_start;
+
+        if (loop.in_eof)
+            return 1;
+        if (loop.in_polled) {
+            event_loop_poll();
+            if (!loop.in_ready)
+                return 0;   // nothing more yet: can't tell without waiting
+        }
+        fill_input();
+    }
+}
+
+/*=============================================================================
+* API
+=============================================================================*/
+
+int event_loop_init(job_arr* jobs, int in_fd)
+{
+    loop.jobs  = jobs;
+    loop.owner = getpid();
+    loop.in_fd = in_fd;
+    loop.in_eof = (in_fd == -1);
+
+    sigset_t set;
+    job_control_signals(&set);
+    loop.sigfd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+    loop.epfd  = epoll_create1(EPOLL_CLOEXEC);
+    if (loop.sigfd == -1 || loop.epfd == -1)
+        return -1;
+
+    struct epoll_event ev;
+    ev.events   = EPOLLIN;
+    ev.data.u64 = EVENT_DATA(loop.sigfd, 0);
+    if (epoll_ctl(loop.epfd, EPOLL_CTL_ADD, loop.sigfd, &ev) == -1)
+        return -1;
+
+    // regular files can't be watched (EPERM); they are always readable anyway
+    ev.events   = EPOLLIN | EPOLLONESHOT;
+    ev.data.u64 = EVENT_DATA(in_fd, 0);
+    loop.in_polled = in_fd != -1 && epoll_ctl(loop.epfd, EPOLL_CTL_ADD, in_fd, &ev) == 0;
+
+    loop.ready = 1;
+    return 0;
+}
+
+int event_loop_input_text(const char* text)
+{
+    size_t n = strlen(text);
+    char *in = (char*)realloc(loop.in, loop.in_end + n + 1);   // + the '\0' of a last line
+    if (!in)
+        return -1;
+
+    memcpy(in + loop.in_end, text, n);
+    loop.in      = in;
+    loop.in_end += n;
+    loop.in_cap  = loop.in_end + 1;
+    return 0;
+}
+
+char* event_loop_read_line(size_t* len, int* last)
+{
+    while (1) {
+        char *nl = NULL;
+        if (loop.in_end > loop.in_scanned)
+            nl = (char*)memchr(loop.in + loop.in_scanned, '\n', loop.in_end - loop.in_scanned);
+
+        // a full line, or what is left at the end; it stays in the buffer
+        if (nl || (loop.in_eof && loop.in_end > loop.in_start)) {
+            if (last && nl) {
+                size_t nl_off = (size_t)(nl - loop.in) - loop.in_start;
+                *last = rest_is_blank(nl_off + 1);
+                nl = loop.in + loop.in_start + nl_off;   // the buffer may have moved
+            } else if (last) {
+                *last = 1;
+            }
+
+            char *start = loop.in + loop.in_start;
+            char *end   = nl ? nl : loop.in + loop.in_end;   // in_end < in_cap: room for the '\0'
+            *end = '\0';
+
+            *len = (size_t)(end - start);
+            loop.in_start   = (size_t)(end - loop.in) + (nl ? 1 : 0);
+            loop.in_scanned = loop.in_start;
+            return start;
+        }
+        loop.in_scanned = loop.in_end;
+        if (loop.in_eof)
+            return NULL;
+
+        if (is_owner() && loop.in_polled && !loop.in_ready) {
+            if (dispatch_events(-1) == -1)
+                loop.in_ready = 1;   // epoll broke: fall back to blocking reads
+            continue;
+        }
+        event_loop_poll();
+        fill_input();
+    }
+}
+
+void event_loop_watch_pid(pid_t pid)
+{
+    if (!is_owner())
+        return;
+
+    int pidfd = (int)my_system_call_ext(SYS_PIDFD_OPEN, pid);
+    if (pidfd == -1) {
+        loop.sweep = 1;   // e.g. out of descriptors: SIGCHLD polls the table
+        return;
+    }
+
+    struct epoll_event ev;
+    ev.events   = EPOLLIN;
+    ev.data.u64 = EVENT_DATA(pidfd, pid);
+    if (epoll_ctl(loop.epfd, EPOLL_CTL_ADD, pidfd, &ev) == -1) {
+        my_system_call(SYS_CLOSE, pidfd);
+        loop.sweep = 1;
+    }
+}
+
+void event_loop_poll(void)
+{
+    if (!is_owner())
+        return;
+    TRACE_BEGIN("event_loop_poll");
+    while (dispatch_events(0) == MAX_EVENTS)
+        ;
+    TRACE_END("event_loop_poll");
+}
+
+unsigned event_loop_interrupts(void)
+{
+    return loop.interrupts;
+}
+
+int event_loop_run(int timeout_ms)
+{
+    if (is_owner())
+        return dispatch_events(timeout_ms) == -1 ? -1 : 0;
+
+    // not the shell: nothing to epoll, poll the table a few times a second
+    if (timeout_ms < 0 || timeout_ms > 10)
+        timeout_ms = 10;
+    struct timespec ts = { 0, (long)timeout_ms * 1000000L };
+    nanosleep(&ts, NULL);
+    if (loop.jobs)
+        reap_jobs(loop.jobs);
+    return 0;
+}
+
+int event_loop_wait_job(job* j, int* last_status)
+{
+    // pipeline stages (forked smash copies) have their signals unblocked
+    if (!is_owner())
+        return wait_job(j, last_status);
+
+    TRACE_BEGIN("wait");
+    loop.fg             = j;
+    loop.fg_last_status = last_status;
+    loop.fg_stopped     = 0;
+
+    int ret = 0;
+    fg_poll();   // it may be done already
+    while (j->nlive > 0 && !loop.fg_stopped) {
+        if (dispatch_events(-1) == -1) {
+            ret = -1;
+            break;
+        }
+    }
+
+    loop.fg = NULL;
+    TRACE_END("wait");
+    return ret == -1 ? -1 : loop.fg_stopped ? 1 : 0;
+}
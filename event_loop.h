@@ -0,0 +1,61 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "jobs.h"
+
+/*=============================================================================
+* event loop (epoll)
+*
+*  - one epoll set over the input (stdin), a signalfd (SIGINT, SIGTSTP, SIGCHLD, blocked
+*    by install_signal_handlers) and a pidfd per started child process
+*  - a child is reaped the moment its pidfd fires, also while smash sits at
+*    the prompt; CTRL+C / CTRL+Z run synchronously from the loop
+*  - foreground waits go through the loop too, so signals and background
+*    exits keep being handled while a command runs
+*  - without pidfds (old kernel, out of descriptors) SIGCHLD falls back to
+*    polling the job table
+=============================================================================*/
+
+/*
+ * Create the epoll set and the signalfd, jobs = the shell's job table,
+ * in_fd = where the command lines come from (stdin, a script; -1 = only
+ * what event_loop_input_text gives). -1 on failure
+ */
+int event_loop_init(job_arr* jobs, int in_fd);
+
+// queue text (e.g. smash -c) to be read before in_fd; -1 if out of memory
+int event_loop_input_text(const char* text);
+
+/*
+ * Read one line of input, of any length, handling events while waiting.
+ *  - the input is read in large blocks into a buffer that grows for long lines
+ *  - the line is returned in place, without its '\n' (*len = its length);
+ *    it may be modified and stays valid until the next call
+ *  - last (may be NULL): set to 1 if this is the last line (only blanks
+ *    follow); finding out never blocks, so 0 can also mean "not known yet"
+ * returns NULL at end of input
+ */
+char* event_loop_read_line(size_t* len, int* last);
+
+// watch a started child: it is reaped (and its job updated) as soon as it exits
+void event_loop_watch_pid(pid_t pid);
+
+// handle whatever is pending without blocking
+void event_loop_poll(void);
+
+// wait up to timeout_ms (-1 = forever) for events and handle them; -1 on error
+int event_loop_run(int timeout_ms);
+
+// how many CTRL+C the loop handled so far (a long-running builtin stops when it changes)
+unsigned event_loop_interrupts(void);
+
+/*
+ * Wait for the foreground job j, handling events meanwhile (same contract as
+ * wait_job: 0 = finished, 1 = stopped, -1 = error; *last_status = wait status
+ * of the last process of the job).
+ */
+int event_loop_wait_job(job* j, int* last_status);
+
+#endif /* EVENT_LOOP_H */
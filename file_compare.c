@@ -0,0 +1,553 @@
+//file_compare.c
+#define _GNU_SOURCE     // MADV_SEQUENTIAL, sysconf(_SC_NPROCESSORS_ONLN)
+#include "file_compare.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "fp_cache.h"
+#include "my_system_call.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// files up to this size are read in one chunk each instead of mapped
+#define READ_CHUNK        IO_BUF_SIZE
+
+// chunks of each file read ahead on the read path (two buffers per chunk)
+#define READ_DEPTH        (IO_BUFS / 2)
+
+// from this size on the compare is split between threads
+#define PARALLEL_MIN_SIZE (64L * 1024 * 1024)
+#define COMPARE_THREADS_MAX 8
+
+// how often a worker checks whether another one already found a difference
+#define STOP_CHECK_BYTES  (1024 * 1024)
+
+#define BLOCK_SIZE 64   // bytes compared per SIMD loop iteration
+
+// a fingerprint is the hash of per-chunk hashes, so chunks can be hashed in parallel
+#define FP_CHUNK (4L * 1024 * 1024)
+
+/*=============================================================================
+* block compare
+=============================================================================*/
+
+// 1 if the 64-byte blocks at a and b differ
+static inline int block_differs(const unsigned char *a, const unsigned char *b)
+{
+#if defined(__SSE2__)
+    __m128i eq0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)a),
+                                 _mm_loadu_si128((const __m128i*)b));
+    __m128i eq1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + 16)),
+                                 _mm_loadu_si128((const __m128i*)(b + 16)));
+    __m128i eq2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + 32)),
+                                 _mm_loadu_si128((const __m128i*)(b + 32)));
+    __m128i eq3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + 48)),
+                                 _mm_loadu_si128((const __m128i*)(b + 48)));
+    __m128i all = _mm_and_si128(_mm_and_si128(eq0, eq1), _mm_and_si128(eq2, eq3));
+    return _mm_movemask_epi8(all) != 0xFFFF;
+#else
+    // portable: OR of XORed words, the compiler vectorizes this
+    uint64_t acc = 0;
+    for (int i = 0; i < BLOCK_SIZE; i += 8) {
+        uint64_t x, y;
+        memcpy(&x, a + i, 8);
+        memcpy(&y, b + i, 8);
+        acc |= x ^ y;
+    }
+    return acc != 0;
+#endif
+}
+
+/*
+ * Compare len bytes. stop (may be NULL) is shared between the workers of one
+ * compare: set by whoever finds a difference, polled every STOP_CHECK_BYTES.
+ */
+static int range_differs(const unsigned char *a, const unsigned char *b, size_t len, int *stop)
+{
+    size_t i = 0;
+    while (i + BLOCK_SIZE <= len) {
+        size_t end = i + STOP_CHECK_BYTES;
+        if (end > len)
+            end = len;
+
+        for (; i + BLOCK_SIZE <= end; i += BLOCK_SIZE) {
+            if (block_differs(a + i, b + i)) {
+                if (stop)
+                    __atomic_store_n(stop, 1, __ATOMIC_RELAXED);
+                return 1;
+            }
+        }
+
+        if (stop && __atomic_load_n(stop, __ATOMIC_RELAXED))
+            return 1;   // somebody else already answered
+    }
+
+    // tail shorter than one block
+    if (i < len && memcmp(a + i, b + i, len - i) != 0) {
+        if (stop)
+            __atomic_store_n(stop, 1, __ATOMIC_RELAXED);
+        return 1;
+    }
+    return 0;
+}
+
+/*=============================================================================
+* plain reads (fingerprints of files that can't be mapped)
+=============================================================================*/
+
+// read up to len bytes, retrying short reads; returns bytes read or -1
+static long read_full(int fd, unsigned char *buf, size_t len)
+{
+    size_t got = 0;
+    while (got < len) {
+        long r = my_system_call(SYS_READ, fd, buf + got, len - got);
+        if (r < 0)
+            return -1;
+        if (r == 0)
+            break;   // EOF
+        got += (size_t)r;
+    }
+    return (long)got;
+}
+
+/*=============================================================================
+* batched I/O (SYS_IO_SUBMIT / SYS_IO_REAP: io_uring when the kernel has it)
+=============================================================================*/
+
+// queue all n, counting them in *outstanding; -1 if the ring takes no more
+static int submit_all(io_req *reqs, int n, int *outstanding)
+{
+    for (int queued = 0; queued < n; ) {
+        long k = my_system_call_ext(SYS_IO_SUBMIT, reqs + queued, n - queued);
+        if (k <= 0)
+            return -1;
+        queued += (int)k;
+        *outstanding += (int)k;
+    }
+    return 0;
+}
+
+static int reap_until_done(io_req *req, int *outstanding)
+{
+    while (!req->done) {
+        long n = my_system_call_ext(SYS_IO_REAP, 1);
+        if (n <= 0)
+            return -1;
+        *outstanding -= (int)n;
+    }
+    return 0;
+}
+
+/*
+ * Wait for a read of req->len bytes to fill its buffer: a short read (a pipe,
+ * a network filesystem, a signal) has the rest resubmitted. -1 on a read
+ * error, or EOF before req->len (the file got shorter under us).
+ */
+static int reap_read_full(io_req *req, int *outstanding)
+{
+    void *buf = req->buf;
+    unsigned len = req->len;
+    long long offset = req->offset;
+    int result = 0;
+
+    for (;;) {
+        if (reap_until_done(req, outstanding) == -1 || req->res <= 0) {
+            result = -1;
+            break;
+        }
+        if ((unsigned long)req->res >= req->len)
+            break;
+        req->buf     = (char*)req->buf + req->res;
+        req->len    -= (unsigned)req->res;
+        req->offset += req->res;
+        if (submit_all(req, 1, outstanding) == -1) {
+            result = -1;
+            break;
+        }
+    }
+
+    req->buf    = buf;
+    req->len    = len;
+    req->offset = offset;
+    return result;
+}
+
+// the reads into the thread's buffers have to be over before they are reused
+static void reap_all(int *outstanding)
+{
+    while (*outstanding > 0) {
+        long n = my_system_call_ext(SYS_IO_REAP, *outstanding);
+        if (n <= 0)
+            break;
+        *outstanding -= (int)n;
+    }
+}
+
+// both files opened with one batch; -1 (errno set) if either fails
+static int open_pair(const char *path1, const char *path2, int *fd1, int *fd2)
+{
+    io_req r[2];
+    memset(r, 0, sizeof(r));
+    for (int i = 0; i < 2; ++i) {
+        r[i].op    = IO_OP_OPEN;
+        r[i].path  = i == 0 ? path1 : path2;
+        r[i].flags = O_RDONLY | O_CLOEXEC;
+    }
+
+    int outstanding = 0;
+    if (submit_all(r, 2, &outstanding) == -1
+        || reap_until_done(&r[0], &outstanding) == -1
+        || reap_until_done(&r[1], &outstanding) == -1) {
+        reap_all(&outstanding);
+        for (int i = 0; i < 2; ++i) {
+            if (r[i].done && r[i].res >= 0)
+                my_system_call(SYS_CLOSE, (int)r[i].res);
+        }
+        return -1;
+    }
+
+    if (r[0].res < 0 || r[1].res < 0) {
+        for (int i = 0; i < 2; ++i) {
+            if (r[i].res >= 0)
+                my_system_call(SYS_CLOSE, (int)r[i].res);
+        }
+        errno = (int)-(r[0].res < 0 ? r[0].res : r[1].res);
+        return -1;
+    }
+    *fd1 = (int)r[0].res;
+    *fd2 = (int)r[1].res;
+    return 0;
+}
+
+static void close_pair(int fd1, int fd2)
+{
+    io_req r[2];
+    memset(r, 0, sizeof(r));
+    r[0].op = r[1].op = IO_OP_CLOSE;
+    r[0].fd = fd1;
+    r[1].fd = fd2;
+
+    int outstanding = 0;
+    if (submit_all(r, 2, &outstanding) == -1) {
+        for (int i = outstanding; i < 2; ++i)   // queued in order: these never were
+            my_system_call(SYS_CLOSE, r[i].fd);
+    }
+    reap_all(&outstanding);
+}
+
+static void prepare_reads(io_req r[2], int fd1, int fd2, void **bufs, int slot, size_t chunk, size_t size)
+{
+    size_t off = chunk * READ_CHUNK;
+    size_t len = size - off < (size_t)READ_CHUNK ? size - off : (size_t)READ_CHUNK;
+    for (int i = 0; i < 2; ++i) {
+        memset(&r[i], 0, sizeof(r[i]));
+        r[i].op        = IO_OP_READ;
+        r[i].fd        = i == 0 ? fd1 : fd2;
+        r[i].buf_index = slot * 2 + i;
+        r[i].buf       = bufs[r[i].buf_index];
+        r[i].len       = (unsigned)len;
+        r[i].offset    = (long long)off;
+    }
+}
+
+/*
+ * Compare size bytes of the two files by reading them: READ_DEPTH chunks of
+ * each are in flight at once, in the thread's fixed buffers, and a chunk
+ * compared is replaced by the next one.
+ */
+static int compare_by_read(int fd1, int fd2, size_t size)
+{
+    void **bufs;
+    if (my_system_call_ext(SYS_IO_BUFFERS, &bufs) == -1)
+        return 1;   // no buffers: counts as a read error
+
+    size_t nchunks = (size + READ_CHUNK - 1) / READ_CHUNK;
+    io_req reqs[READ_DEPTH][2];
+    int outstanding = 0, result = 0;
+
+    // the first READ_DEPTH chunks of both files in one batch
+    size_t next = 0;
+    for (; next < nchunks && next < READ_DEPTH; ++next)
+        prepare_reads(reqs[next], fd1, fd2, bufs, (int)next, next, size);
+    if (submit_all(&reqs[0][0], 2 * (int)next, &outstanding) == -1)
+        result = 1;
+
+    for (size_t c = 0; c < nchunks && result == 0; ++c) {
+        int slot = (int)(c % READ_DEPTH);
+        io_req *r = reqs[slot];
+        if (reap_read_full(&r[0], &outstanding) == -1 || reap_read_full(&r[1], &outstanding) == -1)
+            result = 1;   // read error, or a file got shorter under us
+        else if (range_differs((const unsigned char*)r[0].buf, (const unsigned char*)r[1].buf, r[0].len, NULL))
+            result = 1;
+        else if (next < nchunks) {
+            prepare_reads(r, fd1, fd2, bufs, slot, next++, size);
+            if (submit_all(r, 2, &outstanding) == -1)
+                result = 1;
+        }
+    }
+
+    reap_all(&outstanding);   // an early answer leaves reads in flight
+    return result;
+}
+
+/*=============================================================================
+* mmap path (large files)
+=============================================================================*/
+
+typedef struct compare_range {
+    const unsigned char *a;
+    const unsigned char *b;
+    size_t len;
+    int *stop;
+    int result;
+} compare_range;
+
+static void* compare_worker(void *arg)
+{
+    compare_range *r = (compare_range*)arg;
+    r->result = range_differs(r->a, r->b, r->len, r->stop);
+    return NULL;
+}
+
+// threads worth using for size bytes of work
+static long worker_count(size_t size)
+{
+    if ((long)size < PARALLEL_MIN_SIZE)
+        return 1;
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n > COMPARE_THREADS_MAX)
+        n = COMPARE_THREADS_MAX;
+    return n < 1 ? 1 : n;
+}
+
+// run fn on n argument structs (stride bytes apart); part 0 runs on the caller
+static void run_parallel(void* (*fn)(void*), char *args, size_t stride, long n)
+{
+    pthread_t threads[COMPARE_THREADS_MAX];
+
+    long started = 1;
+    for (; started < n; ++started) {
+        if (pthread_create(&threads[started], NULL, fn, args + stride * started) != 0)
+            break;
+    }
+    // parts without a thread (pthread_create failed) are done here
+    for (long t = started; t < n; ++t)
+        fn(args + stride * t);
+    fn(args);
+
+    for (long t = 1; t < started; ++t)
+        pthread_join(threads[t], NULL);
+}
+
+static int compare_mapped(const unsigned char *a, const unsigned char *b, size_t size)
+{
+    long nthreads = worker_count(size);
+    if (nthreads <= 1)
+        return range_differs(a, b, size, NULL);
+
+    // split at block boundaries, the last range takes the remainder
+    size_t part = (size / (size_t)nthreads) & ~(size_t)(BLOCK_SIZE - 1);
+    compare_range ranges[COMPARE_THREADS_MAX];
+    int stop = 0;
+
+    for (long t = 0; t < nthreads; ++t) {
+        size_t off = part * (size_t)t;
+        ranges[t].a      = a + off;
+        ranges[t].b      = b + off;
+        ranges[t].len    = (t == nthreads - 1) ? size - off : part;
+        ranges[t].stop   = &stop;
+        ranges[t].result = 0;
+    }
+    run_parallel(compare_worker, (char*)ranges, sizeof(compare_range), nthreads);
+
+    int differs = 0;
+    for (long t = 0; t < nthreads; ++t)
+        differs |= ranges[t].result;
+    return differs;
+}
+
+/*=============================================================================
+* fingerprints (fp_cache.c)
+=============================================================================*/
+
+typedef struct chunk_range {
+    const unsigned char *data;
+    size_t size;
+    size_t first;              // chunk indexes [first, end)
+    size_t end;
+    uint64_t (*digests)[2];
+} chunk_range;
+
+static void* hash_chunks(void *arg)
+{
+    chunk_range *r = (chunk_range*)arg;
+    for (size_t c = r->first; c < r->end; ++c) {
+        size_t off = c * (size_t)FP_CHUNK;
+        size_t len = r->size - off < (size_t)FP_CHUNK ? r->size - off : (size_t)FP_CHUNK;
+        fp_hash128(r->data + off, len, (uint64_t)c, r->digests[c]);
+    }
+    return NULL;
+}
+
+static int fingerprint_mapped(const unsigned char *data, size_t size, uint64_t out[2])
+{
+    size_t nchunks = (size + FP_CHUNK - 1) / FP_CHUNK;
+    uint64_t (*digests)[2] = malloc(nchunks * sizeof(*digests));
+    if (!digests)
+        return -1;
+
+    long nthreads = worker_count(size);
+    if ((size_t)nthreads > nchunks)
+        nthreads = (long)nchunks;
+
+    chunk_range ranges[COMPARE_THREADS_MAX];
+    for (long t = 0; t < nthreads; ++t) {
+        ranges[t].data    = data;
+        ranges[t].size    = size;
+        ranges[t].first   = nchunks * (size_t)t / (size_t)nthreads;
+        ranges[t].end     = nchunks * (size_t)(t + 1) / (size_t)nthreads;
+        ranges[t].digests = digests;
+    }
+    run_parallel(hash_chunks, (char*)ranges, sizeof(chunk_range), nthreads);
+
+    fp_hash128(digests, nchunks * sizeof(*digests), (uint64_t)size, out);
+    free(digests);
+    return 0;
+}
+
+// same fingerprint as fingerprint_mapped, for files that can't be mapped
+static int fingerprint_by_read(int fd, size_t size, uint64_t out[2])
+{
+    size_t nchunks = (size + FP_CHUNK - 1) / FP_CHUNK;
+    uint64_t (*digests)[2] = malloc(nchunks * sizeof(*digests));
+    unsigned char *buf = (unsigned char*)malloc(FP_CHUNK);
+    int result = -1;
+
+    if (digests && buf) {
+        size_t c = 0;
+        for (; c < nchunks; ++c) {
+            size_t len = size - c * FP_CHUNK < (size_t)FP_CHUNK ? size - c * FP_CHUNK : (size_t)FP_CHUNK;
+            if (read_full(fd, buf, len) != (long)len)
+                break;   // read error or the file shrank
+            fp_hash128(buf, len, (uint64_t)c, digests[c]);
+        }
+        if (c == nchunks) {
+            fp_hash128(digests, nchunks * sizeof(*digests), (uint64_t)size, out);
+            result = 0;
+        }
+    }
+    free(buf);
+    free(digests);
+    return result;
+}
+
+static int same_version(const struct stat *a, const struct stat *b)
+{
+    return a->st_dev == b->st_dev && a->st_ino == b->st_ino && a->st_size == b->st_size
+        && a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+// hash the open file fd of the given size, from its start
+static int fingerprint_file(int fd, size_t size, uint64_t out[2])
+{
+    int result;
+    void *m = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (m == MAP_FAILED) {
+        lseek(fd, 0, SEEK_SET);
+        result = fingerprint_by_read(fd, size, out);
+    } else {
+        madvise(m, size, MADV_SEQUENTIAL);
+        result = fingerprint_mapped((const unsigned char*)m, size, out);
+        munmap(m, size);
+    }
+    return result;
+}
+
+/*
+ * Remember fp as the fingerprint of the open file fd (st = what the caller
+ * stat'ed before it was read), unless the file changed since.
+ */
+static void remember_fingerprint(int fd, const struct stat *st, const uint64_t fp[2])
+{
+    struct stat now;
+    if (fstat(fd, &now) == 0 && same_version(st, &now))
+        fp_cache_store(&now, fp);
+}
+
+/*=============================================================================
+* API
+=============================================================================*/
+
+int file_compare(const char *path1, const struct stat *st1,
+                 const char *path2, const struct stat *st2, int flags)
+{
+    // same file, or different lengths: no need to look at the data
+    if (st1->st_dev == st2->st_dev && st1->st_ino == st2->st_ino)
+        return 0;
+    if (st1->st_size != st2->st_size)
+        return 1;
+    if (st1->st_size == 0)
+        return 0;
+
+    size_t size = (size_t)st1->st_size;
+
+    // both versions seen before: the fingerprints answer without any I/O
+    int use_cache = !(flags & FILE_COMPARE_NO_CACHE) && size > READ_CHUNK;
+    uint64_t fp1[2], fp2[2];
+    int known1 = 0, known2 = 0;
+    if (use_cache) {
+        known1 = fp_cache_lookup(st1, fp1);
+        known2 = fp_cache_lookup(st2, fp2);
+        if (known1 && known2)
+            return fp1[0] != fp2[0] || fp1[1] != fp2[1];
+    }
+
+    int fd1, fd2;
+    if (open_pair(path1, path2, &fd1, &fd2) == -1)
+        return -1;
+
+    int result;
+
+    if (size <= READ_CHUNK || (flags & FILE_COMPARE_NO_MMAP)) {
+        result = compare_by_read(fd1, fd2, size);
+    } else {
+        void *m1 = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd1, 0);
+        void *m2 = (m1 == MAP_FAILED) ? MAP_FAILED
+                                      : mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd2, 0);
+
+        if (m1 == MAP_FAILED || m2 == MAP_FAILED) {
+            // can't map (e.g. address space limits): fall back to reading
+            if (m1 != MAP_FAILED)
+                munmap(m1, size);
+            result = compare_by_read(fd1, fd2, size);
+        } else {
+            madvise(m1, size, MADV_SEQUENTIAL);
+            madvise(m2, size, MADV_SEQUENTIAL);
+            result = compare_mapped((const unsigned char*)m1, (const unsigned char*)m2, size);
+            munmap(m1, size);
+            munmap(m2, size);
+        }
+    }
+
+    // only equal files get fingerprinted (a difference is usually found early):
+    // they share one, so at most one of them is hashed
+    if (use_cache && result == 0) {
+        if (known1 || known2 || fingerprint_file(fd1, size, fp1) == 0) {
+            const uint64_t *fp = known2 ? fp2 : fp1;
+            if (!known1)
+                remember_fingerprint(fd1, st1, fp);
+            if (!known2)
+                remember_fingerprint(fd2, st2, fp);
+        }
+    }
+
+    close_pair(fd1, fd2);
+    return result;
+}
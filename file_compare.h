@@ -0,0 +1,38 @@
+#ifndef FILE_COMPARE_H
+#define FILE_COMPARE_H
+
+#include <sys/stat.h>
+
+/*=============================================================================
+* file comparison engine (diff builtin)
+*
+*  - same inode -> equal, different sizes -> different, without reading data
+*  - small files: read through the batched I/O calls of my_system_call_ext
+*    (io_uring when the kernel has it): both files opened in one batch, a few
+*    chunks of each read ahead into fixed buffers, both closed in one batch
+*  - large files: mmap + MADV_SEQUENTIAL, compared 64 bytes at a time with SIMD
+*  - very large files: the range is split between several threads
+*  - files above one read chunk go through the fingerprint cache (fp_cache.c):
+*    if both fingerprints are known the answer needs no data at all,
+*    otherwise the bytes are compared and, only when they are equal, one
+*    file is hashed (chunk-parallel) and remembered for both
+*  - equal cached fingerprints are taken as equal contents: MurmurHash3 is
+*    not collision-resistant, files crafted to collide compare as identical;
+*    FILE_COMPARE_NO_CACHE (diff --no-cache) for files nobody vouches for
+=============================================================================*/
+
+// file_compare flags
+#define FILE_COMPARE_NO_CACHE 0x1   // byte compare, don't use the fingerprint cache
+#define FILE_COMPARE_NO_MMAP  0x2   // large files too go through the read path
+
+/*
+ * Compare the contents of two regular files, st1/st2 are their stat results.
+ * flags: FILE_COMPARE_* bits.
+ * returns 0 = identical, 1 = different (a read error also counts as different),
+ *         -1 = a file could not be opened (errno set)
+ * Safe to call from several threads at once.
+ */
+int file_compare(const char *path1, const struct stat *st1,
+                 const char *path2, const struct stat *st2, int flags);
+
+#endif /* FILE_COMPARE_H */
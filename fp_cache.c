@@ -0,0 +1,412 @@
+//fp_cache.c
+#define _GNU_SOURCE     // O_CLOEXEC, ftruncate
+#include "fp_cache.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "my_system_call.h"
+
+#define FP_CACHE_FILE    ".smash_fpcache"
+#define FP_MAGIC         "SMASHFP1"
+#define FP_INDEX_INIT    1024    // must be a power of 2
+
+// rewrite the log at load when it holds this many more records than live keys
+#define FP_COMPACT_SLACK 4096
+
+/*=============================================================================
+* structs
+=============================================================================*/
+
+// log header, followed by fp_record entries
+typedef struct fp_header {
+    char magic[8];
+    uint32_t record_size;
+    uint32_t reserved;
+} fp_header;
+
+typedef struct fp_record {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t  mtime_ns;
+    uint64_t hash[2];
+    uint64_t check;      // hash of the fields above: drops torn/garbage appends
+    uint64_t reserved;
+} fp_record;
+
+typedef struct fp_cache {
+    int loaded;
+    int fd;                  // the log, -1 = memory only
+    char path[4096];
+
+    fp_record *slots;        // open addressing, size 0 = empty slot
+    size_t cap;
+    size_t count;
+
+    long file_records;       // records in the log (incl. overwritten ones)
+    long hits;
+    long misses;
+    long stores;
+} fp_cache;
+
+static fp_cache cache = { 0, -1, "", NULL, 0, 0, 0, 0, 0, 0 };
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*=============================================================================
+* hash (MurmurHash3 x64 128, public domain, Austin Appleby)
+=============================================================================*/
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t fmix64(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+void fp_hash128(const void *data, size_t len, uint64_t seed, uint64_t out[2])
+{
+    const unsigned char *p = (const unsigned char*)data;
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+    uint64_t h1 = seed, h2 = seed;
+    size_t nblocks = len / 16;
+
+    for (size_t i = 0; i < nblocks; ++i) {
+        uint64_t k1, k2;
+        memcpy(&k1, p + i * 16, 8);
+        memcpy(&k2, p + i * 16 + 8, 8);
+
+        k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+        k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    const unsigned char *tail = p + nblocks * 16;
+    uint64_t k1 = 0, k2 = 0;
+    switch (len & 15) {
+    case 15: k2 ^= (uint64_t)tail[14] << 48; /* fall through */
+    case 14: k2 ^= (uint64_t)tail[13] << 40; /* fall through */
+    case 13: k2 ^= (uint64_t)tail[12] << 32; /* fall through */
+    case 12: k2 ^= (uint64_t)tail[11] << 24; /* fall through */
+    case 11: k2 ^= (uint64_t)tail[10] << 16; /* fall through */
+    case 10: k2 ^= (uint64_t)tail[9] << 8;   /* fall through */
+    case 9:  k2 ^= (uint64_t)tail[8];
+             k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+             /* fall through */
+    case 8:  k1 ^= (uint64_t)tail[7] << 56;  /* fall through */
+    case 7:  k1 ^= (uint64_t)tail[6] << 48;  /* fall through */
+    case 6:  k1 ^= (uint64_t)tail[5] << 40;  /* fall through */
+    case 5:  k1 ^= (uint64_t)tail[4] << 32;  /* fall through */
+    case 4:  k1 ^= (uint64_t)tail[3] << 24;  /* fall through */
+    case 3:  k1 ^= (uint64_t)tail[2] << 16;  /* fall through */
+    case 2:  k1 ^= (uint64_t)tail[1] << 8;   /* fall through */
+    case 1:  k1 ^= (uint64_t)tail[0];
+             k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+    }
+
+    h1 ^= (uint64_t)len;
+    h2 ^= (uint64_t)len;
+    h1 += h2;
+    h2 += h1;
+    h1 = fmix64(h1);
+    h2 = fmix64(h2);
+    h1 += h2;
+    h2 += h1;
+
+    out[0] = h1;
+    out[1] = h2;
+}
+
+/*=============================================================================
+* index
+=============================================================================*/
+
+static uint64_t record_check(const fp_record *r)
+{
+    uint64_t h[2];
+    fp_hash128(r, offsetof(fp_record, check), 0, h);
+    return h[0] ^ h[1];
+}
+
+static void record_from_stat(fp_record *r, const struct stat *st)
+{
+    memset(r, 0, sizeof(*r));
+    r->dev      = (uint64_t)st->st_dev;
+    r->ino      = (uint64_t)st->st_ino;
+    r->size     = (uint64_t)st->st_size;
+    r->mtime_ns = (int64_t)st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+}
+
+static int same_key(const fp_record *a, const fp_record *b)
+{
+    return a->dev == b->dev && a->ino == b->ino
+        && a->size == b->size && a->mtime_ns == b->mtime_ns;
+}
+
+static size_t key_slot(const fp_record *r, size_t cap)
+{
+    uint64_t h = fmix64(r->dev * 0x9e3779b97f4a7c15ULL ^ r->ino);
+    h = fmix64(h ^ r->size ^ (uint64_t)r->mtime_ns * 0xc2b2ae3d27d4eb4fULL);
+    return (size_t)h & (cap - 1);
+}
+
+// slot holding r's key, or the empty slot where it belongs
+static fp_record* index_find(const fp_record *r)
+{
+    size_t i = key_slot(r, cache.cap);
+    while (cache.slots[i].size != 0 && !same_key(&cache.slots[i], r))
+        i = (i + 1) & (cache.cap - 1);
+    return &cache.slots[i];
+}
+
+static int index_grow(void)
+{
+    size_t ncap = cache.cap ? cache.cap * 2 : FP_INDEX_INIT;
+    fp_record *nslots = (fp_record*)calloc(ncap, sizeof(fp_record));
+    if (!nslots)
+        return -1;
+
+    for (size_t i = 0; i < cache.cap; ++i) {
+        if (cache.slots[i].size == 0)
+            continue;
+        size_t j = key_slot(&cache.slots[i], ncap);
+        while (nslots[j].size != 0)
+            j = (j + 1) & (ncap - 1);
+        nslots[j] = cache.slots[i];
+    }
+    free(cache.slots);
+    cache.slots = nslots;
+    cache.cap   = ncap;
+    return 0;
+}
+
+// insert or overwrite; returns -1 if the index could not grow
+static int index_put(const fp_record *r)
+{
+    if ((cache.count + 1) * 2 > cache.cap && index_grow() == -1)
+        return -1;
+    fp_record *slot = index_find(r);
+    if (slot->size == 0)
+        cache.count++;
+    *slot = *r;
+    return 0;
+}
+
+/*=============================================================================
+* log file
+=============================================================================*/
+
+static int write_full(int fd, const void *buf, size_t len)
+{
+    const char *p = (const char*)buf;
+    while (len > 0) {
+        long w = my_system_call(SYS_WRITE, fd, p, len);
+        if (w < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += w;
+        len -= (size_t)w;
+    }
+    return 0;
+}
+
+static int write_header(int fd)
+{
+    fp_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, FP_MAGIC, sizeof(h.magic));
+    h.record_size = (uint32_t)sizeof(fp_record);
+    return write_full(fd, &h, sizeof(h));
+}
+
+// replace the log by one record per live key (tmp file + rename)
+static void compact_log(void)
+{
+    char tmp[sizeof(cache.path) + 8];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", cache.path);
+
+    int fd = (int)my_system_call(SYS_OPEN, tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1)
+        return;
+
+    int ok = write_header(fd) == 0;
+    for (size_t i = 0; ok && i < cache.cap; ++i) {
+        if (cache.slots[i].size != 0)
+            ok = write_full(fd, &cache.slots[i], sizeof(fp_record)) == 0;
+    }
+    my_system_call(SYS_CLOSE, fd);
+
+    if (!ok || rename(tmp, cache.path) != 0) {
+        unlink(tmp);
+        return;
+    }
+
+    // keep appending to the new file
+    fd = (int)my_system_call(SYS_OPEN, cache.path, O_WRONLY | O_APPEND | O_CLOEXEC, 0);
+    if (fd == -1)
+        return;
+    my_system_call(SYS_CLOSE, cache.fd);
+    cache.fd = fd;
+    cache.file_records = (long)cache.count;
+}
+
+// map the log once and index every valid record; later records win
+static void load_log(void)
+{
+    struct stat st;
+    if (fstat(cache.fd, &st) != 0)
+        return;
+
+    size_t size = (size_t)st.st_size;
+    int valid = 0;
+
+    if (size >= sizeof(fp_header)) {
+        void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, cache.fd, 0);
+        if (map != MAP_FAILED) {
+            const fp_header *h = (const fp_header*)map;
+            valid = memcmp(h->magic, FP_MAGIC, sizeof(h->magic)) == 0
+                 && h->record_size == sizeof(fp_record);
+
+            if (valid) {
+                madvise(map, size, MADV_SEQUENTIAL);
+                const fp_record *recs = (const fp_record*)((const char*)map + sizeof(fp_header));
+                size_t n = (size - sizeof(fp_header)) / sizeof(fp_record);
+                for (size_t i = 0; i < n; ++i) {
+                    if (recs[i].size != 0 && recs[i].check == record_check(&recs[i]))
+                        index_put(&recs[i]);
+                }
+                cache.file_records = (long)n;
+                // a torn last append would misalign everything after it
+                if ((size - sizeof(fp_header)) % sizeof(fp_record) != 0
+                    && ftruncate(cache.fd, (off_t)(sizeof(fp_header) + n * sizeof(fp_record))) != 0) {
+                    my_system_call(SYS_CLOSE, cache.fd);
+                    cache.fd = -1;   // keep what we read, stop appending
+                }
+            }
+            munmap(map, size);
+        }
+    }
+
+    if (!valid) {
+        // new, foreign or outdated file: start over
+        if (ftruncate(cache.fd, 0) != 0 || write_header(cache.fd) != 0) {
+            my_system_call(SYS_CLOSE, cache.fd);
+            cache.fd = -1;
+        }
+        return;
+    }
+
+    if (cache.fd != -1 && cache.file_records > (long)cache.count + FP_COMPACT_SLACK)
+        compact_log();
+}
+
+// first use: find, open and index the log (called with cache_lock held)
+static void cache_load(void)
+{
+    cache.loaded = 1;
+    if (index_grow() == -1)
+        return;
+
+    const char *env = getenv("SMASH_FP_CACHE");
+    const char *home = getenv("HOME");
+    if (env && *env)
+        snprintf(cache.path, sizeof(cache.path), "%s", env);
+    else if (home && *home)
+        snprintf(cache.path, sizeof(cache.path), "%s/%s", home, FP_CACHE_FILE);
+    else
+        return;   // no place for the log: this session only
+
+    cache.fd = (int)my_system_call(SYS_OPEN, cache.path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (cache.fd == -1)
+        return;
+    load_log();
+}
+
+/*=============================================================================
+* API
+=============================================================================*/
+
+int fp_cache_lookup(const struct stat *st, uint64_t out[2])
+{
+    fp_record key;
+    record_from_stat(&key, st);
+    if (key.size == 0)
+        return 0;
+
+    pthread_mutex_lock(&cache_lock);
+    if (!cache.loaded)
+        cache_load();
+
+    int found = 0;
+    if (cache.cap) {
+        fp_record *slot = index_find(&key);
+        if (slot->size != 0) {
+            out[0] = slot->hash[0];
+            out[1] = slot->hash[1];
+            found = 1;
+        }
+    }
+    if (found)
+        cache.hits++;
+    else
+        cache.misses++;
+    pthread_mutex_unlock(&cache_lock);
+    return found;
+}
+
+void fp_cache_store(const struct stat *st, const uint64_t hash[2])
+{
+    fp_record r;
+    record_from_stat(&r, st);
+    if (r.size == 0)
+        return;
+    r.hash[0] = hash[0];
+    r.hash[1] = hash[1];
+    r.check   = record_check(&r);
+
+    pthread_mutex_lock(&cache_lock);
+    if (!cache.loaded)
+        cache_load();
+
+    if (cache.cap && index_put(&r) == 0) {
+        cache.stores++;
+        // O_APPEND: one record per write, other shells may append too
+        if (cache.fd != -1 && write_full(cache.fd, &r, sizeof(r)) == 0)
+            cache.file_records++;
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+void fp_cache_print_stats(FILE *out)
+{
+    pthread_mutex_lock(&cache_lock);
+    if (!cache.loaded)
+        cache_load();
+
+    fprintf(out, "file: %s\n", cache.fd != -1 ? cache.path : "(none, this session only)");
+    fprintf(out, "entries: %lu\n", (unsigned long)cache.count);
+    fprintf(out, "log records: %ld\n", cache.file_records);
+    fprintf(out, "log size: %lu bytes\n",
+            (unsigned long)(cache.fd != -1 ? sizeof(fp_header) + cache.file_records * sizeof(fp_record) : 0));
+    fprintf(out, "hits: %ld\n", cache.hits);
+    fprintf(out, "misses: %ld\n", cache.misses);
+    fprintf(out, "stores: %ld\n", cache.stores);
+    pthread_mutex_unlock(&cache_lock);
+}
@@ -0,0 +1,33 @@
+#ifndef FP_CACHE_H
+#define FP_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+/*=============================================================================
+* persistent content-fingerprint cache (diff builtin)
+*
+*  - key: (dev, inode, size, mtime in ns) of a file, value: 128-bit hash
+*    of its contents
+*  - on disk: an append-only log of fixed-size records, mmap'ed and indexed
+*    in memory (open addressing) the first time it is used, so a lookup is
+*    one hash probe; later records for the same key win
+*  - file: $SMASH_FP_CACHE, or ~/.smash_fpcache
+*  - all calls are thread-safe (diff -r compares on a thread pool)
+=============================================================================*/
+
+// 128-bit content hash (MurmurHash3 x64 128)
+void fp_hash128(const void *data, size_t len, uint64_t seed, uint64_t out[2]);
+
+// 1 and out filled if the file described by st has a known fingerprint, else 0
+int fp_cache_lookup(const struct stat *st, uint64_t out[2]);
+
+// remember the fingerprint of the file described by st (appended to the log)
+void fp_cache_store(const struct stat *st, const uint64_t hash[2]);
+
+// print entries, hits/misses and the log size to out (diff --cache-stats)
+void fp_cache_print_stats(FILE *out);
+
+#endif /* FP_CACHE_H */
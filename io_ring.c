@@ -0,0 +1,462 @@
+//io_ring.c
+#define _GNU_SOURCE
+#include "io_ring.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#define RING_ENTRIES 64   // submission queue; the completion queue is twice that
+#define PROBE_OPS    256
+
+/*=============================================================================
+* structs
+=============================================================================*/
+
+typedef struct io_ring {
+    int backend;                  // IO_BACKEND_SYNC / IO_BACKEND_URING
+    int fd;                       // io_uring, -1 = not set up
+    void *sq_map;
+    size_t sq_map_len;
+    void *cq_map;                 // == sq_map with IORING_FEAT_SINGLE_MMAP
+    size_t cq_map_len;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+    unsigned *sq_head, *sq_tail, *sq_array, sq_mask;
+    unsigned *cq_head, *cq_tail, cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned entries;
+    unsigned inflight;            // in the ring, not reaped
+    unsigned unsubmitted;         // in the submission queue, not taken by the kernel yet
+    io_req *ready;                // sync backend: done, not reaped
+    io_req **ready_tail;
+    void *bufs[IO_BUFS];
+    void *buf_block;
+    bool bufs_registered;
+    bool forked;                  // a fork copied it: the rings are still the parent's
+} io_ring;
+
+/*=============================================================================
+* global variables & data structures
+=============================================================================*/
+static pthread_key_t ring_key;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+
+/*=============================================================================
+* io_uring setup
+=============================================================================*/
+
+static int uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void uring_unmap(io_ring *r)
+{
+    if (r->sqes)
+        munmap(r->sqes, r->sqes_len);
+    if (r->cq_map && r->cq_map != r->sq_map)
+        munmap(r->cq_map, r->cq_map_len);
+    if (r->sq_map)
+        munmap(r->sq_map, r->sq_map_len);
+    if (r->fd != -1)
+        close(r->fd);
+    r->sqes   = NULL;
+    r->sq_map = r->cq_map = NULL;
+    r->fd     = -1;
+}
+
+// the operations the requests turn into, all of them or the ring is no use
+static int uring_probe(int fd)
+{
+    size_t size = sizeof(struct io_uring_probe) + PROBE_OPS * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = (struct io_uring_probe*)calloc(1, size);
+    if (!probe)
+        return -1;
+
+    static const int needed[] = { IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_READ_FIXED, IORING_OP_CLOSE };
+    int ok = uring_register(fd, IORING_REGISTER_PROBE, probe, PROBE_OPS) == 0;
+    for (int i = 0; ok && i < (int)(sizeof(needed) / sizeof(needed[0])); ++i) {
+        ok = needed[i] <= probe->last_op
+          && (probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    if (!ok) {
+        errno = ENOSYS;
+        return -1;
+    }
+    return 0;
+}
+
+static int uring_init(io_ring *r)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    r->fd = uring_setup(RING_ENTRIES, &p);   // the descriptor is close-on-exec
+    if (r->fd == -1)
+        return -1;
+    if (uring_probe(r->fd) == -1)
+        goto fail;
+
+    r->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && r->cq_map_len > r->sq_map_len)
+        r->sq_map_len = r->cq_map_len;
+
+    void *m = mmap(NULL, r->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   r->fd, IORING_OFF_SQ_RING);
+    if (m == MAP_FAILED)
+        goto fail;
+    r->sq_map = m;
+
+    if (single) {
+        r->cq_map = r->sq_map;
+    } else {
+        m = mmap(NULL, r->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                 r->fd, IORING_OFF_CQ_RING);
+        if (m == MAP_FAILED)
+            goto fail;
+        r->cq_map = m;
+    }
+
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    m = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+             r->fd, IORING_OFF_SQES);
+    if (m == MAP_FAILED)
+        goto fail;
+    r->sqes = (struct io_uring_sqe*)m;
+
+    char *sq = (char*)r->sq_map, *cq = (char*)r->cq_map;
+    r->sq_head  = (unsigned*)(sq + p.sq_off.head);
+    r->sq_tail  = (unsigned*)(sq + p.sq_off.tail);
+    r->sq_array = (unsigned*)(sq + p.sq_off.array);
+    r->sq_mask  = *(unsigned*)(sq + p.sq_off.ring_mask);
+    r->cq_head  = (unsigned*)(cq + p.cq_off.head);
+    r->cq_tail  = (unsigned*)(cq + p.cq_off.tail);
+    r->cq_mask  = *(unsigned*)(cq + p.cq_off.ring_mask);
+    r->cqes     = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    r->entries  = p.sq_entries;
+    return 0;
+
+fail:
+    {
+        int saved_errno = errno;
+        uring_unmap(r);
+        errno = saved_errno;
+    }
+    return -1;
+}
+
+// the thread's buffers as fixed buffers of the ring; best effort (RLIMIT_MEMLOCK)
+static void register_buffers(io_ring *r)
+{
+    if (r->fd == -1 || !r->buf_block || r->bufs_registered)
+        return;
+    struct iovec iov[IO_BUFS];
+    for (int i = 0; i < IO_BUFS; ++i) {
+        iov[i].iov_base = r->bufs[i];
+        iov[i].iov_len  = IO_BUF_SIZE;
+    }
+    r->bufs_registered = uring_register(r->fd, IORING_REGISTER_BUFFERS, iov, IO_BUFS) == 0;
+}
+
+/*=============================================================================
+* the thread's ring
+=============================================================================*/
+
+static void ring_free(void *p)
+{
+    io_ring *r = (io_ring*)p;
+    uring_unmap(r);   // closing the ring unregisters the buffers
+    free(r->buf_block);
+    free(r);
+}
+
+// the child of a fork (a builtin run with '&') shares the MAP_SHARED rings with
+// the parent: both would take each other's completions. Forget the copy, the
+// next call sets up a ring of the child's own (fork + exec never gets there).
+static void forget_ring_in_child(void)
+{
+    io_ring *r = (io_ring*)pthread_getspecific(ring_key);
+    if (r)
+        r->forked = true;
+}
+
+static void make_key(void)
+{
+    pthread_key_create(&ring_key, ring_free);
+    pthread_atfork(NULL, NULL, forget_ring_in_child);
+}
+
+static io_ring* get_ring(void)
+{
+    pthread_once(&key_once, make_key);
+    io_ring *r = (io_ring*)pthread_getspecific(ring_key);
+    if (r && !r->forked)
+        return r;
+    if (r) {
+        // only our mappings and fd go away, the parent's ring stays up
+        ring_free(r);
+        pthread_setspecific(ring_key, NULL);
+    }
+
+    r = (io_ring*)calloc(1, sizeof(io_ring));
+    if (!r)
+        return NULL;
+    r->fd         = -1;
+    r->ready_tail = &r->ready;
+    r->backend    = IO_BACKEND_SYNC;
+
+    const char *env = getenv("SMASH_IO_URING");
+    if (!(env && strcmp(env, "0") == 0) && uring_init(r) == 0)
+        r->backend = IO_BACKEND_URING;
+
+    if (pthread_setspecific(ring_key, r) != 0) {
+        ring_free(r);
+        return NULL;
+    }
+    return r;
+}
+
+/*=============================================================================
+* sync backend
+=============================================================================*/
+
+static void sync_do(io_req *req)
+{
+    long res;
+    switch (req->op) {
+    case IO_OP_OPEN:
+        res = my_system_call(SYS_OPEN, req->path, req->flags, 0);
+        break;
+    case IO_OP_READ:
+        // up to req->len or EOF: one short pread is not the end of the file
+        res = 0;
+        while ((unsigned long)res < req->len) {
+            ssize_t n = pread(req->fd, (char*)req->buf + res, req->len - (size_t)res,
+                              (off_t)req->offset + res);
+            if (n == -1 && errno == EINTR)
+                continue;
+            if (n <= 0) {
+                if (n == -1)
+                    res = -1;
+                break;
+            }
+            res += n;
+        }
+        break;
+    case IO_OP_CLOSE:
+        res = my_system_call(SYS_CLOSE, req->fd);
+        break;
+    default:
+        res = -1;
+        errno = EINVAL;
+    }
+    req->res = res == -1 ? -errno : res;
+}
+
+/*=============================================================================
+* io_uring backend
+=============================================================================*/
+
+static void fill_sqe(io_ring *r, struct io_uring_sqe *sqe, io_req *req)
+{
+    memset(sqe, 0, sizeof(*sqe));
+    switch (req->op) {
+    case IO_OP_OPEN:
+        sqe->opcode     = IORING_OP_OPENAT;
+        sqe->fd         = AT_FDCWD;
+        sqe->addr       = (uint64_t)(uintptr_t)req->path;
+        sqe->open_flags = (uint32_t)req->flags;
+        break;
+    case IO_OP_READ:
+        if (req->buf_index >= 0 && r->bufs_registered) {
+            sqe->opcode    = IORING_OP_READ_FIXED;
+            sqe->buf_index = (uint16_t)req->buf_index;
+        } else {
+            sqe->opcode = IORING_OP_READ;
+        }
+        sqe->fd   = req->fd;
+        sqe->addr = (uint64_t)(uintptr_t)req->buf;
+        sqe->len  = req->len;
+        sqe->off  = (uint64_t)req->offset;
+        break;
+    case IO_OP_CLOSE:
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd     = req->fd;
+        break;
+    default:
+        sqe->opcode = IORING_OP_NOP;   // completes with res 0: report EINVAL instead
+        break;
+    }
+    sqe->user_data = (uint64_t)(uintptr_t)req;
+}
+
+// hand what is in the submission queue to the kernel, waiting for min completions
+static int uring_flush(io_ring *r, unsigned min)
+{
+    while (1) {
+        int ret = uring_enter(r->fd, r->unsubmitted, min, min ? IORING_ENTER_GETEVENTS : 0);
+        if (ret >= 0) {
+            r->unsubmitted -= (unsigned)ret;
+            return 0;
+        }
+        if (errno != EINTR)
+            return -1;
+    }
+}
+
+static long uring_submit(io_ring *r, io_req *reqs, int n)
+{
+    unsigned tail = *r->sq_tail;
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    int queued = 0;
+
+    // at most entries in flight: the completion queue (2 x entries) never overflows
+    for (; queued < n && r->inflight < r->entries && tail - head < r->entries; ++queued) {
+        io_req *req = &reqs[queued];
+        req->done = 0;
+        unsigned slot = tail & r->sq_mask;
+        fill_sqe(r, &r->sqes[slot], req);
+        r->sq_array[slot] = slot;
+        tail++;
+        r->inflight++;
+        r->unsubmitted++;
+    }
+    __atomic_store_n(r->sq_tail, tail, __ATOMIC_RELEASE);
+
+    if (queued == 0 && n > 0) {
+        errno = EBUSY;
+        return -1;
+    }
+    // an error here leaves them queued: the next enter (reap) submits them
+    uring_flush(r, 0);
+    return queued;
+}
+
+static long uring_reap(io_ring *r, int min)
+{
+    long got = 0;
+    while (1) {
+        unsigned head = *r->cq_head;
+        unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            struct io_uring_cqe *cqe = &r->cqes[head & r->cq_mask];
+            io_req *req = (io_req*)(uintptr_t)cqe->user_data;
+            req->res  = req->op >= IO_OP_OPEN && req->op <= IO_OP_CLOSE ? cqe->res : -EINVAL;
+            req->done = 1;
+            r->inflight--;
+            got++;
+        }
+        __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+
+        if (got >= min || r->inflight == 0) {
+            if (r->unsubmitted)
+                uring_flush(r, 0);
+            return got;
+        }
+        if (uring_flush(r, (unsigned)(min - got)) == -1)
+            return got ? got : -1;
+    }
+}
+
+/*=============================================================================
+* API (my_system_call_ext)
+=============================================================================*/
+
+long io_ring_submit(io_req *reqs, int n)
+{
+    io_ring *r = get_ring();
+    if (!r)
+        return -1;
+    if (r->backend == IO_BACKEND_URING)
+        return uring_submit(r, reqs, n);
+
+    for (int i = 0; i < n; ++i) {
+        io_req *req = &reqs[i];
+        req->done = 0;
+        sync_do(req);
+        req->next = NULL;
+        *r->ready_tail = req;
+        r->ready_tail  = &req->next;
+    }
+    return n;
+}
+
+long io_ring_reap(int min)
+{
+    io_ring *r = get_ring();
+    if (!r)
+        return -1;
+    if (r->backend == IO_BACKEND_URING)
+        return uring_reap(r, min);
+
+    long got = 0;
+    for (io_req *req = r->ready; req; req = req->next, ++got)
+        req->done = 1;
+    r->ready      = NULL;
+    r->ready_tail = &r->ready;
+    return got;
+}
+
+long io_ring_buffers(void ***bufs)
+{
+    io_ring *r = get_ring();
+    if (!r)
+        return -1;
+    if (!r->buf_block) {
+        if (posix_memalign(&r->buf_block, 4096, (size_t)IO_BUFS * IO_BUF_SIZE) != 0) {
+            r->buf_block = NULL;
+            errno = ENOMEM;
+            return -1;
+        }
+        for (int i = 0; i < IO_BUFS; ++i)
+            r->bufs[i] = (char*)r->buf_block + (size_t)i * IO_BUF_SIZE;
+        register_buffers(r);
+    }
+    *bufs = r->bufs;
+    return IO_BUFS;
+}
+
+long io_ring_backend(int backend)
+{
+    io_ring *r = get_ring();
+    if (!r)
+        return -1;
+    if (backend == IO_BACKEND_QUERY)
+        return r->backend;
+    if (backend != IO_BACKEND_SYNC && backend != IO_BACKEND_URING) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (r->inflight || r->ready) {
+        errno = EBUSY;
+        return -1;
+    }
+    if (backend == IO_BACKEND_URING && r->fd == -1) {
+        if (uring_init(r) == -1)
+            return -1;
+        register_buffers(r);
+    }
+    r->backend = backend;
+    return backend;
+}
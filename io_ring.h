@@ -0,0 +1,29 @@
+#ifndef IO_RING_H
+#define IO_RING_H
+
+#include "my_system_call.h"
+
+/*=============================================================================
+* batched file I/O behind SYS_IO_SUBMIT / SYS_IO_REAP / SYS_IO_BUFFERS /
+* SYS_IO_BACKEND (my_system_call_ext)
+*
+*  - one ring per thread (a pthread key, torn down when the thread exits):
+*    no locking, diff -r workers and builtin stage threads each have their own;
+*    a forked child (builtin with '&') drops the inherited ring for a new one
+*  - io_uring through the raw syscalls (no liburing): the rings are mapped
+*    once, a batch of requests is one io_uring_enter, completions are read
+*    from the shared ring without a syscall when they are already there
+*  - the kernel is probed once per ring for openat / read / read_fixed /
+*    close; without them (or io_uring) the thread uses the sync backend,
+*    which does each request right away with the plain calls
+=============================================================================*/
+
+long io_ring_submit(io_req *reqs, int n);
+
+long io_ring_reap(int min);
+
+long io_ring_buffers(void ***bufs);
+
+long io_ring_backend(int backend);
+
+#endif /* IO_RING_H */
@@ -0,0 +1,328 @@
+//job_queue.c
+#define _GNU_SOURCE
+#include "job_queue.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "commands.h"
+
+#define HEAP_INIT_CAP 64
+
+/*=============================================================================
+* structs
+=============================================================================*/
+enum { Q_WAITING, Q_READY, Q_RUNNING, Q_GONE };
+
+typedef struct queue_entry {
+    int id;               // job id (QUEUED, then the running job)
+    int prio;
+    unsigned long seq;    // submission order, breaks priority ties
+    int pending;          // dependencies not finished yet
+    int refs;             // the job slot + waiter edges still pointing here
+    int state;
+    int heap_pos;         // Q_READY: index in the heap
+    cmd_line line;        // the pipeline to run, in block (freed once started)
+    void *block;
+} queue_entry;
+
+// one queued job waiting for the job whose list it is in (job.waiters)
+typedef struct queue_edge {
+    queue_entry *entry;
+    struct queue_edge *next;
+} queue_edge;
+
+/*=============================================================================
+* global variables & data structures
+=============================================================================*/
+static queue_entry **heap = NULL;   // Q_READY entries, best at [0]
+static int heap_len = 0;
+static int heap_cap = 0;
+
+static int limit     = 0;      // queue -j, 0 = not set yet (number of CPUs)
+static int running   = 0;      // started from the queue, not finished
+static int waiting   = 0;      // Q_WAITING entries
+static unsigned long next_seq = 0;
+
+static pid_t owner   = 0;      // the smash that queued; forked copies never start jobs
+static bool closed   = false;
+static bool dispatching = false;
+
+/*=============================================================================
+* heap (max priority, then min seq)
+=============================================================================*/
+
+static bool before(const queue_entry *a, const queue_entry *b)
+{
+    return a->prio != b->prio ? a->prio > b->prio : a->seq < b->seq;
+}
+
+static void heap_place(int i, queue_entry *e)
+{
+    heap[i] = e;
+    e->heap_pos = i;
+}
+
+static void sift_up(int i)
+{
+    queue_entry *e = heap[i];
+    while (i > 0 && before(e, heap[(i - 1) / 2])) {
+        heap_place(i, heap[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+    heap_place(i, e);
+}
+
+static void sift_down(int i)
+{
+    queue_entry *e = heap[i];
+    while (1) {
+        int c = 2 * i + 1;
+        if (c >= heap_len)
+            break;
+        if (c + 1 < heap_len && before(heap[c + 1], heap[c]))
+            c++;
+        if (!before(heap[c], e))
+            break;
+        heap_place(i, heap[c]);
+        i = c;
+    }
+    heap_place(i, e);
+}
+
+// room for n entries; submit reserves one slot per queued entry, so a
+// waiter that becomes ready can always be pushed
+static int heap_reserve(int n)
+{
+    if (n <= heap_cap)
+        return 0;
+    int cap = heap_cap ? heap_cap : HEAP_INIT_CAP;
+    while (cap < n)
+        cap *= 2;
+    queue_entry **grown = (queue_entry**)realloc(heap, (size_t)cap * sizeof(queue_entry*));
+    if (!grown)
+        return -1;
+    heap     = grown;
+    heap_cap = cap;
+    return 0;
+}
+
+static void heap_push(queue_entry *e)
+{
+    e->state = Q_READY;
+    heap_place(heap_len++, e);
+    sift_up(heap_len - 1);
+}
+
+static void heap_remove(queue_entry *e)
+{
+    int i = e->heap_pos;
+    queue_entry *last = heap[--heap_len];
+    if (i == heap_len)
+        return;
+    heap_place(i, last);
+    sift_up(i);
+    sift_down(last->heap_pos);
+}
+
+/*=============================================================================
+* helpers
+=============================================================================*/
+
+static bool is_owner(void)
+{
+    return owner != 0 && getpid() == owner;
+}
+
+static void drop_ref(queue_entry *e)
+{
+    if (--e->refs == 0) {
+        free(e->block);
+        free(e);
+    }
+}
+
+static bool finished_ok(const job *j)
+{
+    return j->status != QUEUED && j->exit_status != -1
+        && WIFEXITED(j->exit_status) && WEXITSTATUS(j->exit_status) == 0;
+}
+
+// start ready jobs while slots are free
+static void dispatch(job_arr *arr)
+{
+    if (dispatching || closed || !is_owner())
+        return;
+    dispatching = true;
+
+    if (limit == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        limit = cpus > 0 ? (int)cpus : 1;
+    }
+
+    while (running < limit && heap_len > 0) {
+        queue_entry *e = heap[0];
+        heap_remove(e);
+        e->state = Q_RUNNING;
+        running++;
+
+        int ok = start_queued_job(&e->line.chain[0], e->id);
+        free(e->block);   // the processes have their own copies
+        e->block = NULL;
+        if (ok == -1)
+            delete_job(arr, e->id);   // as if it failed: its waiters are cancelled
+    }
+
+    dispatching = false;
+}
+
+/*=============================================================================
+* API
+=============================================================================*/
+
+static int submit_locked(job_arr *arr, const cmd_line *line, const char *text,
+                         int prio, const int *after, int nafter)
+{
+    if (owner == 0)
+        owner = getpid();
+
+    // a heap slot for every entry that is ready or may become ready
+    queue_entry *e = NULL;
+    if (heap_reserve(heap_len + waiting + 1) == 0)
+        e = (queue_entry*)calloc(1, sizeof(queue_entry));
+    if (e)
+        e->block = cmd_line_clone(line, &e->line);
+    if (!e || !e->block) {
+        fprintf(stderr, "smash error: submit: malloc failed\n");
+        free(e);
+        return -1;
+    }
+
+    int id = add_queued_job(arr, text);
+    if (id == -1) {
+        free(e->block);
+        free(e);
+        return -1;
+    }
+
+    e->id      = id;
+    e->prio    = prio;
+    e->seq     = next_seq++;
+    e->pending = nafter;
+    e->refs    = 1;
+    e->state   = Q_WAITING;
+    waiting++;
+    job_at(arr, id)->qe = e;
+
+    // one edge in the waiter list of each job it comes after
+    for (int k = 0; k < nafter; ++k) {
+        queue_edge *edge = (queue_edge*)malloc(sizeof(queue_edge));
+        if (!edge) {
+            fprintf(stderr, "smash error: submit: malloc failed\n");
+            delete_job(arr, id);   // the edges made so far go with their jobs
+            return -1;
+        }
+        job *dep = job_at(arr, after[k]);
+        edge->entry  = e;
+        edge->next   = dep->waiters;
+        dep->waiters = edge;
+        e->refs++;
+    }
+
+    if (nafter == 0) {
+        waiting--;
+        heap_push(e);
+    }
+
+    dispatch(arr);
+    return id;
+}
+
+// the queue is changed with the job table locked, builtin threads print it (jobs)
+int job_queue_submit(job_arr *arr, const cmd_line *line, const char *text,
+                     int prio, const int *after, int nafter)
+{
+    job_table_lock(arr);
+    int id = submit_locked(arr, line, text, prio, after, nafter);
+    job_table_unlock(arr);
+    return id;
+}
+
+void job_queue_set_limit(job_arr *arr, int n)
+{
+    if (owner == 0)
+        owner = getpid();
+    job_table_lock(arr);
+    limit = n;
+    dispatch(arr);
+    job_table_unlock(arr);
+}
+
+void job_queue_print(void)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int lim = limit ? limit : (cpus > 0 ? (int)cpus : 1);
+    printf("queue: %d running (limit %d), %d ready, %d waiting\n", running, lim, heap_len, waiting);
+}
+
+void job_queue_print_job(FILE *out, const job *j)
+{
+    const queue_entry *e = j->qe;
+    if (!e)
+        return;
+    if (e->state == Q_WAITING)
+        fprintf(out, " (priority %d, waiting for %d)", e->prio, e->pending);
+    else
+        fprintf(out, " (priority %d)", e->prio);
+}
+
+void job_queue_job_left(job_arr *arr, job *j, int id)
+{
+    bool ok = finished_ok(j);
+
+    // its own entry
+    queue_entry *e = j->qe;
+    j->qe = NULL;
+    if (e) {
+        if (e->state == Q_RUNNING)
+            running--;
+        else if (e->state == Q_READY)
+            heap_remove(e);
+        else if (e->state == Q_WAITING)
+            waiting--;
+        e->state = Q_GONE;
+        drop_ref(e);
+    }
+
+    // the queued jobs waiting for it
+    queue_edge *edge = j->waiters;
+    j->waiters = NULL;
+    while (edge) {
+        queue_edge *next = edge->next;
+        queue_entry *w = edge->entry;
+
+        if (w->state == Q_WAITING) {
+            if (ok) {
+                if (--w->pending == 0) {
+                    waiting--;
+                    heap_push(w);   // its slot was reserved at submit
+                }
+            } else if (!closed) {
+                if (is_owner())
+                    fprintf(stderr, "smash: job %d cancelled: job %d did not succeed\n", w->id, id);
+                delete_job(arr, w->id);   // and its own waiters with it
+            }
+        }
+        drop_ref(w);
+        free(edge);
+        edge = next;
+    }
+
+    dispatch(arr);
+}
+
+void job_queue_close(void)
+{
+    closed = true;
+}
@@ -0,0 +1,55 @@
+#ifndef JOB_QUEUE_H
+#define JOB_QUEUE_H
+
+#include <stdbool.h>
+#include "jobs.h"
+#include "parser.h"
+
+/*=============================================================================
+* job queue (submit / queue builtins)
+*
+*  - a submitted pipeline becomes a QUEUED job in the job table right away
+*    (its id is the one --after refers to) and starts in the background once
+*    every job it comes after finished successfully and one of the queue -j
+*    slots is free
+*  - ready jobs wait in a binary heap (highest priority first, then the order
+*    of submission); a job with dependencies sits in the waiter lists of those
+*    jobs until the last one finishes, nothing is ever rescanned
+*  - a dependency that fails (or is killed / removed) cancels its waiters,
+*    and theirs in turn
+*  - not persistent, unlike what was asked for: the queue lives as long as
+*    the smash session. Its entries are jobs of this smash's table (ids that
+*    --after and the job list refer to, process groups it starts and reaps),
+*    which another smash could neither wait for nor start where they were
+*  - --after accepts a job that already finished successfully (the history
+*    of jobs -v); one that failed, or that is too old to be in it, is an error
+=============================================================================*/
+
+/*
+ * Queue line (one pipeline, copied) as a new QUEUED job with text for the job
+ * list, after the jobs in after[0..nafter) (ids of existing jobs).
+ * returns the job id, -1 on failure (message printed)
+ */
+int job_queue_submit(job_arr *arr, const cmd_line *line, const char *text,
+                     int prio, const int *after, int nafter);
+
+// at most n queued jobs running at once (starts more if that allows it)
+void job_queue_set_limit(job_arr *arr, int n);
+
+// queue: running / limit / ready / waiting
+void job_queue_print(void);
+
+// " (priority P[, waiting for N])" of QUEUED job j, for the job list
+void job_queue_print_job(FILE *out, const job *j);
+
+/*
+ * Job j (id) leaves the table: finished, cancelled or removed (delete_job).
+ * Its waiters go on (exit 0) or are cancelled, and a finished queued job
+ * frees its slot for the next one.
+ */
+void job_queue_job_left(job_arr *arr, job *j, int id);
+
+// smash is quitting: start nothing any more
+void job_queue_close(void);
+
+#endif /* JOB_QUEUE_H */
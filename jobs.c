@@ -1,8 +1,19 @@
+#define _GNU_SOURCE   // recursive mutexes, open_memstream
 #include "jobs.h"
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include "my_system_call.h"
+#include "parallel.h"
+#include "job_queue.h"
+#include "stage_thread.h"
+#include "proc_sample.h"
+#include "trace.h"
 #include <sys/wait.h>
+#include <errno.h>
+
+// the shell's job table (jobs.h)
+job_arr job_list;
 
 
 
@@ -11,6 +22,16 @@
 
 
 
+int64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+// the table whose lock fork and finished stage threads take (init_job_arr)
+static job_arr* job_table = NULL;
+
 /*=============================================================================
  * Initialize a single job slot to "empty"
  *===========================================================================*/
@@ -18,45 +39,450 @@
  void init_job(job* j)
  {
      j->pid        = 0;
-     j->command[0] = '\0';
-     j->time_stamp = 0;
+     j->npids      = 0;
+     j->nlive      = 0;
+     free(j->command);
+     j->command    = NULL;
+     j->start_ns   = 0;
      j->status     = 0;
      j->full       = false;
+     memset(&j->usage, 0, sizeof(j->usage));
+     j->exit_status = -1;
+     if (j->par)
+         parallel_stats_free(j->par);
+     j->par        = NULL;
+     j->qe         = NULL;   // the queue let go of them (job_queue_job_left)
+     j->waiters    = NULL;
+     stage_threads_release(job_table, j->threads);   // they run on, counting for nobody
+     j->threads    = NULL;
  }
 
 
+// the job owns a copy of its command line, as long as the line was
+static char* copy_command(const char* command)
+{
+    size_t size = strlen(command) + 1;
+    char* copy = (char*)malloc(size);
+    if (!copy) {
+        perror("smash error: malloc failed");
+        exit(1);
+    }
+    return (char*)memcpy(copy, command, size);
+}
+
+static void set_job_command(job* j, const char* command)
+{
+    char* copy = copy_command(command);   // command may be the old text of a slot
+    free(j->command);
+    j->command = copy;
+}
+
+/*=============================================================================
+ * id bitmaps
+ *  - words: one bit per job id
+ *  - nonempty / notfull: one bit per word, so the lowest clear id and the
+ *    highest set id are found with a ctz/clz on a summary word and one on
+ *    the word it points to
+ *===========================================================================*/
+
+#define SUMMARY_WORDS(nwords) (((nwords) + 63) / 64)
+
+static int bitmap_resize(id_bitmap* b, int nwords)
+{
+    int old_sum = SUMMARY_WORDS(b->nwords), new_sum = SUMMARY_WORDS(nwords);
+
+    uint64_t* words    = (uint64_t*)realloc(b->words, nwords * sizeof(uint64_t));
+    if (!words)
+        return -1;
+    b->words = words;
+    uint64_t* nonempty = (uint64_t*)realloc(b->nonempty, new_sum * sizeof(uint64_t));
+    if (!nonempty)
+        return -1;
+    b->nonempty = nonempty;
+    uint64_t* notfull  = (uint64_t*)realloc(b->notfull, new_sum * sizeof(uint64_t));
+    if (!notfull)
+        return -1;
+    b->notfull = notfull;
+
+    for (int s = old_sum; s < new_sum; ++s) {
+        b->nonempty[s] = 0;
+        b->notfull[s]  = 0;
+    }
+    for (int w = b->nwords; w < nwords; ++w) {
+        b->words[w] = 0;
+        b->notfull[w / 64] |= 1ULL << (w % 64);
+    }
+    b->nwords = nwords;
+    return 0;
+}
+
+static void bitmap_set(id_bitmap* b, int id)
+{
+    int w = id / 64;
+    b->words[w] |= 1ULL << (id % 64);
+    b->nonempty[w / 64] |= 1ULL << (w % 64);
+    if (b->words[w] == ~0ULL)
+        b->notfull[w / 64] &= ~(1ULL << (w % 64));
+}
+
+static void bitmap_clear(id_bitmap* b, int id)
+{
+    int w = id / 64;
+    b->words[w] &= ~(1ULL << (id % 64));
+    b->notfull[w / 64] |= 1ULL << (w % 64);
+    if (b->words[w] == 0)
+        b->nonempty[w / 64] &= ~(1ULL << (w % 64));
+}
+
+// lowest id not in the set (nwords * 64 if every id is)
+static int bitmap_first_clear(const id_bitmap* b)
+{
+    for (int s = 0; s < SUMMARY_WORDS(b->nwords); ++s) {
+        if (b->notfull[s]) {
+            int w = s * 64 + __builtin_ctzll(b->notfull[s]);
+            return w * 64 + __builtin_ctzll(~b->words[w]);
+        }
+    }
+    return b->nwords * 64;
+}
+
+// highest id in the set, 0 if it is empty (id 0 is never asked for)
+static int bitmap_last_set(const id_bitmap* b)
+{
+    for (int s = SUMMARY_WORDS(b->nwords) - 1; s >= 0; --s) {
+        if (b->nonempty[s]) {
+            int w = s * 64 + 63 - __builtin_clzll(b->nonempty[s]);
+            return w * 64 + 63 - __builtin_clzll(b->words[w]);
+        }
+    }
+    return 0;
+}
+
+/*=============================================================================
+ * pid index (open addressing, linear probing)
+ *  - every process of a BG/STOPPED job maps to its job id
+ *  - entries of reaped processes may linger: a lookup checks the job really
+ *    holds the pid, a new entry for the same pid overwrites, and the index is
+ *    rebuilt from the live jobs whenever it fills up
+ *===========================================================================*/
+
+#define PID_INDEX_INIT 256   // must be a power of 2
+
+static unsigned pid_hash(pid_t pid, int cap)
+{
+    return ((unsigned)pid * 2654435761u) & (unsigned)(cap - 1);
+}
+
+static pid_slot* pid_index_find(job_arr* arr, pid_t pid)
+{
+    unsigned i = pid_hash(pid, arr->pid_cap);
+    while (arr->pid_index[i].pid != 0 && arr->pid_index[i].pid != pid)
+        i = (i + 1) & (unsigned)(arr->pid_cap - 1);
+    return &arr->pid_index[i];
+}
+
+static void pid_index_put(job_arr* arr, pid_t pid, int id)
+{
+    pid_slot* slot = pid_index_find(arr, pid);
+    if (slot->pid == 0)
+        arr->pid_count++;
+    slot->pid = pid;
+    slot->id  = id;
+}
+
+// drop pid, shifting later entries of its probe run back (no tombstones)
+static void pid_index_remove(job_arr* arr, pid_t pid)
+{
+    unsigned mask = (unsigned)(arr->pid_cap - 1);
+    pid_slot* slot = pid_index_find(arr, pid);
+    if (slot->pid == 0)
+        return;
+
+    unsigned hole = (unsigned)(slot - arr->pid_index);
+    unsigned i = hole;
+    while (1) {
+        i = (i + 1) & mask;
+        if (arr->pid_index[i].pid == 0)
+            break;
+        unsigned home = pid_hash(arr->pid_index[i].pid, arr->pid_cap);
+        // move i into the hole unless its home lies cyclically in (hole, i]
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            arr->pid_index[hole] = arr->pid_index[i];
+            hole = i;
+        }
+    }
+    arr->pid_index[hole].pid = 0;
+    arr->pid_count--;
+}
+
+// rebuild from the jobs in the table, at least room for `need` more entries
+static int pid_index_rebuild(job_arr* arr, int need)
+{
+    int live = need;
+    for (int id = 1; id < arr->capacity; ++id) {
+        if (job_at(arr, id)->full)
+            live += job_at(arr, id)->nlive;
+    }
+
+    int cap = PID_INDEX_INIT;
+    while (cap < 2 * live)
+        cap *= 2;
+
+    pid_slot* index = (pid_slot*)calloc(cap, sizeof(pid_slot));
+    if (!index)
+        return -1;
+    free(arr->pid_index);
+    arr->pid_index = index;
+    arr->pid_cap   = cap;
+    arr->pid_count = 0;
+
+    for (int id = 1; id < arr->capacity; ++id) {
+        job* j = job_at(arr, id);
+        if (!j->full)
+            continue;
+        for (int k = 0; k < j->npids; ++k) {
+            if (j->pids[k] != 0)
+                pid_index_put(arr, j->pids[k], id);
+        }
+    }
+    return 0;
+}
+
+static int index_job_pids(job_arr* arr, int id)
+{
+    job* j = job_at(arr, id);
+    // keep the load factor at most 1/2
+    if (2 * (arr->pid_count + j->npids) > arr->pid_cap
+        && pid_index_rebuild(arr, j->npids) == -1)
+        return -1;
+
+    for (int k = 0; k < j->npids; ++k) {
+        if (j->pids[k] != 0)
+            pid_index_put(arr, j->pids[k], id);
+    }
+    return 0;
+}
+
+static void unindex_job_pids(job_arr* arr, int id)
+{
+    job* j = job_at(arr, id);
+    for (int k = 0; k < j->npids; ++k) {
+        if (j->pids[k] == 0)
+            continue;
+        pid_slot* slot = pid_index_find(arr, j->pids[k]);
+        if (slot->pid != 0 && slot->id == id)
+            pid_index_remove(arr, j->pids[k]);
+    }
+}
+
+/*=============================================================================
+ * table growth / id bookkeeping
+ *===========================================================================*/
+
+// add one page of job slots
+static int grow_job_arr(job_arr* arr)
+{
+    int npages = arr->capacity / JOB_PAGE_SIZE;
+
+    job* page = (job*)calloc(JOB_PAGE_SIZE, sizeof(job));   // no command to free yet
+    if (!page)
+        return -1;
+    for (int i = 0; i < JOB_PAGE_SIZE; ++i)
+        init_job(&page[i]);
+
+    job** pages = (job**)realloc(arr->pages, (npages + 1) * sizeof(job*));
+    if (!pages) {
+        free(page);
+        return -1;
+    }
+    arr->pages = pages;
+
+    // one bitmap word per page
+    if (bitmap_resize(&arr->used, npages + 1) == -1
+        || bitmap_resize(&arr->stopped, npages + 1) == -1) {
+        free(page);
+        return -1;
+    }
+
+    arr->pages[npages] = page;
+    arr->capacity += JOB_PAGE_SIZE;
+    return 0;
+}
+
+// id id got a job (status BG or STOPPED)
+static void id_taken(job_arr* arr, int id, char status)
+{
+    bitmap_set(&arr->used, id);
+    if (id > arr->highest_id)
+        arr->highest_id = id;
+    if (status == STOPPED) {
+        bitmap_set(&arr->stopped, id);
+        if (id > arr->highest_stopped_id)
+            arr->highest_stopped_id = id;
+    }
+    arr->smallest_free_id = bitmap_first_clear(&arr->used);
+}
+
+// id id lost its job
+static void id_released(job_arr* arr, int id)
+{
+    bitmap_clear(&arr->used, id);
+    bitmap_clear(&arr->stopped, id);
+    if (id == arr->highest_id)
+        arr->highest_id = bitmap_last_set(&arr->used);
+    if (id == arr->highest_stopped_id)
+        arr->highest_stopped_id = bitmap_last_set(&arr->stopped);
+    if (id == arr->resumed_fg_id)
+        arr->resumed_fg_id = 0;
+    if (id < arr->smallest_free_id)
+        arr->smallest_free_id = id;
+}
+
+// recursive: deleting a job may start or cancel others (job_queue.h)
+static void init_table_lock(job_arr* arr)
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&arr->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+static void lock_for_fork(void)
+{
+    job_table_lock(job_table);
+}
+
+static void unlock_after_fork(void)
+{
+    job_table_unlock(job_table);
+}
+
+// the child is another thread as far as the mutex knows: a fresh one, unlocked
+static void lock_in_child(void)
+{
+    init_table_lock(job_table);
+}
+
 /*==========================================================
  * Initialize the entire jobs array
  *  - job_counter = 0 (no background jobs yet)
  *  - smallest_free_id = 1 (first free job ID)
- *  - clear all slots jobs[0..JOBS_NUM_MAX]
+ *  - one page of empty slots, the table grows as jobs are added
  *========================================================*/
 
  void init_job_arr(job_arr* arr)
  {
-     arr->job_counter      = 0;
+     memset(arr, 0, sizeof(*arr));
+
+     if (grow_job_arr(arr) == -1 || pid_index_rebuild(arr, 0) == -1) {
+         perror("smash error: malloc failed");
+         exit(1);
+     }
+     bitmap_set(&arr->used, 0);   // fg slot, never handed out as a job id
      arr->smallest_free_id = 1;
- 
-     for (int i = 0; i <= JOBS_NUM_MAX; ++i) {
-         init_job(&arr->jobs[i]);
+
+     init_table_lock(arr);
+     if (job_table == NULL) {
+         job_table = arr;
+         pthread_atfork(lock_for_fork, unlock_after_fork, lock_in_child);
      }
  }
 
+/*================================================================
+ * Job table lock
+ *  - builtins on stage threads (stage_thread.h) read the table while smash
+ *    changes it: the main thread locks around every change of a BG / STOPPED
+ *    job or of the history, the threads around every read
+ *  - fork waits for it, the child gets the table consistent and unlocked
+ *===================================================================*/
+void job_table_lock(job_arr* arr)
+{
+    pthread_mutex_lock(&arr->lock);
+}
+
+void job_table_unlock(job_arr* arr)
+{
+    pthread_mutex_unlock(&arr->lock);
+}
+
 /*================================================================
  * Find background job by PID
- *  - searches jobs[1..JOBS_NUM_MAX]
+ *  - one probe of the pid index, any process of a pipeline matches
  *  - returns job_id if found, -1 otherwise
  *===================================================================*/
 int find_by_pid(job_arr* arr, pid_t pid)
 {
-    for (int j = 1; j <= JOBS_NUM_MAX; ++j) {
-        if (arr->jobs[j].full && arr->jobs[j].pid == pid) {
-            return j;   // job_id
+    if (pid <= 0)
+        return -1;
+
+    pid_slot* slot = pid_index_find(arr, pid);
+    if (slot->pid == 0)
+        return -1;
+
+    // the entry may be left over from a reaped process of an old job
+    job* j = job_at(arr, slot->id);
+    if (j->full) {
+        for (int k = 0; k < j->npids; ++k) {
+            if (j->pids[k] == pid) {
+                return slot->id;   // job_id
+            }
         }
     }
     return -1;
 }
 
+/*================================================================
+ * Find background job by id (as typed by the user)
+ *===================================================================*/
+job* find_job(job_arr* arr, long job_id)
+{
+    if (job_id < 1 || job_id >= arr->capacity)
+        return NULL;
+    job* j = job_at(arr, (int)job_id);
+    return j->full ? j : NULL;
+}
+
+/*================================================================
+ * Latest finished job that had this id, from the history ring
+ *===================================================================*/
+const job_record* find_job_record(job_arr* arr, int job_id)
+{
+    for (int n = 1; n <= arr->history_count; ++n) {
+        const job_record* r =
+            &arr->history[(arr->history_next - n + JOB_HISTORY_MAX) % JOB_HISTORY_MAX];
+        if (r->id == job_id)
+            return r;
+    }
+    return NULL;
+}
+
+/*==============================================================
+ * Set the status of a BG/STOPPED job, keeping the stopped set in sync
+ *==================================================================*/
+void set_job_status(job_arr* arr, int job_id, char status)
+{
+    job_table_lock(arr);
+    job* j = job_at(arr, job_id);
+    j->status = status;
+
+    if (status == STOPPED) {
+        bitmap_set(&arr->stopped, job_id);
+        if (job_id > arr->highest_stopped_id)
+            arr->highest_stopped_id = job_id;
+    } else {
+        bitmap_clear(&arr->stopped, job_id);
+        if (job_id == arr->highest_stopped_id)
+            arr->highest_stopped_id = bitmap_last_set(&arr->stopped);
+    }
+
+    if (status == FG)
+        arr->resumed_fg_id = job_id;
+    else if (job_id == arr->resumed_fg_id)
+        arr->resumed_fg_id = 0;
+    job_table_unlock(arr);
+}
+
 /*==============================================================
  * Change job status by PID
  *  - e.g. from BG to STOPPED when receiving SIGTSTP
@@ -68,48 +494,219 @@ int find_by_pid(job_arr* arr, pid_t pid)
      if (idx == -1) {
          return -1;
      }
-     arr->jobs[idx].status = new_status;
+     set_job_status(arr, idx, new_status);
      return 0;
  }
 
-/*
- * update_jobs:
- * Reap all finished child processes (background jobs) using waitpid(WNOHANG)
- * and remove them from the jobs list.
- *
- * This keeps the job list up-to-date, as required:
- * - before running commands
- * - before printing "jobs"
- * - before adding new jobs
- */
- void update_jobs(job_arr *arr)
- {
-     int status;
-     while (1) {
-         // -1 = any child, WNOHANG = don't block if none finished
-         pid_t pid = (pid_t)my_system_call(SYS_WAITPID, -1, &status, WNOHANG);
- 
-         if (pid <= 0) {
-             // pid == 0  -> no child has finished
-             // pid == -1 -> no children, or error (we ignore here)
-             break;
-         }
- 
-         // Find this pid in our jobs array
-         int idx = find_by_pid(arr, pid);
- 
-         if (idx > 0) {
-             // Background or stopped job slot
-             delete_job(arr, idx);
-         } else if (idx == 0) {
-             // Very defensive: if somehow fg job got reaped here
-             clear_fg_job(arr);
-         } else {
-             // pid not found in our table – ignore
-         }
-     }
- }
+/*==============================================================
+ * Signal a job
+ *  - single process: kill(pid)
+ *  - pipeline: kill(-pgid), so every stage gets the signal at once
+ *==================================================================*/
+long signal_job(job* j, int sig)
+{
+    if (j->pid == 0) {
+        errno = ESRCH;   // QUEUED: nothing runs yet (kill(0) would hit smash)
+        return -1;
+    }
+    // a pipeline, or a parallel driver with its children: the whole group
+    pid_t target = (j->npids > 1 || j->par) ? -j->pid : j->pid;
+    return my_system_call(SYS_KILL, target, sig);
+}
+
+/*==============================================================
+ * Mark one process of a job as reaped
+ *  - returns how many processes of the job are still alive
+ *==================================================================*/
+int job_member_exited(job* j, pid_t pid)
+{
+    for (int k = 0; k < j->npids; ++k) {
+        if (j->pids[k] == pid) {
+            j->pids[k] = 0;
+            j->nlive--;
+            break;
+        }
+    }
+    return j->nlive;
+}
+
+static long timeval_us(struct timeval tv)
+{
+    return (long)tv.tv_sec * 1000000L + (long)tv.tv_usec;
+}
+
+/*==============================================================
+ * Sum of two usages (time adds up the jobs of a command line)
+ *==================================================================*/
+void job_usage_add(job_usage* sum, const job_usage* u)
+{
+    sum->utime_us += u->utime_us;
+    sum->stime_us += u->stime_us;
+    if (u->maxrss_kb > sum->maxrss_kb)
+        sum->maxrss_kb = u->maxrss_kb;
+    sum->minflt += u->minflt;
+    sum->majflt += u->majflt;
+    sum->nvcsw  += u->nvcsw;
+    sum->nivcsw += u->nivcsw;
+}
+
+/*==============================================================
+ * Mark one process of a job as reaped, with what wait4 told about it
+ *  - its CPU time, faults and context switches are added to the job,
+ *    max RSS is the largest of any process
+ *  - the status of the last pipeline stage is the job's exit status
+ *==================================================================*/
+int job_member_reaped(job* j, pid_t pid, int status, const struct rusage* ru)
+{
+    if (ru) {
+        j->usage.utime_us += timeval_us(ru->ru_utime);
+        j->usage.stime_us += timeval_us(ru->ru_stime);
+        if (ru->ru_maxrss > j->usage.maxrss_kb)
+            j->usage.maxrss_kb = ru->ru_maxrss;
+        j->usage.minflt += ru->ru_minflt;
+        j->usage.majflt += ru->ru_majflt;
+        j->usage.nvcsw  += ru->ru_nvcsw;
+        j->usage.nivcsw += ru->ru_nivcsw;
+    }
+    if (j->npids > 0 && pid == j->pids[j->npids - 1])
+        j->exit_status = status;
+    return job_member_exited(j, pid);
+}
+
+/*==============================================================
+ * Keep a finished job in the history ring (oldest entry is overwritten)
+ *==================================================================*/
+void job_record_finished(job_arr* arr, const job* j, int job_id)
+{
+    job_table_lock(arr);
+    job_record* r = &arr->history[arr->history_next];
+
+    r->id          = job_id;
+    r->pid         = j->pid;
+    r->start_ns    = j->start_ns;
+    r->end_ns      = monotonic_ns();
+    r->exit_status = j->exit_status;
+    r->usage       = j->usage;
+    free(r->command);   // the entry being overwritten
+    r->command     = copy_command(j->command);
 
+    arr->history_next = (arr->history_next + 1) % JOB_HISTORY_MAX;
+    if (arr->history_count < JOB_HISTORY_MAX)
+        arr->history_count++;
+
+    // a job time is waiting for (background ones finishing meanwhile are not)
+    if (arr->fg_usage && j->status == FG)
+        job_usage_add(arr->fg_usage, &j->usage);
+    job_table_unlock(arr);
+}
+
+/*==============================================================
+ * Reap whatever already finished in a job (WNOHANG)
+ *  - a process that is gone already (waitpid -1) counts as finished
+ *==================================================================*/
+int poll_job(job* j)
+{
+    for (int k = 0; k < j->npids; ++k) {
+        pid_t pid = j->pids[k];
+        if (pid == 0)
+            continue;
+
+        int status = 0;
+        struct rusage ru;
+        long w = my_system_call_ext(SYS_WAIT4, pid, &status, WNOHANG, &ru);
+        if (w == pid)
+            job_member_reaped(j, pid, status, &ru);
+        else if (w == -1)
+            job_member_exited(j, pid);
+    }
+    return j->nlive;
+}
+
+/*==============================================================
+ * Block until the job finished or stopped (fg / foreground commands)
+ *  - a pipeline is waited on as a process group
+ *==================================================================*/
+int wait_job(job* j, int* last_status)
+{
+    pid_t last   = j->pids[j->npids - 1];
+    pid_t target = (j->npids > 1) ? -j->pid : j->pid;
+
+    while (j->nlive > 0) {
+        int status = 0;
+        struct rusage ru;
+        pid_t w = (pid_t)my_system_call_ext(SYS_WAIT4, target, &status, WUNTRACED, &ru);
+        if (w == -1) {
+            if (errno == ECHILD && j->npids > 1)
+                break;   // every stage was already reaped elsewhere
+            return -1;
+        }
+
+        if (WIFSTOPPED(status))
+            return 1;   // rest of the group got the same stop signal
+
+        if (w == last && last_status)
+            *last_status = status;
+        job_member_reaped(j, w, status, &ru);
+    }
+    return 0;
+}
+
+/*==============================================================
+ * A process was reaped (by whoever waited for it)
+ *  - marks it in its BG/STOPPED job; with its last process the job goes
+ *    to the history and is deleted
+ *  - returns the job id, -1 if pid belongs to no job in the table
+ *==================================================================*/
+static int job_process_reaped_locked(job_arr* arr, pid_t pid, int status, const struct rusage* ru)
+{
+    int idx = find_by_pid(arr, pid);
+    if (idx == -1)
+        return -1;
+
+    pid_index_remove(arr, pid);
+    job* j = job_at(arr, idx);
+    if (job_member_reaped(j, pid, status, ru) == 0) {
+        job_record_finished(arr, j, idx);
+        delete_job(arr, idx);
+    }
+    return idx;
+}
+
+int job_process_reaped(job_arr* arr, pid_t pid, int status, const struct rusage* ru)
+{
+    job_table_lock(arr);
+    int ret = job_process_reaped_locked(arr, pid, status, ru);
+    job_table_unlock(arr);
+    return ret;
+}
+
+/*==============================================================
+ * Reap finished processes of every BG/STOPPED job (WNOHANG, pid by pid)
+ *  - a job resumed by fg (status FG) is left to the one waiting for it
+ *==================================================================*/
+void reap_jobs(job_arr* arr)
+{
+    TRACE_BEGIN("reap_jobs");
+    for (int id = 1; id <= arr->highest_id; ++id) {
+        job* j = find_job(arr, id);
+        if (!j || j->status == FG)
+            continue;
+
+        for (int k = 0; k < j->npids; ++k) {
+            pid_t pid = j->pids[k];
+            if (pid == 0)
+                continue;
+
+            int status = -1;
+            struct rusage ru;
+            long w = my_system_call_ext(SYS_WAIT4, pid, &status, WNOHANG, &ru);
+            if (w != 0 && job_process_reaped(arr, pid, status, w == pid ? &ru : NULL) == id
+                && !j->full)
+                break;   // that was its last process, the job is gone
+        }
+    }
+    TRACE_END("reap_jobs");
+}
 
 //###########################################################################
 
@@ -118,154 +715,372 @@ int find_by_pid(job_arr* arr, pid_t pid)
 * printing
 =============================================================================*/
 
+/*
+ * The table is printed into memory while it is locked and copied to out
+ * afterwards: out may be a pipe whose reader did not start yet (a builtin
+ * on a stage thread), the lock is never held while waiting for it.
+ */
+typedef struct table_print {
+    FILE* mem;            // NULL = out of memory, printed straight to out
+    char* buf;
+    size_t len;
+    FILE* out;
+} table_print;
+
+static FILE* print_begin(job_arr* arr, table_print* tp, FILE* out)
+{
+    tp->out = out;
+    tp->buf = NULL;
+    tp->len = 0;
+    tp->mem = open_memstream(&tp->buf, &tp->len);
+    job_table_lock(arr);
+    return tp->mem ? tp->mem : out;
+}
+
+static void print_end(job_arr* arr, table_print* tp)
+{
+    job_table_unlock(arr);
+    if (!tp->mem)
+        return;
+    fclose(tp->mem);
+    fwrite(tp->buf, 1, tp->len, tp->out);
+    free(tp->buf);
+}
+
+
+// the processes of j right now: " S 0.0% cpu 1234 KB 1 threads" (jobs -l)
+static void print_job_sample(FILE* out, const job* j)
+{
+    proc_info sum = { 0, 0, 0, 0.0 };
+    int found = 0;
+    for (int k = 0; k < j->npids; ++k) {
+        proc_info pi;
+        if (j->pids[k] == 0 || proc_sample(j->pids[k], &pi) == -1)
+            continue;
+        // one state for the job: running if any process runs, else the first one's
+        if (found++ == 0 || pi.state == 'R')
+            sum.state = pi.state;
+        sum.threads += pi.threads;
+        sum.rss_kb  += pi.rss_kb;
+        sum.cpu_pct += pi.cpu_pct;
+    }
+    if (found == 0) {
+        fprintf(out, " -");   // exited, not reaped yet
+        return;
+    }
+    fprintf(out, " %c %.1f%% cpu %ld KB %ld threads", sum.state, sum.cpu_pct, sum.rss_kb, sum.threads);
+}
 
 /*===========================================================
  * Print all background / stopped jobs
- *  - job IDs are indexes 1..JOBS_NUM_MAX
+ *  - job IDs are 1..highest_id
  *  - format: "[<id>] <command> : <pid> <secs> secs (Stopped)"
+ *  - live (jobs -l): what the processes do right now after the secs
  *============================================================*/
- void print_all_bg_jobs(job_arr* arr)
+ static void print_jobs(job_arr* arr, FILE* to, bool live)
  {
-     for (int j = 1; j <= JOBS_NUM_MAX; ++j) {
-         if (!arr->jobs[j].full)
+     int64_t now = monotonic_ns();
+     table_print tp;
+     FILE* out = print_begin(arr, &tp, to);
+     if (live)
+         proc_sample_begin();
+     for (int id = 1; id <= arr->highest_id; ++id) {
+         job* j = job_at(arr, id);
+         if (!j->full)
              continue;
  
-         printf("[%d] %s : %d %ld secs",
-                j,
-                arr->jobs[j].command,
-                (int)arr->jobs[j].pid,
-                (long)difftime(time(NULL), arr->jobs[j].time_stamp));
+         if (j->status == QUEUED) {
+             fprintf(out, "[%d] %s : queued %ld secs", id, j->command,
+                     (long)((now - j->start_ns) / NS_PER_SEC));
+             job_queue_print_job(out, j);
+             fprintf(out, "\n");
+             continue;
+         }
+
+         fprintf(out, "[%d] %s : %d %ld secs",
+                 id,
+                 j->command,
+                 (int)j->pid,
+                 (long)((now - j->start_ns) / NS_PER_SEC));
  
-         if (arr->jobs[j].status == STOPPED) {
-             printf(" (Stopped)");
+         if (live)
+             print_job_sample(out, j);
+         if (j->par)
+             parallel_stats_print(out, j->par);
+         if (j->status == STOPPED) {
+             fprintf(out, " (Stopped)");
          }
-         printf("\n");
+         fprintf(out, "\n");
      }
+     if (live)
+         proc_sample_end();
+     print_end(arr, &tp);
  }
 
+void print_all_bg_jobs(job_arr* arr, FILE* out)
+{
+    print_jobs(arr, out, false);
+}
 
+void print_jobs_live(job_arr* arr, FILE* out)
+{
+    print_jobs(arr, out, true);
+}
 
 
 /*==================================================
- * Print current foreground job (slot 0), if any
- *  - used if you want to show fg info
+ * Resource usage (wait4) of jobs
  *=================================================*/
-void print_fg_job(job_arr* arr)
+
+// "exit <code>" / "signal <sig>" of a wait status
+static void print_exit_status(FILE* out, int status)
 {
-    if (!arr->jobs[0].full)
-        return;
+    if (status == -1)
+        fprintf(out, "unknown");
+    else if (WIFEXITED(status))
+        fprintf(out, "exit %d", WEXITSTATUS(status));
+    else if (WIFSIGNALED(status))
+        fprintf(out, "signal %d", WTERMSIG(status));
+    else
+        fprintf(out, "unknown");
+}
 
-    printf("%s : %d %ld secs\n",
-           arr->jobs[0].command,
-           (int)arr->jobs[0].pid,
-           (long)difftime(time(NULL), arr->jobs[0].time_stamp));
+static void print_usage_line(FILE* out, const job_usage* u)
+{
+    fprintf(out, "    user %ld.%03lds sys %ld.%03lds maxrss %ldKB faults %ld/%ld ctxsw %ld/%ld\n",
+            u->utime_us / 1000000, (u->utime_us / 1000) % 1000,
+            u->stime_us / 1000000, (u->stime_us / 1000) % 1000,
+            u->maxrss_kb, u->minflt, u->majflt, u->nvcsw, u->nivcsw);
 }
 
+/*===========================================================
+ * Print the finished jobs, oldest first
+ *  - format: "[<id>] <command> : <pid> done, <exit|signal> <n>, <secs> secs"
+ *    and the usage line; jobs that ran in the foreground show [fg]
+ *============================================================*/
+void print_job_history(job_arr* arr, FILE* to)
+{
+    table_print tp;
+    FILE* out = print_begin(arr, &tp, to);
+    if (arr->history_count > 0)
+        fprintf(out, "-- finished --\n");
+    int first = (arr->history_next - arr->history_count + JOB_HISTORY_MAX) % JOB_HISTORY_MAX;
+    for (int n = 0; n < arr->history_count; ++n) {
+        const job_record* r = &arr->history[(first + n) % JOB_HISTORY_MAX];
 
-//################################################################################################
+        if (r->id > 0)
+            fprintf(out, "[%d] ", r->id);
+        else
+            fprintf(out, "[fg] ");
+        fprintf(out, "%s : %d done, ", r->command, (int)r->pid);
+        print_exit_status(out, r->exit_status);
+        fprintf(out, ", %ld secs\n", (long)((r->end_ns - r->start_ns) / NS_PER_SEC));
+        print_usage_line(out, &r->usage);
+    }
+    print_end(arr, &tp);
+}
 
-/*=============================================================================
-* job manipulation
-=============================================================================*/
+static void print_usage_block(FILE* out, const job_usage* u)
+{
+    fprintf(out, "user cpu: %ld.%06ld s\n", u->utime_us / 1000000, u->utime_us % 1000000);
+    fprintf(out, "system cpu: %ld.%06ld s\n", u->stime_us / 1000000, u->stime_us % 1000000);
+    fprintf(out, "max rss: %ld KB\n", u->maxrss_kb);
+    fprintf(out, "page faults: %ld minor, %ld major\n", u->minflt, u->majflt);
+    fprintf(out, "context switches: %ld voluntary, %ld involuntary\n", u->nvcsw, u->nivcsw);
+}
 
+/*===========================================================
+ * Print everything known about one job (jobstat <id>)
+ *  - a job in the table: usage of its processes reaped so far
+ *  - otherwise the latest finished job that had this id
+ *============================================================*/
+static int print_job_stat_locked(job_arr* arr, int job_id, FILE* out)
+{
+    job* j = find_job(arr, job_id);
+    if (j) {
+        fprintf(out, "job %d: %s\n", job_id, j->command);
+        fprintf(out, "pid: %d\n", (int)j->pid);
+        fprintf(out, "state: %s\n", j->status == STOPPED ? "stopped"
+                                   : j->status == QUEUED ? "queued" : "running");
+        fprintf(out, "time: %ld secs\n", (long)((monotonic_ns() - j->start_ns) / NS_PER_SEC));
+        fprintf(out, "processes done: %d of %d\n", j->npids - j->nlive, j->npids);
+        if (j->threads && j->threads->running > 0)
+            fprintf(out, "builtin threads: %d running\n", j->threads->running);
+        print_usage_block(out, &j->usage);
+        return 0;
+    }
 
+    const job_record* r = find_job_record(arr, job_id);
+    if (!r)
+        return -1;
 
-/*=============================================
- * Move a background/stopped job into foreground
- *  - job_id is in [1..JOBS_NUM_MAX]
- *  - copies job[job_id] into jobs[0] (FG slot)
- *  - frees job[job_id] and updates smallest_free_id
- *=============================================*/
+    fprintf(out, "job %d: %s\n", job_id, r->command);
+    fprintf(out, "pid: %d\n", (int)r->pid);
+    fprintf(out, "state: done (");
+    print_exit_status(out, r->exit_status);
+    fprintf(out, ")\n");
+    fprintf(out, "time: %ld secs\n", (long)((r->end_ns - r->start_ns) / NS_PER_SEC));
+    print_usage_block(out, &r->usage);
+    return 0;
+}
 
+int print_job_stat(job_arr* arr, int job_id, FILE* to)
+{
+    table_print tp;
+    int ret = print_job_stat_locked(arr, job_id, print_begin(arr, &tp, to));
+    print_end(arr, &tp);
+    return ret;
+}
 
- int move_job_to_fg(job_arr* arr, int job_id)
- {
-     if (job_id < 1 || job_id > JOBS_NUM_MAX || !arr->jobs[job_id].full) {
-         fprintf(stderr, "smash error: fg %d - job does not exist\n", job_id);
-         return -1;
-     }
- 
-     // Copy job data into fg slot 0
-     arr->jobs[0].pid        = arr->jobs[job_id].pid;
-     arr->jobs[0].status     = FG;
-     arr->jobs[0].time_stamp = arr->jobs[job_id].time_stamp;
- 
-     strncpy(arr->jobs[0].command, arr->jobs[job_id].command, CMD_LENGTH_MAX - 1);
-     arr->jobs[0].command[CMD_LENGTH_MAX - 1] = '\0';
- 
-     arr->jobs[0].full = true;
- 
-     // Clear background slot
-     arr->jobs[job_id].full       = false;
-     arr->jobs[job_id].pid        = 0;
-     arr->jobs[job_id].command[0] = '\0';
-     arr->jobs[job_id].status     = 0;
-     arr->jobs[job_id].time_stamp = 0;
-     arr->job_counter--;
- 
-     // Update smallest_free_id if this index is now the first free one
-     if (job_id < arr->smallest_free_id) {
-         arr->smallest_free_id = job_id;
-     }
- 
-     return 0;
- }
 
+//################################################################################################
 
+/*=============================================================================
+* job manipulation
+=============================================================================*/
 
 
 /*=============================================================================
  * Add a job:
- *  - if status == FG: put it in jobs[0]
- *  - else (BG or STOPPED): find a free slot 1..JOBS_NUM_MAX using smallest_free_id
+ *  - if status == FG: put it in slot 0
+ *  - else (BG or STOPPED): take the smallest free id >= 1, growing the table
+ *    by a page when every id is in use
  *===========================================================================*/
 
 
 int add_job(job_arr* arr, pid_t pid, const char* command, char status)
 {
+    return add_job_group(arr, pid, &pid, 1, command, status);
+}
+
+// copy the processes of a job, reaped ones (0) are kept in place but not counted
+static void set_job_pids(job* j, pid_t pgid, const pid_t* pids, int npids)
+{
+    j->pid   = pgid;
+    j->npids = npids;
+    j->nlive = 0;
+    for (int k = 0; k < npids; ++k) {
+        j->pids[k] = pids[k];
+        if (pids[k] != 0)
+            j->nlive++;
+    }
+}
+
+static int add_job_group_locked(job_arr* arr, pid_t pgid, const pid_t* pids, int npids,
+                                const char* command, char status)
+{
+    if (npids < 1 || npids > PIPE_STAGES_MAX)
+        return -1;
+
     if (status == FG) {
         // Foreground job goes into slot 0
-        arr->jobs[0].pid        = pid;
-        arr->jobs[0].status     = FG;
-        arr->jobs[0].time_stamp = time(NULL);
+        job* fgj = job_at(arr, 0);
+        set_job_pids(fgj, pgid, pids, npids);
+        fgj->status     = FG;
+        fgj->start_ns   = monotonic_ns();
 
-        strncpy(arr->jobs[0].command, command, CMD_LENGTH_MAX - 1);
-        arr->jobs[0].command[CMD_LENGTH_MAX - 1] = '\0';
+        set_job_command(fgj, command);
 
-        arr->jobs[0].full = true;
-        return 0;
+        fgj->full = true;
+        return 0;   // the fg slot
     }
 
-    // Background / stopped job: use smallest_free_id for job ID in [1..JOBS_NUM_MAX]
+    // Background / stopped job: smallest free id, the table grows when all are taken
     int id = arr->smallest_free_id;
-    if (id < 1 || id > JOBS_NUM_MAX) {
+    if (id >= arr->capacity && grow_job_arr(arr) == -1) {
         fprintf(stderr, "smash error: jobs list is full\n");
         return -1;
     }
 
-    arr->jobs[id].pid        = pid;
-    arr->jobs[id].status     = status;   // BG or STOPPED
-    arr->jobs[id].time_stamp = time(NULL);
+    // (jobs never move, so pids/command may point into another slot, e.g. slot 0)
+    job* j = job_at(arr, id);
+    set_job_pids(j, pgid, pids, npids);
+    j->status     = status;   // BG or STOPPED
+    j->start_ns   = monotonic_ns();
 
-    strncpy(arr->jobs[id].command, command, CMD_LENGTH_MAX - 1);
-    arr->jobs[id].command[CMD_LENGTH_MAX - 1] = '\0';
+    set_job_command(j, command);
 
-    arr->jobs[id].full = true;
+    if (index_job_pids(arr, id) == -1) {
+        init_job(j);
+        fprintf(stderr, "smash error: jobs list is full\n");
+        return -1;
+    }
+
+    j->full = true;
     arr->job_counter++;
+    id_taken(arr, id, status);
 
-    // Recompute smallest_free_id (first free slot in 1..JOBS_NUM_MAX)
-    int new_free = JOBS_NUM_MAX + 1;
-    for (int i = 1; i <= JOBS_NUM_MAX; ++i) {
-        if (!arr->jobs[i].full) {
-            new_free = i;
-            break;
-        }
+    return id;
+}
+
+int add_job_group(job_arr* arr, pid_t pgid, const pid_t* pids, int npids,
+                  const char* command, char status)
+{
+    job_table_lock(arr);
+    int ret = add_job_group_locked(arr, pgid, pids, npids, command, status);
+    job_table_unlock(arr);
+    return ret;
+}
+
+/*=============================================================================
+ * Queued jobs (job_queue.h)
+ *  - a QUEUED job holds an id and its command but no process; once the queue
+ *    starts it, it is a BG job like any other
+ *===========================================================================*/
+
+static int add_queued_job_locked(job_arr* arr, const char* command)
+{
+    int id = arr->smallest_free_id;
+    if (id >= arr->capacity && grow_job_arr(arr) == -1) {
+        fprintf(stderr, "smash error: jobs list is full\n");
+        return -1;
     }
-    arr->smallest_free_id = new_free;
 
+    job* j = job_at(arr, id);
+    j->pid        = 0;
+    j->npids      = 0;
+    j->nlive      = 0;
+    j->status     = QUEUED;
+    j->start_ns   = monotonic_ns();
+    set_job_command(j, command);
+
+    j->full = true;
+    arr->job_counter++;
+    id_taken(arr, id, QUEUED);
+    return id;
+}
+
+int add_queued_job(job_arr* arr, const char* command)
+{
+    job_table_lock(arr);
+    int ret = add_queued_job_locked(arr, command);
+    job_table_unlock(arr);
+    return ret;
+}
+
+static int job_start_queued_locked(job_arr* arr, int job_id, pid_t pgid, const pid_t* pids, int npids)
+{
+    job* j = find_job(arr, job_id);
+    if (!j || j->status != QUEUED || npids < 1 || npids > PIPE_STAGES_MAX)
+        return -1;
+
+    set_job_pids(j, pgid, pids, npids);
+    j->status     = BG;
+    j->start_ns   = monotonic_ns();   // the time it has been running, like any job
+    if (index_job_pids(arr, job_id) == -1) {
+        fprintf(stderr, "smash error: jobs list is full\n");
+        return -1;
+    }
     return 0;
 }
 
+int job_start_queued(job_arr* arr, int job_id, pid_t pgid, const pid_t* pids, int npids)
+{
+    job_table_lock(arr);
+    int ret = job_start_queued_locked(arr, job_id, pgid, pids, npids);
+    job_table_unlock(arr);
+    return ret;
+}
 
 
 
@@ -273,39 +1088,38 @@ int add_job(job_arr* arr, pid_t pid, const char* command, char status)
  
 void clear_fg_job(job_arr* arr)
 {
-    if (!arr->jobs[0].full)
+    job* fgj = job_at(arr, 0);
+    if (!fgj->full)
         return;
 
-    arr->jobs[0].full       = false;
-    arr->jobs[0].pid        = 0;
-    arr->jobs[0].command[0] = '\0';
-    arr->jobs[0].status     = 0;
-    arr->jobs[0].time_stamp = 0;
+    job_table_lock(arr);
+    init_job(fgj);
+    job_table_unlock(arr);
 }
 
 
 
 /*=============================================================================
  * Delete a background / stopped job by job_id
- *  - job_id in [1..JOBS_NUM_MAX]
  *===========================================================================*/
 
-void delete_job(job_arr* arr, int job_id)
+static void delete_job_locked(job_arr* arr, int job_id)
 {
-    if (job_id < 1 || job_id > JOBS_NUM_MAX)
+    job* j = find_job(arr, job_id);
+    if (!j)
         return;
 
-    if (!arr->jobs[job_id].full)
-        return;
-
-    arr->jobs[job_id].full       = false;
-    arr->jobs[job_id].pid        = 0;
-    arr->jobs[job_id].command[0] = '\0';
-    arr->jobs[job_id].status     = 0;
-    arr->jobs[job_id].time_stamp = 0;
+    unindex_job_pids(arr, job_id);
+    if (j->qe || j->waiters)
+        job_queue_job_left(arr, j, job_id);   // may start or cancel other jobs
+    init_job(j);
     arr->job_counter--;
+    id_released(arr, job_id);
+}
 
-    if (job_id < arr->smallest_free_id) {
-        arr->smallest_free_id = job_id;
-    }
+void delete_job(job_arr* arr, int job_id)
+{
+    job_table_lock(arr);
+    delete_job_locked(arr, job_id);
+    job_table_unlock(arr);
 }
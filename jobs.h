@@ -1,84 +1,236 @@
-#ifndef JOBS_H
-#define JOBS_H
-
-#include <time.h>
-#include <sys/types.h>
-#include <stdbool.h>
-#include "commands.h"   // for CMD_LENGTH_MAX and JOBS_NUM_MAX
-
-/*=============================================================================
-* flags
-=============================================================================*/
-#define FG       '1'
-#define BG       '2'
-#define STOPPED  '3'
-
-
-/*=============================================================================
-* structs
-=============================================================================*/
-typedef struct job {
-    pid_t pid;
-    char command[CMD_LENGTH_MAX];
-    time_t time_stamp;
-    char status;
-    bool full;
-    //char prev_wd[CMD_LENGTH_MAX];
-    //bool is_external;
-} job;
-
-typedef struct job_arr {
-    job jobs[JOBS_NUM_MAX + 1];   /* index 0 = FG , 1..MAX_ARGS = BG */
-    int job_counter;     // how many BG/STOPPED jobs (not counting fg)
-    int smallest_free_id;  // smallest free index in 1..JOBS_NUM_MAX
-} job_arr;
-
-/*=============================================================================
-* init
-=============================================================================*/
-void init_job(job* j);
-
-void init_job_arr(job_arr* arr);
-
-/*=============================================================================
-* helpers
-=============================================================================*/
-// find background job index by pid, returns job_id in [1..JOBS_NUM_MAX] or -1
-int find_by_pid(job_arr* arr, pid_t pid);
-
-// change status of job by pid, returns 0 on success, -1 if not found
-int job_status_change(job_arr* arr, pid_t pid, char cur_status);
-
-/*=============================================================================
-* printing
-=============================================================================*/
-void print_all_bg_jobs(job_arr* arr);
-
-void print_fg_job(job_arr* arr);
-
-/*=============================================================================
-* job manipulation
-=============================================================================*/
-// add job, status should be FG or BG (STOPPED is set later when signal happens)
-int add_job(job_arr* arr, pid_t pid, const char* command, char status);
-
-// move BG/STOPPED job [job_id] (1..JOBS_NUM_MAX) into foreground slot (jobs[0])
-int move_job_to_fg(job_arr* arr, int job_id);
-
-// clear fg slot after job finished
-void clear_fg_job(job_arr *arr);
-
-void update_jobs(job_arr *arr);
-
-
-
-
-/*=============================================================================
-* delete
-=============================================================================*/
-// delete BG/STOPPED job by job_id in [1..JOBS_NUM_MAX]
-void delete_job(job_arr* arr, int job_id);
-
-//void delete_complex_job(job_arr* arr, pid_t complex_pid, int complex_i, int   smallest_free_id);
-
-#endif /* JOBS_H */
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <time.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <pthread.h>
+
+/*=============================================================================
+* flags
+=============================================================================*/
+#define FG       '1'
+#define BG       '2'
+#define STOPPED  '3'
+#define QUEUED   '4'   // submitted, waiting in the job queue (no process yet)
+
+// most processes one job can hold (stages of a pipeline)
+#define PIPE_STAGES_MAX 32
+
+// the job table grows by pages of this many slots; a job never moves
+#define JOB_PAGE_SIZE 64
+
+// finished jobs kept for jobs -v / jobstat (oldest dropped first)
+#define JOB_HISTORY_MAX 64
+
+
+/*=============================================================================
+* structs
+=============================================================================*/
+// resources used by the reaped processes of a job (from wait4)
+typedef struct job_usage {
+    long utime_us;      // user CPU
+    long stime_us;      // system CPU
+    long maxrss_kb;     // largest max RSS of any process
+    long minflt;        // page faults without I/O
+    long majflt;        // page faults with I/O
+    long nvcsw;         // voluntary context switches
+    long nivcsw;        // involuntary context switches
+} job_usage;
+
+typedef struct job {
+    pid_t pid;                      // first process = process group of the job
+    pid_t pids[PIPE_STAGES_MAX];    // every process of the job, 0 once reaped
+    int npids;                      // processes started (pipeline stages)
+    int nlive;                      // processes not reaped yet
+    char *command;                  // full command line (owned, NULL = empty slot)
+    int64_t start_ns;               // monotonic_ns() when it started running (or was queued)
+    char status;
+    bool full;
+    job_usage usage;                // summed over the processes reaped so far
+    int exit_status;                // wait status of the last stage, -1 = not reaped yet
+    struct parallel_stats *par;     // parallel driver job: its progress (owned), else NULL
+    struct queue_entry *qe;         // job of the queue (QUEUED or started from it), else NULL
+    struct queue_edge *waiters;     // queued jobs that wait for this one to finish
+    struct stage_threads *threads;  // its builtin stages running on threads of smash, else NULL
+    //char prev_wd[CMD_LENGTH_MAX];
+    //bool is_external;
+} job;
+
+// set of job ids: bit per id, plus per-word summaries for ffs/clz searches
+typedef struct id_bitmap {
+    uint64_t *words;      // bit set = id in the set
+    uint64_t *nonempty;   // bit per word: word has a set bit
+    uint64_t *notfull;    // bit per word: word has a clear bit
+    int nwords;
+} id_bitmap;
+
+// a finished job in the history ring
+typedef struct job_record {
+    int id;                         // job id it had, 0 = ran in the foreground
+    pid_t pid;
+    char *command;                  // owned copy
+    int64_t start_ns;               // monotonic_ns()
+    int64_t end_ns;
+    int exit_status;                // wait status, -1 = unknown
+    job_usage usage;
+} job_record;
+
+// pid index entry, pid 0 = empty
+typedef struct pid_slot {
+    pid_t pid;
+    int id;
+} pid_slot;
+
+typedef struct job_arr {
+    job **pages;              // job id -> pages[id / JOB_PAGE_SIZE][id % JOB_PAGE_SIZE], id 0 = FG
+    int capacity;             // ids 0..capacity-1 have a slot, grows on demand
+    int job_counter;          // how many BG/STOPPED jobs (not counting fg)
+    int smallest_free_id;     // smallest free id >= 1 (== capacity: next add grows)
+    int highest_id;           // highest BG/STOPPED id, 0 = none
+    int highest_stopped_id;   // highest STOPPED id, 0 = none
+    int resumed_fg_id;        // BG/STOPPED job resumed by fg (status FG), 0 = none
+    id_bitmap used;           // ids holding a job (bit 0, the fg slot, always set)
+    id_bitmap stopped;        // ids holding a STOPPED job
+    pid_slot *pid_index;      // open addressing: pid of any job process -> job id
+    int pid_cap;
+    int pid_count;            // entries, including ones of reaped processes
+    job_record history[JOB_HISTORY_MAX];   // ring of finished jobs
+    int history_next;         // slot the next finished job goes to
+    int history_count;
+    job_usage* fg_usage;      // set by time: usage of each job that finishes in the foreground is added
+    pthread_mutex_t lock;     // recursive: held by the main thread while it changes the table,
+                              // by builtin threads while they read it (job_table_lock)
+} job_arr;
+
+// slot of job id (0..capacity-1)
+static inline job* job_at(job_arr* arr, int id)
+{
+    return &arr->pages[id / JOB_PAGE_SIZE][id % JOB_PAGE_SIZE];
+}
+
+/*=============================================================================
+* init
+=============================================================================*/
+void init_job(job* j);
+
+void init_job_arr(job_arr* arr);
+
+// the shell's job table (defined in jobs.c)
+extern job_arr job_list;
+
+/*
+ * The main thread is the only one changing the table, it takes the lock for
+ * that; builtins running on threads take it to read (jobs | grep ...).
+ * Recursive, and held across fork so a child never inherits it locked.
+ */
+void job_table_lock(job_arr* arr);
+void job_table_unlock(job_arr* arr);
+
+/*=============================================================================
+* helpers
+=============================================================================*/
+#define NS_PER_SEC 1000000000LL
+
+// CLOCK_MONOTONIC in nanoseconds: job times, not moved by clock changes
+int64_t monotonic_ns(void);
+
+// find background job index by pid, returns job_id (>= 1) or -1
+int find_by_pid(job_arr* arr, pid_t pid);
+
+// BG/STOPPED job with this id, NULL if there is none
+job* find_job(job_arr* arr, long job_id);
+
+// latest finished job that had this id (history), NULL if none is kept
+const job_record* find_job_record(job_arr* arr, int job_id);
+
+// set status (BG, STOPPED or FG = resumed by fg) of job job_id
+void set_job_status(job_arr* arr, int job_id, char status);
+
+// change status of job by pid, returns 0 on success, -1 if not found
+int job_status_change(job_arr* arr, pid_t pid, char cur_status);
+
+// send sig to every process of the job (the whole process group for pipelines),
+// -1 with ESRCH for a QUEUED job
+long signal_job(job* j, int sig);
+
+// mark process pid of the job as reaped, returns the number of live processes left
+int job_member_exited(job* j, pid_t pid);
+
+// same, with what wait4 returned for it (status, ru may be NULL)
+int job_member_reaped(job* j, pid_t pid, int status, const struct rusage* ru);
+
+// job j (id 0 = foreground slot) finished: keep it in the history
+void job_record_finished(job_arr* arr, const job* j, int job_id);
+
+// add u to sum: counters add up, max RSS is the larger one
+void job_usage_add(job_usage* sum, const job_usage* u);
+
+// reap finished processes of the job without blocking, returns live processes left
+int poll_job(job* j);
+
+/*
+ * Wait until every process of the job finished or one of them stopped.
+ *  - returns 0 if the job finished, 1 if it was stopped, -1 on waitpid error
+ *  - *last_status = wait status of the last pipeline stage (if it was reaped)
+ */
+int wait_job(job* j, int* last_status);
+
+/*=============================================================================
+* printing
+=============================================================================*/
+void print_all_bg_jobs(job_arr* arr, FILE* out);
+
+// the same list with each job's state, CPU%, RSS and threads from /proc (jobs -l,
+// CPU% since the previous call)
+void print_jobs_live(job_arr* arr, FILE* out);
+
+// finished jobs with their resource usage, oldest first (jobs -v)
+void print_job_history(job_arr* arr, FILE* out);
+
+// everything known about job job_id (running, stopped or in the history),
+// returns -1 if there is no such job
+int print_job_stat(job_arr* arr, int job_id, FILE* out);
+
+/*=============================================================================
+* job manipulation
+=============================================================================*/
+// add job, status should be FG or BG (STOPPED is set later when signal happens)
+int add_job(job_arr* arr, pid_t pid, const char* command, char status);
+
+// add job made of several processes in process group pgid, 0 entries in pids = reaped
+// returns the job id (0 for FG), -1 on failure
+int add_job_group(job_arr* arr, pid_t pgid, const pid_t* pids, int npids,
+                  const char* command, char status);
+
+// add a QUEUED job (no process yet), returns its id or -1
+int add_queued_job(job_arr* arr, const char* command);
+
+// QUEUED job job_id was started as processes pids (group pgid): now a BG job
+int job_start_queued(job_arr* arr, int job_id, pid_t pgid, const pid_t* pids, int npids);
+
+// clear fg slot after job finished
+void clear_fg_job(job_arr *arr);
+
+// process pid was reaped (status, ru from wait4, ru may be NULL):
+// update its job, returns the job id or -1
+int job_process_reaped(job_arr* arr, pid_t pid, int status, const struct rusage* ru);
+
+// reap finished processes of the BG/STOPPED jobs, pid by pid (WNOHANG)
+void reap_jobs(job_arr* arr);
+
+
+
+
+/*=============================================================================
+* delete
+=============================================================================*/
+// delete BG/STOPPED job by job_id
+void delete_job(job_arr* arr, int job_id);
+
+//void delete_complex_job(job_arr* arr, pid_t complex_pid, int complex_i, int   smallest_free_id);
+
+#endif /* JOBS_H */
@@ -13,6 +13,42 @@
 #define SYS_OPEN     9
 #define SYS_CLOSE    10
 
+//extended syscall numbers (served by my_system_call_ext, see below)
+#define SYS_SPAWN    11
+#define SYS_PIPE_CLOEXEC 12
+#define SYS_PIDFD_OPEN 13
+#define SYS_WAIT4    14
+#define SYS_IO_SUBMIT  15
+#define SYS_IO_REAP    16
+#define SYS_IO_BUFFERS 17
+#define SYS_IO_BACKEND 18
+
+//batched file I/O (SYS_IO_SUBMIT / SYS_IO_REAP)
+#define IO_OP_OPEN   1
+#define IO_OP_READ   2
+#define IO_OP_CLOSE  3
+
+#define IO_BACKEND_QUERY (-1)
+#define IO_BACKEND_SYNC  0    // each request done right away with the plain calls
+#define IO_BACKEND_URING 1    // io_uring: one io_uring_enter per batch, requests run asynchronously
+
+#define IO_BUFS      8             // fixed buffers per thread (SYS_IO_BUFFERS)
+#define IO_BUF_SIZE  (64 * 1024)
+
+typedef struct io_req {
+    int op;               // IO_OP_*
+    int fd;               // READ, CLOSE
+    const char *path;     // OPEN (openat(AT_FDCWD, path, flags))
+    int flags;            // OPEN
+    void *buf;            // READ
+    unsigned len;         // READ
+    int buf_index;        // READ: buf is fixed buffer buf_index (SYS_IO_BUFFERS), -1 = any memory
+    long long offset;     // READ: like pread, the file offset is not used or moved
+    long res;             // once done: the fd / bytes read / 0, or -errno
+    int done;             // set when the request is reaped
+    struct io_req *next;  // the backend's
+} io_req;
+
 /*
  * @General wrapper for invoking system calls by number.
  *
@@ -28,4 +64,70 @@
  *         (see each call’s behavior in its respective man page).
  */long my_system_call(int syscall_number, ...);
 
+/*
+ * @Wrapper for the extended system call numbers (SYS_SPAWN and up).
+ *
+ * The prebuilt my_system_call object only dispatches the numbers 1..SYS_CLOSE,
+ * so the extended calls are routed through this function instead. It follows
+ * the same convention: arguments depend on the call, and on failure it returns
+ * -1 with errno set.
+ *
+ * SYS_SPAWN (pid_t *pid, const char *file, char *const argv[], pid_t pgid,
+ *            const int fds[3]):
+ *         start `file` (searched in $PATH like execvp) without copying the
+ *         parent's address space (posix_spawn, which uses
+ *         clone(CLONE_VM|CLONE_VFORK) on Linux). The child joins process
+ *         group pgid, or leads a new one when pgid is 0. If fds is not NULL,
+ *         fds[i] != -1 is duplicated onto descriptor i (stdin/stdout/stderr)
+ *         in the child. The child starts with an empty signal mask.
+ *         On success stores the child pid in *pid and returns 0.
+ *         If the program could not be executed no child is left behind and
+ *         errno holds the exec error (e.g. ENOENT).
+ *
+ * SYS_PIPE_CLOEXEC (int fds[2], long size):
+ *         pipe with both ends close-on-exec (pipe2 O_CLOEXEC), so only the
+ *         descriptors explicitly dup'ed into a child survive its exec. If
+ *         size > 0 the pipe buffer is enlarged to at least size bytes with
+ *         F_SETPIPE_SZ; that part is best effort (the kernel may refuse sizes
+ *         above /proc/sys/fs/pipe-max-size) and never fails the call.
+ *
+ * SYS_PIDFD_OPEN (pid_t pid):
+ *         a descriptor (close-on-exec) referring to process pid, readable
+ *         once it has exited; fails with ENOSYS on kernels before 5.3.
+ *
+ * SYS_WAIT4 (pid_t pid, int *status, int options, struct rusage *ru):
+ *         like SYS_WAITPID, and when a child is reaped *ru (if not NULL)
+ *         receives its resource usage (CPU times, max RSS, faults, context
+ *         switches), as in wait4(2).
+ *
+ * SYS_IO_SUBMIT (io_req *reqs, int n):
+ *         queue reqs[0..n-1] on this thread's ring. With io_uring they reach
+ *         the kernel in one io_uring_enter and run asynchronously; with the
+ *         sync backend each one is done right away (open / pread / close).
+ *         The requests must stay where they are until reaped. Returns how
+ *         many were queued: fewer than n when the ring is full (reap, then
+ *         submit the rest).
+ *
+ * SYS_IO_REAP (int min):
+ *         collect finished requests of this thread (req->res, req->done = 1),
+ *         waiting until at least min of them finished (at most as many as
+ *         are in flight). Returns how many were collected.
+ *
+ * SYS_IO_BUFFERS (void ***bufs):
+ *         *bufs = this thread's IO_BUFS buffers of IO_BUF_SIZE bytes. With
+ *         io_uring they are registered as fixed buffers: a read into
+ *         buf_index i does not pin the pages per request. Returns IO_BUFS.
+ *
+ * SYS_IO_BACKEND (int backend):
+ *         IO_BACKEND_QUERY: the backend of this thread. IO_BACKEND_SYNC /
+ *         IO_BACKEND_URING: switch this thread to it; fails if the kernel
+ *         has no usable io_uring (ENOSYS when it lacks openat / read / close
+ *         for it), with EBUSY while requests are not reaped. A thread starts with io_uring when
+ *         the kernel has it, unless SMASH_IO_URING=0 is set.
+ *
+ * @return 0 / the call's result on success, -1 on failure (errno is set).
+ *         Unknown numbers fail with ENOSYS.
+ */
+long my_system_call_ext(int syscall_number, ...);
+
 #endif
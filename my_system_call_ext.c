@@ -0,0 +1,190 @@
+//my_system_call_ext.c
+#define _GNU_SOURCE     // pipe2, F_SETPIPE_SZ
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <stdarg.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "my_system_call.h"
+#include "io_ring.h"
+
+extern char **environ;
+
+/*=============================================================================
+* extended syscalls
+=============================================================================*/
+
+/*
+ * SYS_SPAWN: posix_spawnp into a process group (the same setpgid the fork
+ * path does in the child), optionally with stdin/stdout/stderr replaced.
+ * The child starts with an empty signal mask (smash blocks its job-control
+ * signals for the event loop).
+ * posix_spawn reports its failure as a return value, we convert it to the
+ * -1/errno convention of the wrapper.
+ */
+static long sys_spawn(va_list *args)
+{
+    pid_t *pid        = va_arg(*args, pid_t *);
+    const char *file  = va_arg(*args, const char *);
+    char *const *argv = va_arg(*args, char *const *);
+    pid_t pgid        = va_arg(*args, pid_t);
+    const int *fds    = va_arg(*args, const int *);
+
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_t *actions_p = NULL;
+
+    int err = posix_spawnattr_init(&attr);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+
+    sigset_t no_signals;
+    sigemptyset(&no_signals);
+
+    err = posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK);
+    if (err == 0)
+        err = posix_spawnattr_setpgroup(&attr, pgid);   // 0 = child's own pid
+    if (err == 0)
+        err = posix_spawnattr_setsigmask(&attr, &no_signals);
+
+    if (err == 0 && fds != NULL) {
+        err = posix_spawn_file_actions_init(&actions);
+        if (err == 0) {
+            actions_p = &actions;
+            // the source fds are close-on-exec, dup2 clears the flag on the copy
+            for (int i = 0; i < 3 && err == 0; ++i) {
+                if (fds[i] != -1 && fds[i] != i)
+                    err = posix_spawn_file_actions_adddup2(&actions, fds[i], i);
+            }
+        }
+    }
+
+    if (err == 0)
+        err = posix_spawnp(pid, file, actions_p, &attr, argv, environ);
+
+    if (actions_p)
+        posix_spawn_file_actions_destroy(actions_p);
+    posix_spawnattr_destroy(&attr);
+
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * SYS_PIPE_CLOEXEC: pipe2(O_CLOEXEC) plus an optional F_SETPIPE_SZ for
+ * high-throughput pipelines.
+ */
+static long sys_pipe_cloexec(va_list *args)
+{
+    int *fds  = va_arg(*args, int *);
+    long size = va_arg(*args, long);
+
+    if (pipe2(fds, O_CLOEXEC) == -1)
+        return -1;
+
+    if (size > 0) {
+        int saved_errno = errno;
+        (void)fcntl(fds[1], F_SETPIPE_SZ, (int)size);   // best effort
+        errno = saved_errno;
+    }
+    return 0;
+}
+
+/*
+ * SYS_PIDFD_OPEN: pidfd_open(2) (no glibc wrapper on older systems), the
+ * descriptor is close-on-exec.
+ */
+static long sys_pidfd_open(va_list *args)
+{
+    pid_t pid = va_arg(*args, pid_t);
+#ifdef SYS_pidfd_open
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void)pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/*
+ * SYS_WAIT4: waitpid that also returns the resource usage of the reaped child.
+ */
+static long sys_wait4(va_list *args)
+{
+    pid_t pid         = va_arg(*args, pid_t);
+    int *status       = va_arg(*args, int *);
+    int options       = va_arg(*args, int);
+    struct rusage *ru = va_arg(*args, struct rusage *);
+
+    return wait4(pid, status, options, ru);
+}
+
+/*
+ * SYS_IO_SUBMIT / SYS_IO_REAP / SYS_IO_BUFFERS / SYS_IO_BACKEND: batched file
+ * I/O on the calling thread's ring (io_ring.c).
+ */
+static long sys_io_submit(va_list *args)
+{
+    io_req *reqs = va_arg(*args, io_req *);
+    int n        = va_arg(*args, int);
+
+    return io_ring_submit(reqs, n);
+}
+
+static long sys_io_reap(va_list *args)
+{
+    return io_ring_reap(va_arg(*args, int));
+}
+
+static long sys_io_buffers(va_list *args)
+{
+    return io_ring_buffers(va_arg(*args, void ***));
+}
+
+static long sys_io_backend(va_list *args)
+{
+    return io_ring_backend(va_arg(*args, int));
+}
+
+/*=============================================================================
+* dispatch table, indexed by (syscall_number - SYS_SPAWN)
+=============================================================================*/
+typedef long (*ext_syscall_fn)(va_list *args);
+
+static const ext_syscall_fn ext_syscalls[] = {
+    sys_spawn,          // SYS_SPAWN
+    sys_pipe_cloexec,   // SYS_PIPE_CLOEXEC
+    sys_pidfd_open,     // SYS_PIDFD_OPEN
+    sys_wait4,          // SYS_WAIT4
+    sys_io_submit,      // SYS_IO_SUBMIT
+    sys_io_reap,        // SYS_IO_REAP
+    sys_io_buffers,     // SYS_IO_BUFFERS
+    sys_io_backend,     // SYS_IO_BACKEND
+};
+
+#define EXT_SYSCALLS_NUM ((int)(sizeof(ext_syscalls) / sizeof(ext_syscalls[0])))
+
+long my_system_call_ext(int syscall_number, ...)
+{
+    int idx = syscall_number - SYS_SPAWN;
+    if (idx < 0 || idx >= EXT_SYSCALLS_NUM) {
+        errno = ENOSYS;
+        return -1;
+    }
+
+    va_list args;
+    va_start(args, syscall_number);
+    long ret = ext_syscalls[idx](&args);
+    va_end(args);
+    return ret;
+}
@@ -0,0 +1,270 @@
+//parallel.c
+#define _GNU_SOURCE
+#include "parallel.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "my_system_call.h"
+
+#define ARGS_FILE_BLOCK 65536   // read size for :::: files
+
+/*=============================================================================
+* argument parsing
+=============================================================================*/
+
+// positive int from s, -1 if it is not one
+static int positive_int(const char *s)
+{
+    char *end;
+    errno = 0;
+    long v = strtol(s, &end, 10);
+    if (*s == '\0' || *end != '\0' || errno != 0 || v <= 0 || v > INT_MAX)
+        return -1;
+    return (int)v;
+}
+
+// whole contents of path in a (with a '\0' after it), NULL on error (message printed)
+static char* read_file(arena *a, const char *path, size_t *len)
+{
+    int fd = (int)my_system_call(SYS_OPEN, path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        fprintf(stderr, "smash error: parallel: %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    size_t cap = ARGS_FILE_BLOCK, used = 0;
+    int failed = 0;
+    char *buf = (char*)arena_alloc(a, cap + 1);
+    while (buf) {
+        long n = my_system_call(SYS_READ, fd, buf + used, cap - used);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1) {
+            fprintf(stderr, "smash error: parallel: %s: %s\n", path, strerror(errno));
+            failed = 1;
+        }
+        if (n <= 0)
+            break;
+
+        used += (size_t)n;
+        if (used == cap) {
+            // arena memory is never freed one by one: just move to a bigger block
+            char *bigger = (char*)arena_alloc(a, cap * 2 + 1);
+            if (bigger)
+                memcpy(bigger, buf, used);
+            buf = bigger;
+            cap *= 2;
+        }
+    }
+    my_system_call(SYS_CLOSE, fd);
+
+    if (!buf)
+        fprintf(stderr, "smash error: parallel: out of memory\n");
+    if (!buf || failed)
+        return NULL;
+    buf[used] = '\0';
+    *len = used;
+    return buf;
+}
+
+// the non-empty lines of the :::: files, cut up in place
+static int read_arg_files(arena *a, char **files, int nfiles, parallel_spec *spec)
+{
+    char **texts = (char**)arena_alloc(a, (size_t)nfiles * sizeof(char*));
+    size_t *lens = (size_t*)arena_alloc(a, (size_t)nfiles * sizeof(size_t));
+    if (!texts || !lens) {
+        fprintf(stderr, "smash error: parallel: out of memory\n");
+        return -1;
+    }
+
+    size_t lines = 0;
+    for (int f = 0; f < nfiles; ++f) {
+        texts[f] = read_file(a, files[f], &lens[f]);
+        if (!texts[f])
+            return -1;
+        for (char *p = texts[f]; (p = memchr(p, '\n', lens[f] - (size_t)(p - texts[f]))) != NULL; ++p)
+            lines++;
+        lines++;   // a last line without '\n'
+    }
+
+    spec->args = (char**)arena_alloc(a, lines * sizeof(char*));
+    if (!spec->args) {
+        fprintf(stderr, "smash error: parallel: out of memory\n");
+        return -1;
+    }
+
+    spec->nargs = 0;
+    for (int f = 0; f < nfiles; ++f) {
+        char *p = texts[f], *end = texts[f] + lens[f];
+        while (p < end) {
+            char *nl = (char*)memchr(p, '\n', (size_t)(end - p));
+            if (!nl)
+                nl = end;
+            *nl = '\0';
+            if (nl > p)
+                spec->args[spec->nargs++] = p;
+            p = nl + 1;
+        }
+    }
+    return 0;
+}
+
+/*=============================================================================
+* API
+=============================================================================*/
+
+int parallel_parse(arena *a, char **args, int argc, parallel_spec *spec)
+{
+    memset(spec, 0, sizeof(*spec));
+    spec->batch = 1;
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    spec->jobs = (cpus > 0 && cpus < INT_MAX) ? (int)cpus : 1;
+
+    // options
+    int i = 1;
+    for (; i + 1 <= argc && args[i][0] == '-'; i += 2) {
+        int v = positive_int(args[i + 1]);
+        if (v == -1 || (strcmp(args[i], "-j") != 0 && strcmp(args[i], "-n") != 0)) {
+            fprintf(stderr, "smash error: parallel: invalid arguments\n");
+            return -1;
+        }
+        if (args[i][1] == 'j')
+            spec->jobs = v;
+        else
+            spec->batch = v;
+    }
+
+    // template up to ::: / ::::
+    int sep = i;
+    while (sep <= argc && strcmp(args[sep], ":::") != 0 && strcmp(args[sep], "::::") != 0)
+        ++sep;
+    if (sep == i || sep > argc) {
+        fprintf(stderr, "smash error: parallel: invalid arguments\n");
+        return -1;
+    }
+
+    spec->tmpl  = args + i;
+    spec->ntmpl = sep - i;
+    for (int k = 0; k < spec->ntmpl; ++k) {
+        if (strstr(spec->tmpl[k], "{}") != NULL)
+            spec->has_braces = true;
+    }
+
+    if (strcmp(args[sep], ":::") == 0) {
+        spec->args  = args + sep + 1;
+        spec->nargs = argc - sep;
+        return 0;
+    }
+    if (sep == argc) {
+        fprintf(stderr, "smash error: parallel: invalid arguments\n");
+        return -1;
+    }
+    return read_arg_files(a, args + sep + 1, argc - sep, spec);
+}
+
+int parallel_invocations(const parallel_spec *spec)
+{
+    return (spec->nargs + spec->batch - 1) / spec->batch;
+}
+
+char** parallel_argv(arena *a, const parallel_spec *spec, int i)
+{
+    char **batch = spec->args + (size_t)i * spec->batch;
+    int n = spec->nargs - i * spec->batch;
+    if (n > spec->batch)
+        n = spec->batch;
+
+    // a word with {} becomes n words, without any {} the n arguments are appended
+    size_t words = spec->has_braces ? (size_t)spec->ntmpl * n : (size_t)(spec->ntmpl + n);
+    char **argv = (char**)arena_alloc(a, (words + 1) * sizeof(char*));
+    if (!argv)
+        return NULL;
+
+    size_t w = 0;
+    for (int k = 0; k < spec->ntmpl; ++k) {
+        const char *word = spec->tmpl[k];
+        if (strstr(word, "{}") == NULL) {
+            argv[w++] = (char*)word;
+            continue;
+        }
+        if (strcmp(word, "{}") == 0) {
+            for (int b = 0; b < n; ++b)
+                argv[w++] = batch[b];
+            continue;
+        }
+
+        // {} inside a word: one copy of the word per argument
+        for (int b = 0; b < n; ++b) {
+            size_t braces = 0, len = strlen(word), arg_len = strlen(batch[b]);
+            for (const char *p = word; (p = strstr(p, "{}")) != NULL; p += 2)
+                braces++;
+
+            char *out = (char*)arena_alloc(a, len - 2 * braces + braces * arg_len + 1);
+            if (!out)
+                return NULL;
+            argv[w++] = out;
+            for (const char *p = word; *p; ) {
+                if (p[0] == '{' && p[1] == '}') {
+                    memcpy(out, batch[b], arg_len);
+                    out += arg_len;
+                    p   += 2;
+                } else {
+                    *out++ = *p++;
+                }
+            }
+            *out = '\0';
+        }
+    }
+    if (!spec->has_braces) {
+        for (int b = 0; b < n; ++b)
+            argv[w++] = batch[b];
+    }
+    argv[w] = NULL;
+    return argv;
+}
+
+parallel_stats* parallel_stats_new(int total)
+{
+    void *p = mmap(NULL, sizeof(parallel_stats), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+
+    parallel_stats *s = (parallel_stats*)p;   // zero filled
+    s->total = total;
+    return s;
+}
+
+void parallel_stats_free(parallel_stats *s)
+{
+    munmap(s, sizeof(*s));
+}
+
+void parallel_stats_started(parallel_stats *s)
+{
+    __atomic_fetch_add(&s->started, 1, __ATOMIC_RELAXED);
+}
+
+void parallel_stats_finished(parallel_stats *s, bool failed)
+{
+    if (failed)
+        __atomic_fetch_add(&s->failed, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->done, 1, __ATOMIC_RELEASE);
+}
+
+void parallel_stats_print(FILE *out, const parallel_stats *s)
+{
+    int done    = __atomic_load_n(&s->done, __ATOMIC_ACQUIRE);
+    int failed  = __atomic_load_n(&s->failed, __ATOMIC_RELAXED);
+    int started = __atomic_load_n(&s->started, __ATOMIC_RELAXED);
+    int running = started - done;
+
+    fprintf(out, " (done %d, running %d, failed %d of %d)",
+            done, running > 0 ? running : 0, failed, s->total);
+}
@@ -0,0 +1,67 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include "arena.h"
+
+/*=============================================================================
+* parallel builtin: one command template over many arguments
+*
+*  parallel [-j N] [-n K] cmd [word...] ::: arg...
+*  parallel [-j N] [-n K] cmd [word...] :::: file...
+*
+*  - every invocation takes the next K arguments (default 1), -j N of them
+*    run at once (default: the number of CPUs)
+*  - a word {} stands for the arguments of the invocation, a word holding {}
+*    is repeated for each of them with {} replaced; without any {} the
+*    arguments go at the end
+*  - :::: reads the arguments from files, one per line
+*  - the whole run is one job: a driver process (forked smash) keeps N
+*    children going in its process group and publishes its counters in a
+*    shared mapping, so `jobs` shows done / running / failed
+=============================================================================*/
+
+typedef struct parallel_spec {
+    char **tmpl;          // the command template (NULL-terminated)
+    int ntmpl;
+    bool has_braces;      // some template word holds {}
+    char **args;
+    int nargs;
+    int jobs;             // -j, at most this many invocations running
+    int batch;            // -n, arguments per invocation
+} parallel_spec;
+
+// progress of a run, written by the driver, read by smash (shared mapping)
+typedef struct parallel_stats {
+    int total;            // invocations
+    int started;
+    int done;             // finished, successful or not
+    int failed;           // exited non-zero, killed or could not start
+} parallel_stats;
+
+/*
+ * Parse the arguments of the parallel builtin (args[1..argc]) into *spec;
+ * argument files are read into a. returns 0, or -1 (message printed)
+ */
+int parallel_parse(arena *a, char **args, int argc, parallel_spec *spec);
+
+// number of invocations spec makes
+int parallel_invocations(const parallel_spec *spec);
+
+// argv of invocation i, built in a; NULL if out of memory
+char** parallel_argv(arena *a, const parallel_spec *spec, int i);
+
+// counters for total invocations, shared with the processes forked after it; NULL on failure
+parallel_stats* parallel_stats_new(int total);
+
+void parallel_stats_free(parallel_stats *s);
+
+// driver side: an invocation started / finished
+void parallel_stats_started(parallel_stats *s);
+void parallel_stats_finished(parallel_stats *s, bool failed);
+
+// " (done D, running R, failed F of T)" for the job list
+void parallel_stats_print(FILE *out, const parallel_stats *s);
+
+#endif /* PARALLEL_H */
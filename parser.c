@@ -0,0 +1,455 @@
+//parser.c
+#include "parser.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// bytes the scans stop at
+static const char split_stops[] = "'\"\\|&";        // structure: quotes, escapes, operators
+static const char word_stops[]  = " \t\n'\"\\<>";   // inside a command: blanks, quotes, escapes, < >
+
+#define SPLIT_STOPS_NUM ((int)sizeof(split_stops) - 1)
+#define WORD_STOPS_NUM  ((int)sizeof(word_stops) - 1)
+
+/*=============================================================================
+* structs
+=============================================================================*/
+typedef struct span {
+    size_t start;
+    size_t end;               // exclusive
+} span;
+
+// what the structure scan found; the arrays are NULL on the counting pass
+typedef struct split {
+    span *stages;             // every command of every pipeline, in order
+    span *texts;              // text of each pipeline ('&' included)
+    int  *nstages_of;         // commands per pipeline
+    bool *background;
+    int nstages;
+    int npipes;
+} split;
+
+/*=============================================================================
+* scanning
+=============================================================================*/
+
+static int is_blank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n';
+}
+
+// length of the prefix of p[0..n) without any of the nstops bytes in stops
+static size_t skip_plain(const char *p, size_t n, const char *stops, int nstops)
+{
+    size_t i = 0;
+#if defined(__SSE2__)
+    __m128i set[8];   // room for the longest stop list
+    for (int k = 0; k < nstops; ++k)
+        set[k] = _mm_set1_epi8(stops[k]);
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i v   = _mm_loadu_si128((const __m128i*)(p + i));
+        __m128i hit = _mm_cmpeq_epi8(v, set[0]);
+        for (int k = 1; k < nstops; ++k)
+            hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, set[k]));
+
+        int mask = _mm_movemask_epi8(hit);
+        if (mask != 0)
+            return i + (size_t)__builtin_ctz((unsigned)mask);
+    }
+#endif
+    for (; i < n; ++i) {
+        if (memchr(stops, p[i], (size_t)nstops) != NULL)
+            return i;
+    }
+    return n;
+}
+
+// first non-blank at or after i (len if none)
+static size_t skip_blanks(const char *line, size_t i, size_t len)
+{
+    while (i < len && is_blank(line[i]))
+        ++i;
+    return i;
+}
+
+// closing quote of the one at line[i], len if unterminated
+static size_t closing_quote(const char *line, size_t i, size_t len)
+{
+    char q = line[i++];
+    while (i < len && line[i] != q) {
+        if (q == '"' && line[i] == '\\' && i + 1 < len)
+            ++i;   // \" does not close
+        ++i;
+    }
+    return i;
+}
+
+/*=============================================================================
+* pass 1: pipelines and commands (quote aware), counted or recorded
+=============================================================================*/
+
+static int end_stage(const char *line, split *sp, size_t start, size_t end, const char *near)
+{
+    if (skip_blanks(line, start, end) == end) {
+        fprintf(stderr, "smash error: parse: missing command near '%s'\n", near);
+        return -1;
+    }
+    if (sp->stages) {
+        sp->stages[sp->nstages].start = start;
+        sp->stages[sp->nstages].end   = end;
+        sp->nstages_of[sp->npipes]++;
+    }
+    sp->nstages++;
+    return 0;
+}
+
+static void end_pipe(const char *line, split *sp, size_t start, size_t end, bool bg)
+{
+    if (sp->texts) {
+        // trimmed
+        start = skip_blanks(line, start, end);
+        while (end > start && is_blank(line[end - 1]))
+            --end;
+        sp->texts[sp->npipes].start = start;
+        sp->texts[sp->npipes].end   = end;
+        sp->background[sp->npipes]  = bg;
+    }
+    sp->npipes++;
+}
+
+static int split_line(const char *line, size_t len, split *sp)
+{
+    sp->nstages = 0;
+    sp->npipes  = 0;
+
+    if (skip_blanks(line, 0, len) == len)
+        return 0;   // empty line
+
+    size_t pipe_start  = 0;
+    size_t stage_start = 0;
+    size_t i = 0;
+
+    while (1) {
+        i += skip_plain(line + i, len - i, split_stops, SPLIT_STOPS_NUM);
+        if (i >= len)
+            break;
+
+        switch (line[i]) {
+        case '\'':
+        case '"':
+            i = closing_quote(line, i, len);
+            if (i >= len) {
+                fprintf(stderr, "smash error: parse: unterminated quote\n");
+                return -1;
+            }
+            ++i;
+            break;
+
+        case '\\':
+            i += (i + 1 < len) ? 2 : 1;
+            break;
+
+        case '|':
+            if (end_stage(line, sp, stage_start, i, "|") == -1)
+                return -1;
+            stage_start = ++i;
+            break;
+
+        default:   // '&'
+            if (i + 1 < len && line[i + 1] == '&') {
+                if (end_stage(line, sp, stage_start, i, "&&") == -1)
+                    return -1;
+                end_pipe(line, sp, pipe_start, i, false);
+                i += 2;
+            } else {
+                // background: only blanks or && may follow
+                if (end_stage(line, sp, stage_start, i, "&") == -1)
+                    return -1;
+                end_pipe(line, sp, pipe_start, i + 1, true);
+                i = skip_blanks(line, i + 1, len);
+                if (i == len)
+                    return 0;
+                if (i + 1 >= len || line[i] != '&' || line[i + 1] != '&') {
+                    fprintf(stderr, "smash error: parse: unexpected text after '&'\n");
+                    return -1;
+                }
+                i += 2;
+            }
+            pipe_start = stage_start = i;
+            break;
+        }
+    }
+
+    if (end_stage(line, sp, stage_start, len, "&&") == -1)
+        return -1;
+    end_pipe(line, sp, pipe_start, len, false);
+    return 0;
+}
+
+/*=============================================================================
+* pass 2: words and redirections of one command, unquoted in place
+=============================================================================*/
+
+/*
+ * The word at *rp (not a blank), unquoted in place and '\0'-terminated; *rp
+ * moves past it and its blank. An unquoted '<' / '>' ends the word too: it is
+ * consumed and returned in *op ('\0' otherwise), the terminator may overwrite it.
+ */
+static char* next_word(char **rp, char *end, char *op)
+{
+    char *r    = *rp;
+    char *word = r;
+    char *w    = r;   // w <= r: the unquoted word is written over itself
+
+    *op = '\0';
+    while (r < end && !is_blank(*r)) {
+        size_t n = skip_plain(r, (size_t)(end - r), word_stops, WORD_STOPS_NUM);
+        if (w != r)
+            memmove(w, r, n);
+        w += n;
+        r += n;
+        if (r >= end || is_blank(*r))
+            break;
+
+        char c = *r++;
+        if (c == '<' || c == '>') {
+            *op = c;
+            break;
+        }
+        if (c == '\'') {
+            char *q = (char*)memchr(r, '\'', (size_t)(end - r));   // pass 1 saw it
+            memmove(w, r, (size_t)(q - r));
+            w += q - r;
+            r  = q + 1;
+        } else if (c == '"') {
+            while (r < end && *r != '"') {
+                if (*r == '\\' && r + 1 < end && strchr("\"\\$`", r[1]) != NULL)
+                    ++r;
+                *w++ = *r++;
+            }
+            ++r;   // closing quote
+        } else if (r < end) {   // backslash: next byte as is
+            *w++ = *r++;
+        }
+    }
+
+    *w = '\0';
+    if (*op == '\0' && r < end)
+        ++r;   // the blank after the word (maybe just overwritten)
+    *rp = r;
+    return word;
+}
+
+// -1 if out of memory, -2 on a syntax error (message printed)
+static int split_words(arena *a, char *line, span s, command *cmd)
+{
+    // a word takes at least one byte and a separator
+    size_t cap = (s.end - s.start) / 2 + 2;
+    cmd->argv = (char**)arena_alloc(a, cap * sizeof(char*));
+    if (!cmd->argv)
+        return -1;
+    cmd->argc     = 0;
+    cmd->no_alias = false;
+    cmd->redirs   = NULL;
+    cmd->nredirs  = 0;
+
+    char *r   = line + s.start;
+    char *end = line + s.end;
+
+    // at most one redirection per '<' / '>' (quoted ones overcount)
+    size_t nops = 0;
+    for (char *p = r; p < end; ++p)
+        nops += (*p == '<' || *p == '>');
+    if (nops > 0) {
+        cmd->redirs = (redirect*)arena_alloc(a, nops * sizeof(redirect));
+        if (!cmd->redirs)
+            return -1;
+    }
+
+    char op = '\0';   // operator that ended the word before, if any
+    while (1) {
+        if (op == '\0') {
+            while (r < end && is_blank(*r))
+                ++r;
+            if (r >= end)
+                break;
+            if (*r == '<' || *r == '>') {
+                op = *r++;
+            } else if (*r == '2' && r + 1 < end && r[1] == '>') {
+                r += 2;
+                op = '2';
+            } else {
+                cmd->argv[cmd->argc++] = next_word(&r, end, &op);
+                continue;
+            }
+        }
+
+        redirect *rd = &cmd->redirs[cmd->nredirs];
+        rd->fd   = (op == '<') ? 0 : (op == '2') ? 2 : 1;
+        rd->mode = (op == '<') ? REDIR_IN : REDIR_OUT;
+        if (op != '<' && r < end && *r == '>') {
+            rd->mode = REDIR_APPEND;
+            ++r;
+        }
+
+        while (r < end && is_blank(*r))
+            ++r;
+        if (r >= end || *r == '<' || *r == '>') {
+            fprintf(stderr, "smash error: parse: missing file name after '%s%s'\n",
+                    rd->fd == 0 ? "<" : rd->fd == 2 ? "2>" : ">",
+                    rd->mode == REDIR_APPEND ? ">" : "");
+            return -2;
+        }
+        rd->path = next_word(&r, end, &op);
+        cmd->nredirs++;
+    }
+
+    if (cmd->argc == 0) {
+        fprintf(stderr, "smash error: parse: missing command before a redirection\n");
+        return -2;
+    }
+    cmd->argv[cmd->argc] = NULL;
+    return 0;
+}
+
+// passes 1 (recording) and 2 over a line pass 1 already counted;
+// -1 if out of memory, -2 on a syntax error (message printed)
+static int build_line(arena *a, char *line, size_t len, int npipes, int nstages, cmd_line *out)
+{
+    split sp;
+    memset(&sp, 0, sizeof(sp));
+    sp.stages     = (span*)arena_alloc(a, (size_t)nstages * sizeof(span));
+    sp.texts      = (span*)arena_alloc(a, (size_t)npipes * sizeof(span));
+    sp.nstages_of = (int*)arena_alloc(a, (size_t)npipes * sizeof(int));
+    sp.background = (bool*)arena_alloc(a, (size_t)npipes * sizeof(bool));
+    out->chain    = (pipeline*)arena_alloc(a, (size_t)npipes * sizeof(pipeline));
+    command *cmds = (command*)arena_alloc(a, (size_t)nstages * sizeof(command));
+    if (!sp.stages || !sp.texts || !sp.nstages_of || !sp.background || !out->chain || !cmds)
+        return -1;
+
+    memset(sp.nstages_of, 0, (size_t)npipes * sizeof(int));
+    (void)split_line(line, len, &sp);   // same line: same result, now recorded
+
+    // the texts first: splitting the words overwrites the line
+    for (int p = 0; p < npipes; ++p) {
+        pipeline *pl = &out->chain[p];
+        pl->text = arena_strndup(a, line + sp.texts[p].start, sp.texts[p].end - sp.texts[p].start);
+        if (!pl->text)
+            return -1;
+        pl->background = sp.background[p];
+    }
+
+    int k = 0;
+    for (int p = 0; p < npipes; ++p) {
+        pipeline *pl = &out->chain[p];
+        pl->stages  = cmds + k;
+        pl->nstages = sp.nstages_of[p];
+        for (int st = 0; st < pl->nstages; ++st, ++k) {
+            int err = split_words(a, line, sp.stages[k], &cmds[k]);
+            if (err != 0)
+                return err;
+        }
+    }
+
+    out->nchain = npipes;
+    return 0;
+}
+
+/*=============================================================================
+* API
+=============================================================================*/
+
+int parse_line(arena *a, char *line, cmd_line *out)
+{
+    size_t len = strlen(line);
+    out->chain  = NULL;
+    out->nchain = 0;
+
+    split sp;
+    memset(&sp, 0, sizeof(sp));
+    if (split_line(line, len, &sp) == -1)
+        return -1;
+    if (sp.npipes == 0)
+        return 0;   // empty line
+
+    int err = build_line(a, line, len, sp.npipes, sp.nstages, out);
+    if (err != 0) {
+        if (err == -1)
+            fprintf(stderr, "smash error: parse: out of memory\n");
+        out->chain  = NULL;
+        out->nchain = 0;
+        return -1;
+    }
+    return 0;
+}
+
+void* cmd_line_clone(const cmd_line *src, cmd_line *dst)
+{
+    // sizes: structs and pointer arrays first (aligned), the strings after them
+    size_t ncmds = 0, nredirs = 0, nptrs = 0, nchars = 0;
+    for (int p = 0; p < src->nchain; ++p) {
+        const pipeline *pl = &src->chain[p];
+        nchars += strlen(pl->text) + 1;
+        for (int k = 0; k < pl->nstages; ++k) {
+            const command *c = &pl->stages[k];
+            ncmds++;
+            nptrs += (size_t)c->argc + 1;
+            for (int i = 0; i < c->argc; ++i)
+                nchars += strlen(c->argv[i]) + 1;
+            nredirs += (size_t)c->nredirs;
+            for (int i = 0; i < c->nredirs; ++i)
+                nchars += strlen(c->redirs[i].path) + 1;
+        }
+    }
+
+    size_t size = (size_t)src->nchain * sizeof(pipeline) + ncmds * sizeof(command)
+                + nredirs * sizeof(redirect) + nptrs * sizeof(char*) + nchars;
+    char *block = (char*)malloc(size ? size : 1);
+    if (!block)
+        return NULL;
+
+    pipeline *pls  = (pipeline*)block;
+    command  *cmds = (command*)(pls + src->nchain);
+    redirect *rds  = (redirect*)(cmds + ncmds);
+    char    **ptrs = (char**)(rds + nredirs);
+    char     *str  = (char*)(ptrs + nptrs);
+
+    for (int p = 0; p < src->nchain; ++p) {
+        const pipeline *from = &src->chain[p];
+        pipeline *to = &pls[p];
+        *to = *from;
+
+        size_t n = strlen(from->text) + 1;
+        to->text = (char*)memcpy(str, from->text, n);
+        str += n;
+
+        to->stages = cmds;
+        for (int k = 0; k < from->nstages; ++k, ++cmds) {
+            *cmds = from->stages[k];
+            cmds->argv = ptrs;
+            for (int i = 0; i < cmds->argc; ++i) {
+                n = strlen(from->stages[k].argv[i]) + 1;
+                *ptrs++ = (char*)memcpy(str, from->stages[k].argv[i], n);
+                str += n;
+            }
+            *ptrs++ = NULL;
+
+            cmds->redirs = cmds->nredirs ? rds : NULL;
+            for (int i = 0; i < cmds->nredirs; ++i, ++rds) {
+                *rds = from->stages[k].redirs[i];
+                n = strlen(rds->path) + 1;
+                rds->path = (char*)memcpy(str, rds->path, n);
+                str += n;
+            }
+        }
+    }
+
+    dst->chain  = pls;
+    dst->nchain = src->nchain;
+    return block;
+}
@@ -0,0 +1,64 @@
+#ifndef PARSER_H
+#define PARSER_H
+
+#include <stdbool.h>
+#include "arena.h"
+
+/*=============================================================================
+* command line parser
+*
+*  - line := pipeline [ && pipeline ]...     pipeline := command [ | command ]... [&]
+*  - words are split on blanks; '...' is literal, "..." allows \" \\ \$ \`,
+*    a backslash outside quotes makes the next character literal
+*  - redirections < file, > file, >> file, 2> file, 2>> file anywhere in a
+*    command (unquoted, blanks before the file optional) are taken out of its
+*    words; the last one for a descriptor wins
+*  - reentrant (no strtok, no globals): everything it builds lives in the
+*    caller's arena, argv words are slices of the line itself (the quotes and
+*    escapes are removed in place)
+*  - the blank / operator / quote scans run 16 bytes at a time (SSE2)
+=============================================================================*/
+
+// what a redirection opens the file for
+enum { REDIR_IN, REDIR_OUT, REDIR_APPEND };
+
+typedef struct redirect {
+    int fd;               // 0, 1 or 2
+    int mode;             // REDIR_IN / REDIR_OUT / REDIR_APPEND
+    char *path;
+} redirect;
+
+typedef struct command {
+    char **argv;          // NULL-terminated
+    int argc;
+    bool no_alias;        // argv[0] is not alias-expanded (an alias naming itself)
+    redirect *redirs;     // in the order they were typed
+    int nredirs;
+} command;
+
+typedef struct pipeline {
+    command *stages;
+    int nstages;
+    char *text;           // the pipeline as typed (trimmed, '&' included), for the job list
+    bool background;      // ended with '&'
+} pipeline;
+
+typedef struct cmd_line {
+    pipeline *chain;      // each runs only if the one before succeeded (&&)
+    int nchain;           // 0 = empty line
+} cmd_line;
+
+/*
+ * Parse line (modified in place, it must outlive *out) into *out.
+ * returns 0, or -1 on a syntax error / out of memory (message printed)
+ */
+int parse_line(arena *a, char *line, cmd_line *out);
+
+/*
+ * Deep copy of src (pipelines, commands, words, redirections, texts) into
+ * one malloc'd block, so a parsed line can outlive its arena. *dst is the
+ * copy; returns the block to free(), NULL if out of memory
+ */
+void* cmd_line_clone(const cmd_line *src, cmd_line *dst);
+
+#endif /* PARSER_H */
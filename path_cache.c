@@ -0,0 +1,491 @@
+//path_cache.c
+#define _POSIX_C_SOURCE 200809L
+#include "path_cache.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include "my_system_call.h"
+
+// execvp's search path when $PATH is unset
+#define DEFAULT_PATH "/bin:/usr/bin"
+
+#define PATH_CACHE_INIT_CAP 64   // must be a power of 2
+
+// inotify read buffer, in longs so struct inotify_event is properly aligned
+#define EVENT_BUF_LONGS (4096 / sizeof(long))
+
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+                    IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF)
+
+/*=============================================================================
+* structs
+=============================================================================*/
+typedef struct path_entry {
+    char *name;            // NULL = empty slot
+    char *path;            // NULL = negative entry ("cannot find program")
+    int dir_idx;           // $PATH index the program was found in, -1 if negative
+    unsigned long hits;
+} path_entry;
+
+/*=============================================================================
+* global variables & data structures
+=============================================================================*/
+// open addressing (linear probing) table, keyed by command name
+static path_entry *table = NULL;
+static size_t table_cap  = 0;
+static size_t table_used = 0;
+
+static unsigned long cache_hits   = 0;
+static unsigned long cache_misses = 0;
+
+// $PATH the cache was built for, split into directories
+static char *path_copy   = NULL;   // the $PATH string itself (for change detection)
+static char *dirs_buf    = NULL;   // split copy, dirs[] point into it
+static char **dirs       = NULL;
+static int  *dir_wd      = NULL;   // inotify watch per dir, -1 = not watched
+static int  *dir_missing = NULL;   // 1 = dir_wd is on its nearest existing parent
+static int   dirs_num    = 0;
+
+// dirs [0..first_unwatched) are watched; an entry is cacheable only if
+// no unwatched directory could shadow it
+static int first_unwatched = 0;
+
+static int inotify_fd = -1;
+
+// result of an uncached lookup, kept until the next call
+static char *uncached_result = NULL;
+
+/*=============================================================================
+* hash table helpers
+=============================================================================*/
+
+// FNV-1a
+static size_t hash_name(const char *s)
+{
+    size_t h = (size_t)14695981039346656037ULL;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= (size_t)1099511628211ULL;
+    }
+    return h;
+}
+
+static char* copy_str(const char *s)
+{
+    size_t len = strlen(s) + 1;
+    char *p = (char*)malloc(len);
+    if (p)
+        memcpy(p, s, len);
+    return p;
+}
+
+static path_entry* find_slot(path_entry *tab, size_t cap, const char *name)
+{
+    size_t i = hash_name(name) & (cap - 1);
+    while (tab[i].name != NULL && strcmp(tab[i].name, name) != 0)
+        i = (i + 1) & (cap - 1);
+    return &tab[i];
+}
+
+static void free_entry(path_entry *e)
+{
+    free(e->name);
+    free(e->path);
+    e->name = NULL;
+    e->path = NULL;
+}
+
+/*
+ * Rebuild the table, dropping every entry for which drop(entry, arg) is true.
+ * Used for invalidation (rare), so a full rehash keeps probing chains intact
+ * without tombstones.
+ */
+static void rebuild_table(size_t new_cap, int (*drop)(const path_entry*, int), int arg)
+{
+    path_entry *new_tab = (path_entry*)calloc(new_cap, sizeof(path_entry));
+    if (!new_tab) {
+        // out of memory: drop everything rather than keep stale entries
+        for (size_t i = 0; i < table_cap; ++i)
+            if (table[i].name)
+                free_entry(&table[i]);
+        table_used = 0;
+        return;
+    }
+
+    size_t used = 0;
+    for (size_t i = 0; i < table_cap; ++i) {
+        path_entry *e = &table[i];
+        if (!e->name)
+            continue;
+        if (drop && drop(e, arg)) {
+            free_entry(e);
+            continue;
+        }
+        *find_slot(new_tab, new_cap, e->name) = *e;
+        used++;
+    }
+
+    free(table);
+    table      = new_tab;
+    table_cap  = new_cap;
+    table_used = used;
+}
+
+static void insert_entry(const char *name, const char *path, int dir_idx)
+{
+    if (table == NULL) {
+        table = (path_entry*)calloc(PATH_CACHE_INIT_CAP, sizeof(path_entry));
+        if (!table)
+            return;
+        table_cap = PATH_CACHE_INIT_CAP;
+    } else if ((table_used + 1) * 10 >= table_cap * 7) {
+        rebuild_table(table_cap * 2, NULL, 0);
+    }
+
+    path_entry *e = find_slot(table, table_cap, name);
+    if (e->name)
+        return;   // already there
+
+    e->name = copy_str(name);
+    e->path = path ? copy_str(path) : NULL;
+    if (!e->name || (path && !e->path)) {
+        free_entry(e);
+        return;
+    }
+    e->dir_idx = dir_idx;
+    e->hits    = 0;
+    table_used++;
+}
+
+// drop entries that a change in directory `idx` may affect
+static int affected_by_dir(const path_entry *e, int idx)
+{
+    return e->path == NULL || e->dir_idx >= idx;
+}
+
+static int drop_all(const path_entry *e, int unused)
+{
+    (void)e;
+    (void)unused;
+    return 1;
+}
+
+/*=============================================================================
+* $PATH tracking
+=============================================================================*/
+
+static void release_dirs(void)
+{
+    if (inotify_fd != -1) {
+        my_system_call(SYS_CLOSE, inotify_fd);   // also removes every watch
+        inotify_fd = -1;
+    }
+    free(path_copy);
+    free(dirs_buf);
+    free(dirs);
+    free(dir_wd);
+    free(dir_missing);
+    path_copy = dirs_buf = NULL;
+    dirs      = NULL;
+    dir_wd    = NULL;
+    dir_missing = NULL;
+    dirs_num  = 0;
+    first_unwatched = 0;
+}
+
+/*
+ * Watch dirs[i]. A directory that does not exist (yet) holds no programs,
+ * so its nearest existing parent is watched instead: creating any part of
+ * the path shows up there. -1 if neither can be watched.
+ */
+static int watch_dir(int i)
+{
+    dir_wd[i]      = inotify_add_watch(inotify_fd, dirs[i], WATCH_MASK);
+    dir_missing[i] = 0;
+    if (dir_wd[i] != -1)
+        return 0;
+    if (errno != ENOENT && errno != ENOTDIR)
+        return -1;
+
+    char *parent = copy_str(dirs[i]);
+    if (!parent)
+        return -1;
+    char *slash;
+    while (dir_wd[i] == -1 && (slash = strrchr(parent, '/')) != NULL) {
+        slash[slash == parent] = '\0';   // keep the root's '/'
+        dir_wd[i] = inotify_add_watch(inotify_fd, parent, WATCH_MASK);
+        if (slash == parent)
+            break;
+    }
+    free(parent);
+    dir_missing[i] = 1;
+    return dir_wd[i] == -1 ? -1 : 0;
+}
+
+// drop a watch no directory uses any more (dirs can share one: same inode)
+static void unwatch_unused(int wd)
+{
+    for (int i = 0; i < dirs_num; ++i)
+        if (dir_wd[i] == wd)
+            return;
+    inotify_rm_watch(inotify_fd, wd);
+}
+
+// (re)build dirs[] and the inotify watches for a new $PATH value
+static void load_path(const char *path_env)
+{
+    release_dirs();
+    if (table)
+        rebuild_table(table_cap, drop_all, 0);
+
+    path_copy = copy_str(path_env);
+    dirs_buf  = copy_str(path_env);
+    if (!path_copy || !dirs_buf)
+        return;
+
+    int n = 1;
+    for (const char *p = path_env; *p; ++p)
+        if (*p == ':')
+            n++;
+
+    dirs        = (char**)malloc(n * sizeof(char*));
+    dir_wd      = (int*)malloc(n * sizeof(int));
+    dir_missing = (int*)calloc(n, sizeof(int));
+    if (!dirs || !dir_wd || !dir_missing)
+        return;
+
+    // split on ':' keeping empty elements (an empty element means ".")
+    char *start = dirs_buf;
+    for (char *p = dirs_buf; ; ++p) {
+        if (*p == ':' || *p == '\0') {
+            int last = (*p == '\0');
+            *p = '\0';
+            dirs[dirs_num]   = (*start == '\0') ? "." : start;
+            dir_wd[dirs_num] = -1;
+            dirs_num++;
+            if (last)
+                break;
+            start = p + 1;
+        }
+    }
+
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd == -1)
+        return;   // first_unwatched stays 0: nothing is cached
+
+    // relative dirs depend on the cwd, so they are never watched
+    for (int i = 0; i < dirs_num; ++i) {
+        if (dirs[i][0] != '/' || watch_dir(i) == -1)
+            break;
+        first_unwatched = i + 1;
+    }
+}
+
+/*
+ * Apply pending inotify events: a change in dir i can add a program that
+ * shadows entries found in later dirs, or remove entries found in dir i,
+ * and can satisfy any negative entry. A dir that went away, moved, or was
+ * missing and saw its parent change gets watched again.
+ */
+static void drain_events(void)
+{
+    if (inotify_fd == -1)
+        return;
+
+    long buf[EVENT_BUF_LONGS];
+    int min_idx = dirs_num;   // smallest dir index that changed
+    int lost = 0;
+
+    while (1) {
+        long r = my_system_call(SYS_READ, inotify_fd, buf, sizeof(buf));
+        if (r <= 0)
+            break;   // EAGAIN: no more events
+
+        char *p = (char*)buf;
+        while (p < (char*)buf + r) {
+            const struct inotify_event *ev = (const struct inotify_event*)p;
+            p += sizeof(struct inotify_event) + ev->len;
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                min_idx = 0;   // lost events: trust nothing
+                lost = 1;
+                continue;
+            }
+            for (int i = 0; i < first_unwatched; ++i) {
+                if (dir_wd[i] != ev->wd)
+                    continue;
+                if (i < min_idx)
+                    min_idx = i;
+                if (dir_missing[i] || (ev->mask & (IN_IGNORED | IN_MOVE_SELF))) {
+                    // the path may name another directory now: watch that
+                    int old_wd = dir_wd[i];
+                    if (watch_dir(i) == -1) {
+                        first_unwatched = i;   // stop caching from here on
+                        break;
+                    }
+                    if (!(ev->mask & IN_IGNORED) && dir_wd[i] != old_wd)
+                        unwatch_unused(old_wd);
+                }
+            }
+        }
+    }
+
+    // a missing dir may have been created in the events that were lost
+    for (int i = 0; lost && i < first_unwatched; ++i) {
+        if (dir_missing[i] && watch_dir(i) == -1)
+            first_unwatched = i;
+    }
+
+    if (min_idx < dirs_num && table)
+        rebuild_table(table_cap, affected_by_dir, min_idx);
+}
+
+// pick up $PATH changes and pending directory events
+static void sync_path(void)
+{
+    const char *path_env = getenv("PATH");
+    if (path_env == NULL)
+        path_env = DEFAULT_PATH;
+
+    if (path_copy == NULL || strcmp(path_copy, path_env) != 0)
+        load_path(path_env);
+    else
+        drain_events();
+}
+
+/*
+ * Walk $PATH like execvp: first directory with an executable regular file wins.
+ * Returns a malloc'ed path and its dir index, or NULL with *err = ENOENT/EACCES.
+ */
+static char* search_path(const char *name, int *dir_idx, int *err)
+{
+    size_t name_len = strlen(name);
+    *err = ENOENT;
+
+    for (int i = 0; i < dirs_num; ++i) {
+        size_t dir_len = strlen(dirs[i]);
+        char *full = (char*)malloc(dir_len + name_len + 2);
+        if (!full) {
+            *err = ENOMEM;
+            return NULL;
+        }
+        memcpy(full, dirs[i], dir_len);
+        full[dir_len] = '/';
+        memcpy(full + dir_len + 1, name, name_len + 1);
+
+        struct stat st;
+        if (stat(full, &st) == 0 && S_ISREG(st.st_mode)) {
+            if (access(full, X_OK) == 0) {
+                *dir_idx = i;
+                return full;
+            }
+            *err = EACCES;   // execvp reports EACCES if nothing better is found
+        }
+        free(full);
+    }
+    return NULL;
+}
+
+/*=============================================================================
+* API
+=============================================================================*/
+
+const char* path_cache_lookup(const char *name)
+{
+    if (strchr(name, '/') != NULL)
+        return name;
+
+    sync_path();
+
+    if (table) {
+        path_entry *e = find_slot(table, table_cap, name);
+        if (e->name) {
+            cache_hits++;
+            e->hits++;
+            if (!e->path) {
+                errno = ENOENT;
+                return NULL;
+            }
+            return e->path;
+        }
+    }
+
+    cache_misses++;
+
+    int dir_idx = -1, err = 0;
+    char *found = search_path(name, &dir_idx, &err);
+
+    free(uncached_result);
+    uncached_result = NULL;
+
+    if (!found) {
+        // negative entries are safe only if every $PATH dir is watched
+        if (err == ENOENT && first_unwatched == dirs_num && dirs_num > 0)
+            insert_entry(name, NULL, -1);
+        errno = err;
+        return NULL;
+    }
+
+    if (dir_idx < first_unwatched) {
+        insert_entry(name, found, dir_idx);
+        path_entry *e = table ? find_slot(table, table_cap, name) : NULL;
+        if (e && e->name) {
+            free(found);
+            return e->path;
+        }
+    }
+
+    uncached_result = found;
+    return found;
+}
+
+void path_cache_forget(const char *name)
+{
+    if (!table)
+        return;
+
+    path_entry *e = find_slot(table, table_cap, name);
+    if (!e->name)
+        return;
+
+    // free the slot, then re-insert the rest of its probe cluster
+    free_entry(e);
+    table_used--;
+    size_t i = ((size_t)(e - table) + 1) & (table_cap - 1);
+    while (table[i].name) {
+        path_entry moved = table[i];
+        table[i].name = NULL;
+        table[i].path = NULL;
+        *find_slot(table, table_cap, moved.name) = moved;
+        i = (i + 1) & (table_cap - 1);
+    }
+}
+
+void path_cache_flush(void)
+{
+    if (table)
+        rebuild_table(table_cap, drop_all, 0);
+}
+
+void path_cache_print(void)
+{
+    if (table_used == 0) {
+        printf("hash: hash table empty\n");
+    } else {
+        printf("hits\tcommand\n");
+        for (size_t i = 0; i < table_cap; ++i) {
+            const path_entry *e = &table[i];
+            if (!e->name)
+                continue;
+            if (e->path)
+                printf("%4lu\t%s\n", e->hits, e->path);
+            else
+                printf("%4lu\t%s (not found)\n", e->hits, e->name);
+        }
+    }
+    printf("hash: %lu hits, %lu misses\n", cache_hits, cache_misses);
+}
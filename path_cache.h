@@ -0,0 +1,34 @@
+#ifndef PATH_CACHE_H
+#define PATH_CACHE_H
+
+/*=============================================================================
+* resolved-path cache for external commands (like bash's `hash`)
+*
+*  - command name -> absolute path of the program found in $PATH
+*  - "cannot find program" misses are cached too (negative entries)
+*  - every $PATH directory is watched with inotify, a change in directory i
+*    drops the entries that directory could shadow or remove
+*  - a directory that does not exist has its nearest existing parent watched,
+*    and is watched itself once it shows up
+*  - a change of $PATH itself flushes the whole cache
+=============================================================================*/
+
+/*
+ * Resolve a command name the way execvp would.
+ *  - names containing '/' are returned as-is (never searched, never cached)
+ *  - returns the absolute path to exec, or NULL with errno set
+ *    (ENOENT = not found in any $PATH directory, EACCES = found but not executable)
+ * The returned string is owned by the cache and valid until the next call.
+ */
+const char* path_cache_lookup(const char *name);
+
+// drop the entry for name (e.g. exec of the cached path failed)
+void path_cache_forget(const char *name);
+
+// drop every entry (hash -r)
+void path_cache_flush(void);
+
+// print entries and hit/miss counters (hash)
+void path_cache_print(void);
+
+#endif /* PATH_CACHE_H */
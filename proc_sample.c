@@ -0,0 +1,283 @@
+//proc_sample.c
+#define _GNU_SOURCE
+#include "proc_sample.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "my_system_call.h"
+
+#define STAT_BUF      1024   // /proc/<pid>/stat is a few hundred bytes
+#define INDEX_INIT    256    // must be a power of 2
+#define NS_PER_SEC    1000000000LL
+#define MIN_WINDOW_NS 200000000LL   // shorter than this, CPU ticks (10 ms) are mostly rounding
+
+/*=============================================================================
+* structs
+=============================================================================*/
+
+// one process followed across refreshes
+typedef struct proc_entry {
+    pid_t pid;
+    int stat_fd;                  // -1 = over the descriptor budget, opened per sample
+    int statm_fd;
+    unsigned long long ticks;     // utime + stime at the newest baseline
+    long long ns;                 // CLOCK_BOOTTIME of it
+    unsigned long long prev_ticks;   // the baseline before, for samples close after it
+    long long prev_ns;
+    unsigned gen;                 // refresh it was last sampled in
+} proc_entry;
+
+/*=============================================================================
+* global variables & data structures
+=============================================================================*/
+static proc_entry *entries = NULL;
+static int nentries = 0;
+static int entries_cap = 0;
+
+static int *index_of = NULL;      // open addressing: pid -> entry number + 1, 0 = empty
+static int index_cap = 0;
+
+static unsigned gen = 0;
+static long long now_ns = 0;      // CLOCK_BOOTTIME of this refresh (stat's starttime clock)
+static long clk_tck = 0;
+static long page_kb = 0;
+static int fds_open = 0;
+static int fd_budget = -1;
+
+static char buf[STAT_BUF];
+
+/*=============================================================================
+* index
+=============================================================================*/
+
+static unsigned pid_hash(pid_t pid, int cap)
+{
+    return ((unsigned)pid * 2654435761u) & (unsigned)(cap - 1);
+}
+
+static int index_rebuild(int need)
+{
+    int cap = index_cap ? index_cap : INDEX_INIT;
+    while (cap < 2 * need)
+        cap *= 2;
+
+    int *idx = (int*)calloc((size_t)cap, sizeof(int));
+    if (!idx)
+        return -1;
+    for (int i = 0; i < nentries; ++i) {
+        unsigned h = pid_hash(entries[i].pid, cap);
+        while (idx[h] != 0)
+            h = (h + 1) & (unsigned)(cap - 1);
+        idx[h] = i + 1;
+    }
+    free(index_of);
+    index_of  = idx;
+    index_cap = cap;
+    return 0;
+}
+
+static proc_entry* entry_find(pid_t pid)
+{
+    if (index_cap == 0)
+        return NULL;
+    unsigned h = pid_hash(pid, index_cap);
+    while (index_of[h] != 0) {
+        proc_entry *e = &entries[index_of[h] - 1];
+        if (e->pid == pid)
+            return e;
+        h = (h + 1) & (unsigned)(index_cap - 1);
+    }
+    return NULL;
+}
+
+static proc_entry* entry_add(pid_t pid)
+{
+    if (nentries == entries_cap) {
+        int cap = entries_cap ? entries_cap * 2 : INDEX_INIT / 2;
+        proc_entry *grown = (proc_entry*)realloc(entries, (size_t)cap * sizeof(proc_entry));
+        if (!grown)
+            return NULL;
+        entries     = grown;
+        entries_cap = cap;
+    }
+    if (2 * (nentries + 1) > index_cap && index_rebuild(nentries + 1) == -1)
+        return NULL;
+
+    proc_entry *e = &entries[nentries++];
+    memset(e, 0, sizeof(*e));
+    e->pid      = pid;
+    e->stat_fd  = -1;
+    e->statm_fd = -1;
+
+    unsigned h = pid_hash(pid, index_cap);
+    while (index_of[h] != 0)
+        h = (h + 1) & (unsigned)(index_cap - 1);
+    index_of[h] = nentries;
+    return e;
+}
+
+/*=============================================================================
+* reading
+=============================================================================*/
+
+static int open_proc(pid_t pid, const char *file)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/%s", (int)pid, file);
+    return (int)my_system_call(SYS_OPEN, path, O_RDONLY | O_CLOEXEC);
+}
+
+static void close_fds(proc_entry *e)
+{
+    if (e->stat_fd != -1) {
+        my_system_call(SYS_CLOSE, e->stat_fd);
+        fds_open--;
+    }
+    if (e->statm_fd != -1) {
+        my_system_call(SYS_CLOSE, e->statm_fd);
+        fds_open--;
+    }
+    e->stat_fd = e->statm_fd = -1;
+}
+
+// read a whole /proc file from offset 0 into buf (NUL-terminated); keep = a new fd stays open
+static int read_proc(int *fd, pid_t pid, const char *file, bool keep)
+{
+    int own = *fd == -1;
+    if (own)
+        *fd = open_proc(pid, file);
+    if (*fd == -1)
+        return -1;
+
+    ssize_t n = pread(*fd, buf, sizeof(buf) - 1, 0);
+    if (own && !keep) {
+        my_system_call(SYS_CLOSE, *fd);
+        *fd = -1;
+    }
+    if (n <= 0)
+        return -1;   // ESRCH: the process is gone (its pid may be someone else's by now)
+    buf[n] = '\0';
+    return 0;
+}
+
+/*=============================================================================
+* API
+=============================================================================*/
+
+void proc_sample_begin(void)
+{
+    if (fd_budget == -1) {
+        struct rlimit rl;
+        long lim = (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY)
+                 ? (long)rl.rlim_cur : 1024;
+        fd_budget = (int)(lim / 4);
+        clk_tck   = sysconf(_SC_CLK_TCK);
+        page_kb   = sysconf(_SC_PAGESIZE) / 1024;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    now_ns = (long long)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+    gen++;
+}
+
+int proc_sample(pid_t pid, proc_info *out)
+{
+    proc_entry *e = entry_find(pid);
+    bool fresh = e == NULL;
+    if (fresh && (e = entry_add(pid)) == NULL)
+        return -1;
+    e->gen = gen;
+
+    // a new process gets descriptors kept open while the budget lasts
+    bool keep = fresh && fds_open + 2 <= fd_budget;
+
+    /* ---------- stat: "pid (comm) S ppid ... utime stime ... threads ... starttime" ---------- */
+    int stat_fd = e->stat_fd;
+    if (read_proc(&stat_fd, pid, "stat", keep) == -1) {
+        close_fds(e);
+        return -1;
+    }
+    if (keep && stat_fd != -1) {
+        e->stat_fd = stat_fd;
+        fds_open++;
+    }
+
+    char *p = strrchr(buf, ')');   // comm may hold spaces and parentheses
+    unsigned long long utime, stime, start;
+    long threads;
+    if (!p || sscanf(p + 2, "%c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu %*d %*d %*d %*d %ld %*d %llu",
+                     &out->state, &utime, &stime, &threads, &start) != 5) {
+        close_fds(e);
+        return -1;
+    }
+    out->threads = threads;
+
+    unsigned long long ticks = utime + stime;
+    if (fresh) {
+        // no sample yet: measured from the start of the process, like ps
+        e->ns = e->prev_ns = (long long)(start * (NS_PER_SEC / clk_tck));
+        e->ticks = e->prev_ticks = 0;
+    }
+
+    // against the newest baseline at least MIN_WINDOW_NS old, which then moves up
+    bool newest = now_ns - e->ns >= MIN_WINDOW_NS;
+    unsigned long long base_ticks = newest ? e->ticks : e->prev_ticks;
+    long long base_ns = newest ? e->ns : e->prev_ns;
+    out->cpu_pct = now_ns > base_ns
+        ? (double)(ticks - base_ticks) * (double)NS_PER_SEC / (double)clk_tck * 100.0
+          / (double)(now_ns - base_ns)
+        : 0.0;
+    if (newest) {
+        e->prev_ticks = e->ticks;
+        e->prev_ns    = e->ns;
+        e->ticks      = ticks;
+        e->ns         = now_ns;
+    }
+
+    /* ---------- statm: "size resident shared ..." (pages) ---------- */
+    int statm_fd = e->statm_fd;
+    bool keep_statm = e->stat_fd != -1 && statm_fd == -1;
+    long resident = 0;
+    if (read_proc(&statm_fd, pid, "statm", keep_statm) == -1 || sscanf(buf, "%*s %ld", &resident) != 1) {
+        if (keep_statm && statm_fd != -1)
+            my_system_call(SYS_CLOSE, statm_fd);
+        close_fds(e);
+        out->rss_kb = 0;
+        return 0;   // stat was read: gone just now, still worth a line
+    }
+    if (keep_statm) {
+        e->statm_fd = statm_fd;
+        fds_open++;
+    }
+    out->rss_kb = resident * page_kb;
+    return 0;
+}
+
+void proc_sample_end(void)
+{
+    int kept = 0;
+    for (int i = 0; i < nentries; ++i) {
+        if (entries[i].gen != gen) {
+            close_fds(&entries[i]);
+            continue;
+        }
+        entries[kept++] = entries[i];
+    }
+    if (kept == nentries)
+        return;
+    nentries = kept;
+    if (index_rebuild(nentries) == -1) {
+        // no index: start over, every process is new again next time
+        for (int i = 0; i < nentries; ++i)
+            close_fds(&entries[i]);
+        nentries = 0;
+        free(index_of);
+        index_of  = NULL;
+        index_cap = 0;
+    }
+}
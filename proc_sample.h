@@ -0,0 +1,39 @@
+#ifndef PROC_SAMPLE_H
+#define PROC_SAMPLE_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+/*=============================================================================
+* live process sampler (jobs -l / jobs -w)
+*
+*  - /proc/<pid>/stat (state, CPU ticks, threads) and /proc/<pid>/statm
+*    (resident pages) of every job process, read with pread into one
+*    reused buffer: the descriptors stay open across refreshes, a refresh
+*    is two preads per process, no open, no lseek
+*  - CPU% is since the previous sample of the same process (one at least
+*    200 ms older, CPU time comes in 10 ms ticks); a process seen for the
+*    first time is averaged over its lifetime, like ps does
+*  - descriptors are kept for at most a quarter of RLIMIT_NOFILE, processes
+*    past that budget are opened per sample
+*  - a refresh is proc_sample_begin, proc_sample per process, proc_sample_end;
+*    not thread-safe: callers hold the job table lock
+=============================================================================*/
+
+typedef struct proc_info {
+    char state;           // R S D T Z ... from stat
+    long threads;
+    long rss_kb;
+    double cpu_pct;       // 100 = one CPU busy
+} proc_info;
+
+// start a refresh
+void proc_sample_begin(void);
+
+// sample pid; 0 and *out filled, or -1 if it is gone
+int proc_sample(pid_t pid, proc_info *out);
+
+// end a refresh: processes not sampled in it are forgotten (descriptors closed)
+void proc_sample_end(void);
+
+#endif /* PROC_SAMPLE_H */
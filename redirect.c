@@ -0,0 +1,102 @@
+//redirect.c
+#define _GNU_SOURCE
+#include "redirect.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "my_system_call.h"
+
+#define SAVED_FD_MIN 10   // copies of 0 / 1 / 2 go above the descriptors programs expect
+#define WAS_CLOSED   (-2) // saved[i]: descriptor i was not open, close it again
+
+static int open_flags(int mode)
+{
+    switch (mode) {
+    case REDIR_IN:     return O_RDONLY;
+    case REDIR_APPEND: return O_WRONLY | O_CREAT | O_APPEND;
+    default:           return O_WRONLY | O_CREAT | O_TRUNC;
+    }
+}
+
+int redirect_open(const command *c, int fds[3])
+{
+    fds[0] = fds[1] = fds[2] = -1;
+
+    // in order: "> a > b" creates a, like other shells, and b gets the output
+    for (int i = 0; i < c->nredirs; ++i) {
+        const redirect *rd = &c->redirs[i];
+        int fd = (int)my_system_call(SYS_OPEN, rd->path, open_flags(rd->mode) | O_CLOEXEC, 0666);
+        if (fd == -1) {
+            fprintf(stderr, "smash error: redirect: %s: %s\n", rd->path, strerror(errno));
+            redirect_close(fds);
+            return -1;
+        }
+        if (fds[rd->fd] != -1)
+            my_system_call(SYS_CLOSE, fds[rd->fd]);
+        fds[rd->fd] = fd;
+    }
+    return 0;
+}
+
+void redirect_close(int fds[3])
+{
+    for (int i = 0; i < 3; ++i) {
+        if (fds[i] != -1)
+            my_system_call(SYS_CLOSE, fds[i]);
+        fds[i] = -1;
+    }
+}
+
+void redirect_apply(const int fds[3])
+{
+    for (int i = 0; i < 3; ++i) {
+        if (fds[i] != -1)
+            dup2(fds[i], i);   // the copy is not close-on-exec, the original is
+    }
+}
+
+int redirect_begin(const command *c, redirect_state *st)
+{
+    st->saved[0] = st->saved[1] = st->saved[2] = -1;
+    if (redirect_open(c, st->fds) == -1)
+        return -1;
+
+    // what smash buffered so far belongs to the old descriptors
+    fflush(stdout);
+    fflush(stderr);
+
+    for (int i = 0; i < 3; ++i) {
+        if (st->fds[i] == -1)
+            continue;
+        st->saved[i] = fcntl(i, F_DUPFD_CLOEXEC, SAVED_FD_MIN);
+        if (st->saved[i] == -1 && errno != EBADF) {
+            fprintf(stderr, "smash error: redirect: %s\n", strerror(errno));
+            redirect_end(st);
+            return -1;
+        }
+        if (st->saved[i] == -1)
+            st->saved[i] = WAS_CLOSED;
+        dup2(st->fds[i], i);
+    }
+    return 0;
+}
+
+void redirect_end(redirect_state *st)
+{
+    // the command's output goes to its files before they are let go
+    fflush(stdout);
+    fflush(stderr);
+
+    for (int i = 0; i < 3; ++i) {
+        if (st->saved[i] == WAS_CLOSED) {
+            my_system_call(SYS_CLOSE, i);
+        } else if (st->saved[i] != -1) {
+            dup2(st->saved[i], i);
+            my_system_call(SYS_CLOSE, st->saved[i]);
+        }
+        st->saved[i] = -1;
+    }
+    redirect_close(st->fds);
+}
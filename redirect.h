@@ -0,0 +1,42 @@
+#ifndef REDIRECT_H
+#define REDIRECT_H
+
+#include "parser.h"
+
+/*=============================================================================
+* redirections (< > >> 2> of a command, see parser.h)
+*
+*  - external commands: the files are opened close-on-exec in smash and
+*    handed to the child as its descriptors 0 / 1 / 2 (spawn file actions or
+*    dup2 after fork), nothing else of smash leaks into the program
+*  - builtins and aliases run in smash itself, no fork: stdout / stderr are
+*    flushed, 0 / 1 / 2 are pointed at the files for the duration of the
+*    command and put back afterwards
+=============================================================================*/
+
+// a command running in smash with its redirections in place
+typedef struct redirect_state {
+    int fds[3];           // the opened files, -1 = descriptor not redirected
+    int saved[3];         // copies of what 0 / 1 / 2 were before
+} redirect_state;
+
+/*
+ * Open the files of c's redirections (close-on-exec): fds[i] is the one for
+ * descriptor i, -1 if i is not redirected (the last redirection of i wins).
+ * returns 0, or -1 with nothing left open (message printed)
+ */
+int redirect_open(const command *c, int fds[3]);
+
+// close what redirect_open opened
+void redirect_close(int fds[3]);
+
+// in a child about to exec: make fds[i] descriptor i (no way back)
+void redirect_apply(const int fds[3]);
+
+// run smash's own code with c's redirections from here on; -1 on failure (message printed)
+int redirect_begin(const command *c, redirect_state *st);
+
+// put 0 / 1 / 2 back as they were before redirect_begin
+void redirect_end(redirect_state *st);
+
+#endif /* REDIRECT_H */
@@ -7,33 +7,36 @@
 #include "signals.h"
 #include "my_system_call.h"
 
-extern job_arr job_list;
-
 /* ----------------------------------------------------------
    Helpers
    ---------------------------------------------------------- */
 
-// is there a foreground job in slot 0? 
+// foreground job: slot 0, or a job resumed by fg (keeps its id, status FG)
+static job* get_foreground_job() {
+    if (job_at(&job_list, 0)->full)
+        return job_at(&job_list, 0);
+
+    if (job_list.resumed_fg_id != 0)
+        return find_job(&job_list, job_list.resumed_fg_id);
+    return NULL;
+}
+
+// is there a foreground job? 
 static int is_foreground_job_active() {
-    return job_list.jobs[0].full;
+    return get_foreground_job() != NULL;
 }
 
 // get pid of foreground job
 static pid_t get_foreground_pid() {
-    return job_list.jobs[0].pid;
-}
-
-// block delivery of all signals (save previous mask)
-static void block_all_signal_delivery(sigset_t* previous_mask) {
-    sigset_t all_signals;
-    sigfillset(&all_signals);
-    sigprocmask(SIG_SETMASK, &all_signals, previous_mask);
+    return get_foreground_job()->pid;
 }
 
-
-// restore previous signal mask
-static void restore_signal_mask(sigset_t* previous_mask) {
-    sigprocmask(SIG_SETMASK, previous_mask, NULL);
+// signals smash takes synchronously, through the event loop's signalfd
+void job_control_signals(sigset_t* set) {
+    sigemptyset(set);
+    sigaddset(set, SIGINT);
+    sigaddset(set, SIGTSTP);
+    sigaddset(set, SIGCHLD);
 }
 
 /* ----------------------------------------------------------
@@ -41,21 +44,12 @@ static void restore_signal_mask(sigset_t* previous_mask) {
    ---------------------------------------------------------- */
 void install_signal_handlers(void) {
 
-    
-    struct sigaction sa_sigint;
-    struct sigaction sa_sigtstp;
-    
-        // CTRL+C → SIGINT
-    sigemptyset(&sa_sigint.sa_mask);
-    sa_sigint.sa_handler = ctrl_c;
-    sa_sigint.sa_flags   = SA_RESTART;
-    sigaction(SIGINT, &sa_sigint, NULL);
-    
-        // CTRL+Z → SIGTSTP
-    sigemptyset(&sa_sigtstp.sa_mask);
-    sa_sigtstp.sa_handler = ctrl_z;
-    sa_sigtstp.sa_flags   = SA_RESTART;
-    sigaction(SIGTSTP, &sa_sigtstp, NULL);
+    // CTRL+C → SIGINT, CTRL+Z → SIGTSTP, child state changes → SIGCHLD:
+    // keep them blocked, so they queue up for the signalfd of the event loop
+    // (event_loop.c), which calls ctrl_c / ctrl_z from the main loop
+    sigset_t set;
+    job_control_signals(&set);
+    sigprocmask(SIG_BLOCK, &set, NULL);
 }
 
 /* wrapper so smash.c can call MainHandleConfigPack() */
@@ -64,6 +58,14 @@ void MainHandleConfigPack(void)
     install_signal_handlers();
 }
 
+/* forked children: take the signals again before running anything */
+void restore_child_signals(void)
+{
+    sigset_t set;
+    job_control_signals(&set);
+    sigprocmask(SIG_UNBLOCK, &set, NULL);
+}
+
 
 /* ----------------------------------------------------------
    CTRL+C (SIGINT)
@@ -72,17 +74,14 @@ void MainHandleConfigPack(void)
    {
        (void)sig;  // unused
    
-       sigset_t previous_mask;
-       block_all_signal_delivery(&previous_mask);
-   
        printf("\nsmash: caught CTRL+C\n");
        fflush(stdout);
    
        if (is_foreground_job_active()) {
            pid_t pid = get_foreground_pid();
    
-           // send SIGKILL to the foreground process via wrapper
-           long r = my_system_call(SYS_KILL, pid, SIGKILL);
+           // send SIGKILL to the foreground job (whole group for a pipeline)
+           long r = signal_job(get_foreground_job(), SIGKILL);
            if (r == -1) {
                perror("smash error: kill failed");
            } else {
@@ -91,7 +90,6 @@ void MainHandleConfigPack(void)
        }
    
        fflush(stdout);
-       restore_signal_mask(&previous_mask);
    }
 
 /* ----------------------------------------------------------
@@ -101,27 +99,23 @@ void MainHandleConfigPack(void)
    {
        (void)sig;  // unused
    
-       sigset_t previous_mask;
-       block_all_signal_delivery(&previous_mask);
-   
        printf("\nsmash: caught CTRL+Z\n");
        fflush(stdout);
    
        if (is_foreground_job_active()) {
            pid_t pid = get_foreground_pid();
    
-           // send SIGSTOP to the foreground process via wrapper
-           long r = my_system_call(SYS_KILL, pid, SIGSTOP);
+           // send SIGSTOP to the foreground job (whole group for a pipeline)
+           long r = signal_job(get_foreground_job(), SIGSTOP);
            if (r == -1) {
                perror("smash error: kill failed");
            } else {
                printf("smash: process %d was stopped\n", pid);
            }
            // We do NOT modify job_list here:
-           // run_external_command + waitpid(WUNTRACED) will see WIFSTOPPED
-           // and handle moving the job to background as STOPPED.
+           // the foreground wait (event_loop_wait_job) sees the stop and
+           // run_external_command moves the job to background as STOPPED.
        }
    
        fflush(stdout);
-       restore_signal_mask(&previous_mask);
    }
@@ -3,13 +3,19 @@
 
 #include <signal.h>
 
-/* install all signal handlers */
+/* block SIGINT/SIGTSTP/SIGCHLD, the event loop reads them from a signalfd */
 void install_signal_handlers(void);
 
+/* the signals smash handles through the event loop */
+void job_control_signals(sigset_t* set);
+
+/* unblock them again (forked children, before running a command) */
+void restore_child_signals(void);
+
 /* compatibility wrapper for your main (it calls MainHandleConfigPack) */
 void MainHandleConfigPack(void);
 
-/* signal handlers */
+/* handlers, called synchronously by the event loop */
 void ctrl_c(int sig);
 void ctrl_z(int sig);
 
@@ -1,13 +1,20 @@
 //smash.c
+#define _GNU_SOURCE
 
 /*=============================================================================
 * includes, defines, usings
 =============================================================================*/
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "commands.h"
 #include "signals.h"
-#include "jobs.c"
+#include "event_loop.h"
+#include "my_system_call.h"
+#include "trace.h"
 
 
 /*=============================================================================
@@ -17,61 +24,132 @@
 /*=============================================================================
 * global variables & data structures
 =============================================================================*/
-char _line[CMD_LENGTH_MAX];
+char* _line;   // current input line, lives in the reader's buffer (any length)
+
+// batch mode (smash -c, smash file, stdin not a terminal): fully buffered stdout
+#define BATCH_STDOUT_BUF 65536
+
+/*=============================================================================
+* batch mode diagnostics
+=============================================================================*/
+
+// stderr in batch mode: what the earlier commands printed goes out first,
+// so an error shows up after it and not ahead of it
+static ssize_t batch_stderr_write(void *cookie, const char *buf, size_t size)
+{
+	(void)cookie;
+	fflush(stdout);
+
+	size_t done = 0;
+	while (done < size) {
+		long r = my_system_call(SYS_WRITE, 2, buf + done, size - done);
+		if (r == -1 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			return done > 0 ? (ssize_t)done : -1;
+		done += (size_t)r;
+	}
+	return (ssize_t)done;
+}
+
+static void batch_stderr(void)
+{
+	cookie_io_functions_t io = { NULL, batch_stderr_write, NULL, NULL };
+	FILE *err = fopencookie(NULL, "w", io);
+	if (!err)
+		return;   // keep the plain stderr: only the order suffers
+	setvbuf(err, NULL, _IONBF, 0);
+	stderr = err;
+}
 
 /*=============================================================================
 * main function
 =============================================================================*/
 int main(int argc, char* argv[])
 {
-	char _cmd[CMD_LENGTH_MAX];
+	/* ---------- where the commands come from ----------
+	 *  smash              stdin (interactive if it is a terminal)
+	 *  smash -c "cmds"    the given text
+	 *  smash file         the script file
+	 */
+	const char *text = NULL;
+	int in_fd = 0;
+
+	if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+		if (argc < 3) {
+			fprintf(stderr, "smash error: -c: option requires an argument\n");
+			exit(2);
+		}
+		text  = argv[2];
+		in_fd = -1;
+	} else if (argc > 1) {
+		in_fd = (int)my_system_call(SYS_OPEN, argv[1], O_RDONLY | O_CLOEXEC);
+		if (in_fd == -1) {
+			fprintf(stderr, "smash error: %s: %s\n", argv[1], strerror(errno));
+			exit(127);
+		}
+	}
 
-	MainHandleConfigPack(); // initialize signals
+	// no prompt and one write per buffer instead of per line, unless someone types
+	int batch = (in_fd != 0) || !isatty(0);
+	if (batch) {
+		setvbuf(stdout, NULL, _IOFBF, BATCH_STDOUT_BUF);
+		batch_stderr();
+	}
+
+	MainHandleConfigPack(); // initialize signals (taken by the event loop)
 
 	init_job_arr(&job_list); //init jobs array
 
+	// input, signals and child exits all come through one epoll loop
+	if (event_loop_init(&job_list, in_fd) == -1
+	    || (text != NULL && event_loop_input_text(text) == -1)) {
+		perror("smash error: event loop");
+		exit(1);
+	}
 
-	while(1) {
-		printf("smash > "); //Every shell prints a prompt
-		fgets(_line, CMD_LENGTH_MAX, stdin); // reads a full line from the keyboard into line
+	int status = 0;   // of the last command, becomes smash's exit code
 
+	while(1) {
+		if (!batch) {
+			TRACE_BEGIN("prompt");
+			printf("smash > "); //Every shell prints a prompt
+			fflush(stdout);     // nobody reads stdin through stdio, so flush it ourselves
+			TRACE_END("prompt");
+		}
 
-		size_t len = strlen(_line);
-		if (len > 0 && _line[len - 1] == '\n') {
-			_line[len - 1] = '\0';
+		// reads a full line (without '\n'), reaping jobs / handling signals while idle
+		size_t len;
+		int last = 0;
+		TRACE_BEGIN("read_line");
+		_line = event_loop_read_line(&len, batch ? &last : NULL);
+		TRACE_END("read_line");
+		if (_line == NULL) {
+			break; // end of input
 		}
 
 		// skip empty/whitespace-only lines
 		int only_ws = 1;
-		for (char *p = _line; *p != '\0'; ++p) {
+		for (char *p = _line; p < _line + len; ++p) {
 			if (*p != ' ' && *p != '\t') {
 				only_ws = 0;
 				break;
 			}
 		}
 		if (only_ws) {
-			_line[0] = '\0';
 			continue;
 		}
 
-		update_jobs(&job_list); //before running any command, clean up finished jobs
-
-		 // ===== detect compound command (&&) =====
-        if (strstr(_line, "&&") != NULL) {
-            // handle chain "cmd1 && cmd2 && cmd3"
-            (void)handle_compound_commands(_line);
-        } else {
-            // ===== simple single command =====
-            strcpy(_cmd, _line);     // copy to parse buffer
-
-            int numArgs = parseCommand(_cmd);      // fills g_argv, sets g_is_bg
-            (void)command_Manager(numArgs, _line); // execute (we ignore return here)
-        }
-
-        // reset buffers for next line
-        _line[0] = '\0';
-        _cmd[0] = '\0';
+		// ===== last line of a script: a simple command replaces smash =====
+		TRACE_BEGIN("line");
+		if (last) {
+			status = run_last_line(_line);
+		} else {
+			// ===== "cmd1 | cmd2 && cmd3 &": parsed in place, then run =====
+			status = run_line(_line);
+		}
+		TRACE_END("line");
     }
 
-    return 0;
+    return status;
 }
@@ -0,0 +1,208 @@
+//stage_thread.c
+#define _GNU_SOURCE
+#include "stage_thread.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "my_system_call.h"
+#include "trace.h"
+
+#define STAGE_OUT_BUF (64 * 1024)   // one pipe buffer: a full one is a single write()
+
+/*=============================================================================
+* structs
+=============================================================================*/
+
+// one running stage: its own copy of the command and of the pipe ends
+typedef struct stage_arg {
+    const builtin *b;
+    cmd_line line;            // the one command, in block (the line arena is reset meanwhile)
+    void *block;
+    int in_fd;                // -1 = first stage
+    int out_fd;
+    shell_state *shell;
+    stage_threads *st;
+    job_arr *arr;
+    struct stage_arg *next;   // running list
+} stage_arg;
+
+/*=============================================================================
+* global variables & data structures
+=============================================================================*/
+static pthread_mutex_t list_lock = PTHREAD_MUTEX_INITIALIZER;
+static stage_arg *running_list = NULL;   // whose pipe ends a forked smash must close
+static bool atfork_set = false;
+
+/*=============================================================================
+* running list (fork safety)
+=============================================================================*/
+
+static void list_lock_for_fork(void)
+{
+    pthread_mutex_lock(&list_lock);
+}
+
+static void list_unlock_after_fork(void)
+{
+    pthread_mutex_unlock(&list_lock);
+}
+
+// the child has no stage threads: their pipe ends are only in the way
+static void close_stage_fds_in_child(void)
+{
+    for (stage_arg *a = running_list; a; a = a->next) {
+        if (a->in_fd != -1)
+            my_system_call(SYS_CLOSE, a->in_fd);
+        my_system_call(SYS_CLOSE, a->out_fd);
+    }
+    running_list = NULL;   // the argument blocks stay with the threads of the parent
+    pthread_mutex_unlock(&list_lock);
+}
+
+// list_lock held
+static void list_unlink(stage_arg *a)
+{
+    stage_arg **pp = &running_list;
+    while (*pp && *pp != a)
+        pp = &(*pp)->next;
+    if (*pp)
+        *pp = a->next;
+}
+
+/*=============================================================================
+* the thread
+=============================================================================*/
+
+static void* stage_main(void *p)
+{
+    stage_arg *a = (stage_arg*)p;
+    command *c = &a->line.chain[0].stages[0];
+
+    FILE *out = fdopen(a->out_fd, "w");
+    if (out) {
+        setvbuf(out, NULL, _IOFBF, STAGE_OUT_BUF);
+        exec_ctx ctx = { a->shell, out, a->line.chain[0].text, false, true };
+        TRACE_BEGIN("stage_thread");
+        a->b->handler(&ctx, c->argv, c->argc - 1);
+        TRACE_END("stage_thread");
+        fflush(out);   // EPIPE here if the reader is gone: nothing to do about it
+    }
+
+    // off the list and closed in one go: no fork in between may copy the ends
+    pthread_mutex_lock(&list_lock);
+    list_unlink(a);
+    if (out)
+        fclose(out);
+    else
+        my_system_call(SYS_CLOSE, a->out_fd);
+    if (a->in_fd != -1)
+        my_system_call(SYS_CLOSE, a->in_fd);
+    pthread_mutex_unlock(&list_lock);
+
+    job_table_lock(a->arr);
+    a->st->running--;
+    stage_threads_release(a->arr, a->st);
+    job_table_unlock(a->arr);
+
+    free(a->block);
+    free(a);
+    return NULL;
+}
+
+/*=============================================================================
+* API
+=============================================================================*/
+
+stage_threads* stage_threads_new(void)
+{
+    stage_threads *st = (stage_threads*)calloc(1, sizeof(stage_threads));
+    if (st)
+        st->refs = 1;
+    return st;
+}
+
+void stage_threads_release(job_arr *arr, stage_threads *st)
+{
+    if (!st)
+        return;
+    job_table_lock(arr);
+    bool last = --st->refs == 0;
+    job_table_unlock(arr);
+    if (last)
+        free(st);
+}
+
+int stage_thread_start(job_arr *arr, stage_threads *st, shell_state *shell,
+                       const builtin *b, const command *c, int in_fd, int out_fd)
+{
+    if (!atfork_set) {
+        if (pthread_atfork(list_lock_for_fork, list_unlock_after_fork, close_stage_fds_in_child) != 0)
+            return -1;
+        atfork_set = true;
+    }
+
+    stage_arg *a = (stage_arg*)calloc(1, sizeof(stage_arg));
+    if (!a)
+        return -1;
+
+    // a one-stage line of its own, the text is the command name
+    pipeline one = { (command*)c, 1, c->argv[0], false };
+    cmd_line src = { &one, 1 };
+    a->block = cmd_line_clone(&src, &a->line);
+
+    a->in_fd  = in_fd == -1 ? -1 : fcntl(in_fd, F_DUPFD_CLOEXEC, 0);
+    a->out_fd = fcntl(out_fd, F_DUPFD_CLOEXEC, 0);
+    if (!a->block || a->out_fd == -1 || (in_fd != -1 && a->in_fd == -1))
+        goto fail;
+
+    a->b     = b;
+    a->shell = shell;
+    a->st    = st;
+    a->arr   = arr;
+
+    job_table_lock(arr);
+    st->running++;
+    st->refs++;
+    job_table_unlock(arr);
+
+    pthread_mutex_lock(&list_lock);
+    a->next = running_list;
+    running_list = a;
+    pthread_mutex_unlock(&list_lock);
+
+    // every signal stays with the main thread: a closed pipe is EPIPE here
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t tid;
+    int err = pthread_create(&tid, &attr, stage_main, a);
+    pthread_attr_destroy(&attr);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (err == 0)
+        return 0;
+
+    pthread_mutex_lock(&list_lock);
+    list_unlink(a);
+    pthread_mutex_unlock(&list_lock);
+    job_table_lock(arr);
+    st->running--;
+    st->refs--;   // the caller still holds one
+    job_table_unlock(arr);
+
+fail:
+    if (a->in_fd != -1)
+        my_system_call(SYS_CLOSE, a->in_fd);
+    if (a->out_fd != -1)
+        my_system_call(SYS_CLOSE, a->out_fd);
+    free(a->block);
+    free(a);
+    return -1;
+}
@@ -0,0 +1,42 @@
+#ifndef STAGE_THREAD_H
+#define STAGE_THREAD_H
+
+#include "builtins.h"
+#include "jobs.h"
+#include "parser.h"
+
+/*=============================================================================
+* builtin pipeline stages on threads (jobs | grep x, diff -r a b | wc -l)
+*
+*  - a BI_THREAD builtin that feeds the next stage runs on a detached
+*    thread of smash instead of a forked copy of it: no fork, no exec
+*  - it writes into its pipe end through a buffered FILE of its own
+*    (ctx->out), with every signal blocked: a reader that went away is an
+*    EPIPE for it, never a SIGPIPE for smash
+*  - the threads of a pipeline are members of its job (job.threads), the
+*    count is kept under the job table lock
+*  - a forked copy of smash closes the pipe ends of running stage threads
+*    first thing, so they never keep a reader from seeing EOF
+=============================================================================*/
+
+// the stage threads of one job
+typedef struct stage_threads {
+    int running;          // stages not finished yet
+    int refs;             // the job (or its creator) + every running stage
+} stage_threads;
+
+// new set, one reference held by the caller; NULL if out of memory
+stage_threads* stage_threads_new(void);
+
+// drop a reference (job table lock held or not, it is taken)
+void stage_threads_release(job_arr *arr, stage_threads *st);
+
+/*
+ * Run builtin b (its command is c) on a thread of set st, reading in_fd and
+ * writing out_fd (copies are taken, the caller keeps and closes its own).
+ * returns 0, or -1 if no thread could be started (nothing changed)
+ */
+int stage_thread_start(job_arr *arr, stage_threads *st, shell_state *shell,
+                       const builtin *b, const command *c, int in_fd, int out_fd);
+
+#endif /* STAGE_THREAD_H */
@@ -0,0 +1,294 @@
+//thread_pool.c
+#define _GNU_SOURCE     // sysconf(_SC_NPROCESSORS_ONLN)
+#include "thread_pool.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define DEQUE_INIT_CAP 64      // must be a power of 2
+#define POOL_THREADS_MAX 64
+
+/*=============================================================================
+* structs
+=============================================================================*/
+typedef struct task {
+    task_fn fn;
+    void *arg;
+} task;
+
+// ring buffer: owner pushes/pops at tail, thieves take from head
+typedef struct deque {
+    pthread_mutex_t lock;
+    task *buf;
+    size_t cap;
+    size_t head;
+    size_t tail;
+} deque;
+
+typedef struct worker {
+    thread_pool *pool;
+    int index;           // also the index of the worker's own deque
+    int started;
+    pthread_t thread;
+} worker;
+
+struct thread_pool {
+    int nthreads;
+    worker *workers;
+    deque *deques;
+
+    pthread_mutex_t lock;         // protects everything below
+    pthread_cond_t  work_cond;    // new work or shutdown
+    pthread_cond_t  done_cond;    // pending dropped to 0
+    long queued;                  // tasks sitting in deques
+    long pending;                 // tasks submitted and not finished
+    unsigned next_deque;          // round-robin target for outside submits
+    int shutdown;
+};
+
+// index of the worker running on this thread, -1 outside the pool
+static __thread int worker_index = -1;
+static __thread thread_pool *worker_pool = NULL;
+
+/*=============================================================================
+* deque
+=============================================================================*/
+
+static int deque_init(deque *d)
+{
+    d->buf = (task*)malloc(DEQUE_INIT_CAP * sizeof(task));
+    if (!d->buf)
+        return -1;
+    d->cap  = DEQUE_INIT_CAP;
+    d->head = d->tail = 0;
+    pthread_mutex_init(&d->lock, NULL);
+    return 0;
+}
+
+// returns -1 if the deque could not grow
+static int deque_push(deque *d, task t)
+{
+    pthread_mutex_lock(&d->lock);
+    if (d->tail - d->head == d->cap) {
+        task *nbuf = (task*)malloc(2 * d->cap * sizeof(task));
+        if (!nbuf) {
+            pthread_mutex_unlock(&d->lock);
+            return -1;
+        }
+        for (size_t i = d->head; i != d->tail; ++i)
+            nbuf[i & (2 * d->cap - 1)] = d->buf[i & (d->cap - 1)];
+        free(d->buf);
+        d->buf = nbuf;
+        d->cap *= 2;
+    }
+    d->buf[d->tail & (d->cap - 1)] = t;
+    d->tail++;
+    pthread_mutex_unlock(&d->lock);
+    return 0;
+}
+
+// owner side: newest task
+static int deque_pop(deque *d, task *out)
+{
+    int found = 0;
+    pthread_mutex_lock(&d->lock);
+    if (d->tail != d->head) {
+        d->tail--;
+        *out = d->buf[d->tail & (d->cap - 1)];
+        found = 1;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return found;
+}
+
+// thief side: oldest task
+static int deque_steal(deque *d, task *out)
+{
+    int found = 0;
+    if (pthread_mutex_trylock(&d->lock) != 0)
+        return 0;   // owner or another thief is busy there, try elsewhere
+    if (d->tail != d->head) {
+        *out = d->buf[d->head & (d->cap - 1)];
+        d->head++;
+        found = 1;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return found;
+}
+
+/*=============================================================================
+* workers
+=============================================================================*/
+
+static int find_task(thread_pool *pool, int self, task *out)
+{
+    if (deque_pop(&pool->deques[self], out))
+        return 1;
+
+    for (int k = 1; k < pool->nthreads; ++k) {
+        if (deque_steal(&pool->deques[(self + k) % pool->nthreads], out))
+            return 1;
+    }
+    return 0;
+}
+
+// one task finished (pending was raised when it was submitted)
+static void task_done(thread_pool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->pending == 0)
+        pthread_cond_broadcast(&pool->done_cond);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void* worker_main(void *arg)
+{
+    worker *w = (worker*)arg;
+    thread_pool *pool = w->pool;
+    int self = w->index;
+
+    worker_index = self;
+    worker_pool  = pool;
+
+    while (1) {
+        task t;
+        if (find_task(pool, self, &t)) {
+            pthread_mutex_lock(&pool->lock);
+            pool->queued--;
+            pthread_mutex_unlock(&pool->lock);
+
+            t.fn(t.arg);
+            task_done(pool);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        // a trylock miss in find_task may hide work: only sleep if nothing is queued
+        // (queued can dip below 0 while a push is being counted)
+        while (pool->queued <= 0 && !pool->shutdown)
+            pthread_cond_wait(&pool->work_cond, &pool->lock);
+        int stop = pool->shutdown && pool->queued <= 0;
+        pthread_mutex_unlock(&pool->lock);
+        if (stop)
+            break;
+    }
+    return NULL;
+}
+
+/*=============================================================================
+* API
+=============================================================================*/
+
+thread_pool* thread_pool_create(int nthreads)
+{
+    if (nthreads <= 0)
+        nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads < 1)
+        nthreads = 1;
+    if (nthreads > POOL_THREADS_MAX)
+        nthreads = POOL_THREADS_MAX;
+
+    thread_pool *pool = (thread_pool*)calloc(1, sizeof(thread_pool));
+    if (!pool)
+        return NULL;
+
+    pool->workers = (worker*)calloc(nthreads, sizeof(worker));
+    pool->deques  = (deque*)calloc(nthreads, sizeof(deque));
+    if (!pool->workers || !pool->deques) {
+        free(pool->workers);
+        free(pool->deques);
+        free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+    pool->nthreads = nthreads;
+
+    for (int i = 0; i < nthreads; ++i) {
+        if (deque_init(&pool->deques[i]) == -1) {
+            pool->nthreads = i;
+            thread_pool_destroy(pool);
+            return NULL;
+        }
+    }
+
+    for (int i = 0; i < nthreads; ++i) {
+        pool->workers[i].pool  = pool;
+        pool->workers[i].index = i;
+        if (pthread_create(&pool->workers[i].thread, NULL, worker_main, &pool->workers[i]) != 0) {
+            // run with the workers we got (deques of missing ones get stolen from)
+            if (i == 0) {
+                thread_pool_destroy(pool);
+                return NULL;
+            }
+            break;
+        }
+        pool->workers[i].started = 1;
+    }
+    return pool;
+}
+
+void thread_pool_submit(thread_pool *pool, task_fn fn, void *arg)
+{
+    task t = { fn, arg };
+
+    // count it before it becomes visible, so pending can't drop to 0 early
+    pthread_mutex_lock(&pool->lock);
+    pool->pending++;
+    // a worker pushes to its own deque, everybody else round-robins
+    int target = (worker_pool == pool && worker_index >= 0)
+                     ? worker_index
+                     : (int)(pool->next_deque++ % (unsigned)pool->nthreads);
+    pthread_mutex_unlock(&pool->lock);
+
+    if (deque_push(&pool->deques[target], t) == -1) {
+        fn(arg);   // out of memory: run it inline rather than lose it
+        task_done(pool);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->queued++;
+    pthread_cond_signal(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void thread_pool_wait(thread_pool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0)
+        pthread_cond_wait(&pool->done_cond, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void thread_pool_destroy(thread_pool *pool)
+{
+    if (!pool)
+        return;
+
+    thread_pool_wait(pool);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    // every worker must be gone before any deque goes away (thieves touch them all)
+    for (int i = 0; i < pool->nthreads; ++i) {
+        if (pool->workers[i].started)
+            pthread_join(pool->workers[i].thread, NULL);
+    }
+    for (int i = 0; i < pool->nthreads; ++i) {
+        free(pool->deques[i].buf);
+        pthread_mutex_destroy(&pool->deques[i].lock);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_cond);
+    pthread_cond_destroy(&pool->done_cond);
+    free(pool->workers);
+    free(pool->deques);
+    free(pool);
+}
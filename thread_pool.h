@@ -0,0 +1,29 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+/*=============================================================================
+* work-stealing thread pool
+*
+*  - every worker owns a deque: it pops its own newest task (LIFO, cache-warm)
+*    and, when empty, steals the oldest task of another worker (FIFO)
+*  - tasks submitted from outside are spread round-robin over the deques
+*  - idle workers sleep until new work arrives
+=============================================================================*/
+
+typedef void (*task_fn)(void *arg);
+
+typedef struct thread_pool thread_pool;
+
+// nthreads <= 0 -> one worker per online CPU; returns NULL on failure
+thread_pool* thread_pool_create(int nthreads);
+
+// queue fn(arg); may be called from any thread, including from a task
+void thread_pool_submit(thread_pool *pool, task_fn fn, void *arg);
+
+// block until every submitted task has finished
+void thread_pool_wait(thread_pool *pool);
+
+// wait for the queued tasks, stop the workers and free the pool
+void thread_pool_destroy(thread_pool *pool);
+
+#endif /* THREAD_POOL_H */
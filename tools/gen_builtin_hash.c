@@ -0,0 +1,72 @@
+//gen_builtin_hash.c
+// build-time generator: a perfect hash of the builtin names in builtins.h
+// usage: gen_builtin_hash > builtin_hash.h
+#include <stdio.h>
+#include <string.h>
+#include "../builtins.h"
+
+#define NAME_OF(name, handler, min_args, max_args, msg, flags) name,
+
+static const char *names[] = { BUILTIN_LIST(NAME_OF) };
+
+#define NAMES_NUM ((int)(sizeof(names) / sizeof(names[0])))
+
+#define MAX_SEEDS 1000000u
+
+// 1 and slot[] filled if seed maps every name to its own slot of size
+static int try_seed(uint32_t seed, int size, int *slot)
+{
+    for (int s = 0; s < size; ++s)
+        slot[s] = -1;
+
+    for (int i = 0; i < NAMES_NUM; ++i) {
+        int s = (int)(builtin_hash(names[i], seed) & (uint32_t)(size - 1));
+        if (slot[s] != -1)
+            return 0;
+        slot[s] = i;
+    }
+    return 1;
+}
+
+int main(void)
+{
+    // a table at least twice the number of names keeps the search short
+    int size = 1;
+    while (size < 2 * NAMES_NUM)
+        size *= 2;
+
+    int slot[256];   // the generated table holds indexes as signed char
+    if (size > (int)(sizeof(slot) / sizeof(slot[0]))) {
+        fprintf(stderr, "gen_builtin_hash: too many builtins\n");
+        return 1;
+    }
+
+    for (int i = 0; i < NAMES_NUM; ++i) {
+        for (int k = 0; k < i; ++k) {
+            if (strcmp(names[i], names[k]) == 0) {
+                fprintf(stderr, "gen_builtin_hash: builtin '%s' listed twice\n", names[i]);
+                return 1;
+            }
+        }
+    }
+
+    uint32_t seed = 0;
+    while (seed < MAX_SEEDS && !try_seed(seed, size, slot))
+        seed++;
+    if (seed == MAX_SEEDS) {
+        fprintf(stderr, "gen_builtin_hash: no perfect hash found\n");
+        return 1;
+    }
+
+    printf("//builtin_hash.h - generated by tools/gen_builtin_hash from builtins.h, do not edit\n");
+    printf("#ifndef BUILTIN_HASH_H\n#define BUILTIN_HASH_H\n\n");
+    printf("#define BUILTIN_HASH_SEED  %uu\n", (unsigned)seed);
+    printf("#define BUILTIN_HASH_SIZE  %d\n", size);
+    printf("#define BUILTIN_HASH_COUNT %d\n\n", NAMES_NUM);
+    printf("// slot -> index in BUILTIN_LIST, -1 = no builtin hashes here\n");
+    printf("static const signed char builtin_slot[BUILTIN_HASH_SIZE] = {");
+    for (int s = 0; s < size; ++s)
+        printf("%s%d%s", (s % 16 == 0) ? "\n    " : " ", slot[s], (s + 1 < size) ? "," : "\n");
+    printf("};\n\n#endif /* BUILTIN_HASH_H */\n");
+    return 0;
+}
@@ -0,0 +1,149 @@
+//trace.c
+#define _GNU_SOURCE
+#include "trace.h"
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define TRACE_MASK (TRACE_EVENTS - 1)
+
+/*=============================================================================
+* structs
+=============================================================================*/
+
+typedef struct trace_rec {
+    uint64_t seq;             // claim number + 1 once written, 0 = empty / being written
+    int64_t ts;               // CLOCK_MONOTONIC ns
+    const char *name;         // static: the same address in forked copies
+    long arg;
+    int32_t pid;
+    int32_t tid;
+    char phase;
+} trace_rec;
+
+// the shared mapping: the claim counter, then the ring
+typedef struct trace_ring {
+    uint64_t head;            // next claim number
+    trace_rec recs[TRACE_EVENTS];
+} trace_ring;
+
+/*=============================================================================
+* global variables & data structures
+=============================================================================*/
+int trace_enabled = 0;
+static trace_ring *ring = NULL;   // mapped by the first trace on, kept for dumps
+
+/*=============================================================================
+* recording
+=============================================================================*/
+
+void trace_event(const char *name, char phase, long arg)
+{
+    trace_ring *r = ring;
+    if (!r)
+        return;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    uint64_t n = __atomic_fetch_add(&r->head, 1, __ATOMIC_RELAXED);
+    trace_rec *e = &r->recs[n & TRACE_MASK];
+
+    // readers skip the slot until seq says it holds claim n
+    __atomic_store_n(&e->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    e->ts    = (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    e->name  = name;
+    e->arg   = arg;
+    e->pid   = (int32_t)getpid();
+    e->tid   = (int32_t)syscall(SYS_gettid);
+    e->phase = phase;
+    __atomic_store_n(&e->seq, n + 1, __ATOMIC_RELEASE);
+}
+
+int trace_start(void)
+{
+    if (!ring) {
+        void *m = mmap(NULL, sizeof(trace_ring), PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (m == MAP_FAILED)
+            return -1;
+        ring = (trace_ring*)m;
+    } else {
+        __atomic_store_n(&trace_enabled, 0, __ATOMIC_RELAXED);
+        memset(ring, 0, sizeof(trace_ring));
+    }
+    __atomic_store_n(&trace_enabled, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void trace_stop(void)
+{
+    __atomic_store_n(&trace_enabled, 0, __ATOMIC_RELAXED);
+}
+
+/*=============================================================================
+* dump
+=============================================================================*/
+
+static void json_string(FILE *f, const char *s)
+{
+    fputc('"', f);
+    for (; *s; ++s) {
+        if (*s == '"' || *s == '\\')
+            fputc('\\', f);
+        if ((unsigned char)*s >= 0x20)
+            fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+long trace_dump(const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (!f)
+        return -1;
+
+    long count = 0;
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+    if (ring) {
+        uint64_t head  = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t first = head > TRACE_EVENTS ? head - TRACE_EVENTS : 0;
+        int64_t t0 = -1;
+
+        for (uint64_t n = first; n < head; ++n) {
+            const trace_rec *e = &ring->recs[n & TRACE_MASK];
+            if (__atomic_load_n(&e->seq, __ATOMIC_ACQUIRE) != n + 1)
+                continue;   // still being written, or overwritten already
+            trace_rec copy = *e;
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&e->seq, __ATOMIC_RELAXED) != n + 1)
+                continue;   // overwritten while copied
+
+            if (t0 == -1)
+                t0 = copy.ts;
+            int64_t rel = copy.ts - t0;   // microseconds with ns digits, from the first event
+
+            fprintf(f, "%s\n{\"name\":", count ? "," : "");
+            json_string(f, copy.name);
+            fprintf(f, ",\"ph\":\"%c\",\"ts\":%lld.%03lld,\"pid\":%d,\"tid\":%d",
+                    copy.phase, (long long)(rel / 1000), (long long)(rel % 1000),
+                    (int)copy.pid, (int)copy.tid);
+            if (copy.phase == 'i')
+                fprintf(f, ",\"s\":\"t\",\"args\":{\"arg\":%ld}", copy.arg);
+            fputc('}', f);
+            count++;
+        }
+    }
+
+    fprintf(f, "\n]}\n");
+    if (fclose(f) == EOF)
+        return -1;
+    return count;
+}
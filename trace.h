@@ -0,0 +1,41 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+/*=============================================================================
+* command-lifecycle tracing (trace on | off | dump <file>)
+*
+*  - tracepoints on the way from reading a line to the next prompt: input,
+*    parse, alias expansion, run_chain, command_Manager, reaping, fork /
+*    spawn, exec, waits, prompt output
+*  - every event is a fixed-size record (CLOCK_MONOTONIC ns, pid, tid, a
+*    static name, one number) in a ring of TRACE_EVENTS, the oldest are
+*    overwritten; a slot is claimed with one atomic add, no lock, so stage
+*    threads and forked copies of smash (the ring is a shared mapping)
+*    record into the same ring
+*  - tracing off: a tracepoint is one load and a branch not taken
+*  - dump: Chrome trace_event JSON, opens in ui.perfetto.dev / chrome://tracing
+=============================================================================*/
+
+#define TRACE_EVENTS (1 << 16)   // ring size (a power of 2), about 3 MB
+
+extern int trace_enabled;
+
+// record one event: phase 'B' (begin), 'E' (end) or 'i' (instant); name must be static
+void trace_event(const char *name, char phase, long arg);
+
+#define TRACE_ON() __builtin_expect(__atomic_load_n(&trace_enabled, __ATOMIC_RELAXED), 0)
+
+#define TRACE_BEGIN(name)     do { if (TRACE_ON()) trace_event(name, 'B', 0); } while (0)
+#define TRACE_END(name)       do { if (TRACE_ON()) trace_event(name, 'E', 0); } while (0)
+#define TRACE_MARK(name, arg) do { if (TRACE_ON()) trace_event(name, 'i', (long)(arg)); } while (0)
+
+// start a new recording (the ring is emptied); -1 with errno if it can't be mapped
+int trace_start(void);
+
+// stop recording, what was recorded stays for trace_dump
+void trace_stop(void);
+
+// write the ring as Chrome JSON to path; returns the number of events, -1 with errno
+long trace_dump(const char *path);
+
+#endif /* TRACE_H */